@@ -0,0 +1,126 @@
+#include "BatchRunner.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+// 每个工作线程一个任务队列：自己从头部取，其他线程从尾部窃取
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<size_t> items;
+};
+
+static bool takeFront(WorkQueue& queue, size_t& item)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.items.empty())
+        return false;
+    item = queue.items.front();
+    queue.items.pop_front();
+    return true;
+}
+
+static bool stealBack(WorkQueue& queue, size_t& item)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.items.empty())
+        return false;
+    item = queue.items.back();
+    queue.items.pop_back();
+    return true;
+}
+
+static int symbolBars(const SymbolInput& input)
+{
+    int bars = 0;
+    for (const auto& pair : input.series)
+        if (pair.second)
+            bars = std::max(bars, pair.second->size());
+    return bars;
+}
+
+static void runSymbol(const Bytecode& bytecode, const SymbolInput& input, SymbolResult& result)
+{
+    result.symbol = input.symbol;
+    try
+    {
+        PineVM vm;
+        for (const auto& pair : input.series)
+            vm.registerSeries(pair.first, pair.second);
+        vm.loadBytecode(bytecode);
+        result.status = vm.execute(symbolBars(input));
+        if (result.status != 0)
+            result.error_message = vm.getLastErrorMessage();
+        for (const Value& global : vm.getGlobalSeries())
+        {
+            const auto* series = std::get_if<std::shared_ptr<Series>>(&global);
+            result.series.push_back(series ? *series : nullptr);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        result.status = 1;
+        result.error_message = e.what();
+    }
+}
+
+void runTasks(size_t count, int threads, const std::function<void(size_t)>& task, const std::function<int(size_t)>& cost)
+{
+    if (threads <= 0)
+        threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    threads = static_cast<int>(std::min<size_t>(threads, count));
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+            task(i);
+        return;
+    }
+
+    // 开销大的任务先开始，轮流发到各队列，使初始负载大致均衡
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    if (cost)
+    {
+        std::vector<int> costs(count);
+        for (size_t i = 0; i < count; ++i)
+            costs[i] = cost(i);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+    }
+
+    std::vector<WorkQueue> queues(threads);
+    for (size_t k = 0; k < order.size(); ++k)
+        queues[k % threads].items.push_back(order[k]);
+
+    // 任务在开始后不再增加，所以所有队列都取空时即可退出
+    auto worker = [&](int self) {
+        size_t item;
+        for (;;)
+        {
+            bool found = takeFront(queues[self], item);
+            for (int k = 1; !found && k < threads; ++k)
+                found = stealBack(queues[(self + k) % threads], item);
+            if (!found)
+                return;
+            task(item);
+        }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (int t = 1; t < threads; ++t)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : pool)
+        thread.join();
+}
+
+std::vector<SymbolResult> runBatch(const Bytecode& bytecode, const std::vector<SymbolInput>& inputs, int threads)
+{
+    std::vector<SymbolResult> results(inputs.size());
+    runTasks(
+        inputs.size(), threads,
+        [&](size_t i) { runSymbol(bytecode, inputs[i], results[i]); },
+        [&](size_t i) { return symbolBars(inputs[i]); });
+    return results;
+}
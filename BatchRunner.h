@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PineVM.h"
+
+#include <functional>
+
+//-----------------------------------------------------------------------------
+// 多品种批量计算
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief 一个品种的输入列：序列名称 (open、high、low、close、volume、time 等) -> 数据。
+ *        以只读方式注册到 VM，不复制；同一份数据可以出现在多个输入中。
+ */
+struct SymbolInput {
+    std::string symbol;
+    std::map<std::string, std::shared_ptr<const Series>> series;
+};
+
+/**
+ * @brief 一个品种的计算结果。
+ */
+struct SymbolResult {
+    std::string symbol;
+    int status = 0;            // PineVM::execute 的返回值，0 表示成功
+    std::string error_message; // status 非 0 时的错误信息
+    std::vector<std::shared_ptr<Series>> series; // 全局序列，顺序与 PineVM::getGlobalSeries 一致，未赋值的为空
+};
+
+/**
+ * @brief 用同一份已编译的字节码计算多个品种。
+ *        每个品种由一个独立的 PineVM 计算，K线数取该品种最长的输入序列。
+ *        品种按K线数从多到少轮流分配到各工作线程的队列，线程处理完自己的队列后
+ *        从其他线程的队列尾部窃取任务，品种长短悬殊时各线程也能同时结束。
+ * @param bytecode 编译器输出的字节码 (只读，所有线程共享)。
+ * @param inputs 各品种的输入。
+ * @param threads 工作线程数；<= 0 时使用 std::thread::hardware_concurrency()。
+ * @return 与 inputs 一一对应的结果。
+ */
+std::vector<SymbolResult> runBatch(const Bytecode& bytecode, const std::vector<SymbolInput>& inputs, int threads = 0);
+
+/**
+ * @brief 在工作线程上执行 count 个相互独立的任务 (runBatch 与参数扫描共用)。
+ *        任务按 cost 从大到小轮流分配到各线程的队列，空闲线程从其他队列尾部窃取。
+ * @param task 执行第 i 个任务；不同任务可能在不同线程上同时执行。
+ * @param cost 第 i 个任务的相对开销；为空时按原顺序分配。
+ */
+void runTasks(size_t count, int threads, const std::function<void(size_t)>& task, const std::function<int(size_t)>& cost = nullptr);
@@ -0,0 +1,159 @@
+#include "BytecodeLibrary.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kLibraryMagic[4] = {'P', 'V', 'M', 'L'};
+
+template <typename T>
+static void writePod(std::ostream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void BytecodeLibrary::write(const std::string& path, const std::vector<std::pair<std::string, Bytecode>>& formulas)
+{
+    std::vector<std::string> blobs;
+    uint64_t header = sizeof(kLibraryMagic) + 2 * sizeof(uint32_t);
+    for (const auto& formula : formulas)
+    {
+        blobs.push_back(bytecodeToBinary(formula.second));
+        header += sizeof(uint32_t) + formula.first.size() + 2 * sizeof(uint64_t);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot write bytecode library: " + path);
+    out.write(kLibraryMagic, sizeof(kLibraryMagic));
+    writePod(out, kVersion);
+    writePod(out, static_cast<uint32_t>(formulas.size()));
+    uint64_t offset = header;
+    for (size_t i = 0; i < formulas.size(); ++i)
+    {
+        writePod(out, static_cast<uint32_t>(formulas[i].first.size()));
+        out.write(formulas[i].first.data(), static_cast<std::streamsize>(formulas[i].first.size()));
+        writePod(out, offset);
+        writePod(out, static_cast<uint64_t>(blobs[i].size()));
+        offset += blobs[i].size();
+    }
+    for (const auto& blob : blobs)
+        out.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+    if (!out)
+        throw std::runtime_error("Cannot write bytecode library: " + path);
+}
+
+void BytecodeLibrary::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot open bytecode library: " + path);
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    size_ = static_cast<size_t>(file_size.QuadPart);
+    HANDLE mapping = size_ ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    CloseHandle(file);
+    if (mapping)
+    {
+        data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        mapping_ = mapping;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open bytecode library: " + path);
+    struct stat info;
+    size_ = fstat(fd, &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+    if (size_)
+    {
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        data_ = p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+    }
+    ::close(fd);
+#endif
+    if (!data_)
+    {
+        close();
+        throw std::runtime_error("Cannot map bytecode library: " + path);
+    }
+
+    // 只解析索引，公式本身在 load 时解码
+    size_t offset = 0;
+    auto take = [&](size_t n) {
+        if (n > size_ - offset)
+            throw std::runtime_error("Bytecode library is truncated: " + path);
+        const char* p = data_ + offset;
+        offset += n;
+        return p;
+    };
+    auto read = [&](auto& value) { std::memcpy(&value, take(sizeof(value)), sizeof(value)); };
+    try
+    {
+        if (std::memcmp(take(sizeof(kLibraryMagic)), kLibraryMagic, sizeof(kLibraryMagic)) != 0)
+            throw std::runtime_error("Not a bytecode library: " + path);
+        uint32_t version, count;
+        read(version);
+        if (version != kVersion)
+            throw std::runtime_error("Unsupported bytecode library version " + std::to_string(version) + ": " + path);
+        read(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Entry entry;
+            uint32_t length;
+            read(length);
+            entry.name.assign(take(length), length);
+            read(entry.offset);
+            read(entry.size);
+            if (entry.offset > size_ || entry.size > size_ - entry.offset)
+                throw std::runtime_error("Bytecode library is truncated: " + path);
+            index_.emplace(entry.name, entries_.size());
+            entries_.push_back(std::move(entry));
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+void BytecodeLibrary::close()
+{
+#ifdef _WIN32
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle(static_cast<HANDLE>(mapping_));
+#else
+    if (data_)
+        munmap(const_cast<char*>(data_), size_);
+#endif
+    data_ = nullptr;
+    mapping_ = nullptr;
+    size_ = 0;
+    entries_.clear();
+    index_.clear();
+}
+
+int BytecodeLibrary::find(const std::string& name) const
+{
+    auto it = index_.find(name);
+    return it == index_.end() ? -1 : static_cast<int>(it->second);
+}
+
+Bytecode BytecodeLibrary::load(size_t index) const
+{
+    const Entry& entry = entries_.at(index);
+    return binaryToBytecode(data_ + entry.offset, static_cast<size_t>(entry.size));
+}
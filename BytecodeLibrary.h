@@ -0,0 +1,65 @@
+#pragma once
+
+#include "VMCommon.h"
+
+#include <unordered_map>
+#include <utility>
+
+//-----------------------------------------------------------------------------
+// 预编译公式库
+//-----------------------------------------------------------------------------
+
+/**
+ * @class BytecodeLibrary
+ * @brief 把大量已编译的公式按名称存放在一个文件中，打开时以内存映射方式只读取索引，
+ *        每个公式在 load 时才从映射区解码 (二进制字节码，见 bytecodeToBinary)。
+ *        文件格式 (本机字节序)：魔数 "PVML"、版本号、公式个数，
+ *        然后是每个公式的名称、数据偏移和长度，最后是各公式的二进制字节码。
+ *        打开后只读，多个线程可以同时 load。
+ */
+class BytecodeLibrary {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    BytecodeLibrary() = default;
+    ~BytecodeLibrary() { close(); }
+    BytecodeLibrary(const BytecodeLibrary&) = delete;
+    BytecodeLibrary& operator=(const BytecodeLibrary&) = delete;
+
+    /**
+     * @brief 把公式写成库文件。
+     * @throws std::runtime_error 文件无法写入。
+     */
+    static void write(const std::string& path, const std::vector<std::pair<std::string, Bytecode>>& formulas);
+
+    /**
+     * @brief 映射并打开库文件 (先关闭已打开的文件)。
+     * @throws std::runtime_error 文件无法打开或不是公式库。
+     */
+    void open(const std::string& path);
+    void close();
+
+    size_t size() const { return entries_.size(); }
+    const std::string& name(size_t index) const { return entries_[index].name; }
+    // 返回公式的下标，不存在时返回 -1
+    int find(const std::string& name) const;
+
+    /**
+     * @brief 解码第 index 个公式，可直接交给 PineVM::loadBytecode。
+     * @throws std::runtime_error 数据损坏或校验和不符。
+     */
+    Bytecode load(size_t index) const;
+
+private:
+    struct Entry {
+        std::string name;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    void* mapping_ = nullptr; // Windows 下的映射句柄
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string, size_t> index_;
+};
@@ -0,0 +1,910 @@
+#include "BytecodeOptimizer.h"
+#include "VMKernels.h"
+#include "PineVM.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+//-----------------------------------------------------------------------------
+// 辅助函数
+//-----------------------------------------------------------------------------
+
+static bool isBinaryOp(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::ADD:
+    case OpCode::SUB:
+    case OpCode::MUL:
+    case OpCode::DIV:
+    case OpCode::LESS:
+    case OpCode::LESS_EQUAL:
+    case OpCode::EQUAL_EQUAL:
+    case OpCode::BANG_EQUAL:
+    case OpCode::GREATER:
+    case OpCode::GREATER_EQUAL:
+    case OpCode::LOGICAL_AND:
+    case OpCode::LOGICAL_OR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 只压入一个值、没有任何副作用的指令
+static bool isPurePush(OpCode op)
+{
+    return op == OpCode::PUSH_CONST || op == OpCode::LOAD_GLOBAL || op == OpCode::LOAD_BUILTIN_VAR;
+}
+
+static bool isJump(OpCode op)
+{
+    return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE;
+}
+
+// 与 VM 一致：JUMP_IF_FALSE 跳到 i + operand，JUMP 跳到 i + operand + 1
+static int jumpTarget(const std::vector<Instruction>& code, int i)
+{
+    return code[i].op == OpCode::JUMP ? i + code[i].operand + 1 : i + code[i].operand;
+}
+
+static std::vector<bool> findJumpTargets(const std::vector<Instruction>& code)
+{
+    const int n = static_cast<int>(code.size());
+    std::vector<bool> targets(n + 1, false);
+    for (int i = 0; i < n; ++i)
+    {
+        if (!isJump(code[i].op))
+            continue;
+        int target = jumpTarget(code, i);
+        if (target >= 0 && target <= n)
+            targets[target] = true;
+    }
+    return targets;
+}
+
+static const double* numericConstant(const Bytecode& bytecode, const Instruction& instr, double& storage)
+{
+    if (instr.op != OpCode::PUSH_CONST || instr.operand < 0 || instr.operand >= static_cast<int>(bytecode.constant_pool.size()))
+        return nullptr;
+    const Value& value = bytecode.constant_pool[instr.operand];
+    if (const auto* d = std::get_if<double>(&value))
+        return d;
+    if (const auto* b = std::get_if<bool>(&value))
+    {
+        storage = *b ? 1.0 : 0.0;
+        return &storage;
+    }
+    return nullptr;
+}
+
+// 指令的栈效应 (弹出/压入个数)，无法静态确定或是控制流指令时返回 false
+static bool stackEffect(const Bytecode& bytecode, int i, int& pops, int& pushes)
+{
+    const Instruction& instr = bytecode.instructions[i];
+    if (isPurePush(instr.op)) { pops = 0; pushes = 1; return true; }
+    if (isBinaryOp(instr.op) || instr.op == OpCode::SUBSCRIPT) { pops = 2; pushes = 1; return true; }
+    switch (instr.op)
+    {
+    case OpCode::POP:
+    case OpCode::STORE_GLOBAL:
+    case OpCode::STORE_EXPORT:
+        pops = 1; pushes = 0;
+        return true;
+    case OpCode::RENAME_SERIES:
+        // 弹出名字，序列留在栈上；按"读取两个、压回一个"处理
+        pops = 2; pushes = 1;
+        return true;
+    case OpCode::CALL_BUILTIN_FUNC:
+    {
+        double storage;
+        const double* count = i > 0 ? numericConstant(bytecode, bytecode.instructions[i - 1], storage) : nullptr;
+        if (!count)
+            return false;
+        pops = static_cast<int>(*count) + 1;
+        pushes = 1;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// 在基本块内向后模拟栈，找到消费 start 之前压入的栈顶值的指令；
+// position 为该值在消费指令操作数中距栈顶的位置 (0 为最后一个操作数)。找不到时返回 -1。
+static int findConsumer(const Bytecode& bytecode, const std::vector<bool>& targets, int start, int& position)
+{
+    int depth = 0;
+    for (int j = start; j < static_cast<int>(bytecode.instructions.size()); ++j)
+    {
+        if (targets[j])
+            return -1;
+        int pops, pushes;
+        if (!stackEffect(bytecode, j, pops, pushes))
+            return -1;
+        if (pops > depth)
+        {
+            position = depth;
+            return j;
+        }
+        depth += pushes - pops;
+    }
+    return -1;
+}
+
+// 删除标记的指令并重新计算跳转偏移。被删除的跳转目标顺延到其后第一条保留的指令。
+static void removeInstructions(std::vector<Instruction>& code, const std::vector<bool>& removed)
+{
+    const int n = static_cast<int>(code.size());
+    std::vector<int> new_index(n + 1);
+    int kept = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        new_index[i] = kept;
+        if (!removed[i])
+            ++kept;
+    }
+    new_index[n] = kept;
+
+    std::vector<Instruction> result;
+    result.reserve(kept);
+    for (int i = 0; i < n; ++i)
+    {
+        if (removed[i])
+            continue;
+        Instruction instr = code[i];
+        if (isJump(instr.op))
+        {
+            int target = jumpTarget(code, i);
+            if (target >= 0 && target <= n)
+            {
+                int offset = new_index[target] - new_index[i];
+                instr.operand = instr.op == OpCode::JUMP ? offset - 1 : offset;
+            }
+        }
+        result.push_back(instr);
+    }
+    code.swap(result);
+}
+
+// 用 replacement 替换 [begin, end) 内的指令 (begin == end 时为插入)，并重新计算其余跳转的偏移。
+// 调用者保证区间内部不是跳转目标；指向 begin 的跳转落在替换后的第一条指令上。
+static void replaceInstructions(std::vector<Instruction>& code, int begin, int end, const std::vector<Instruction>& replacement)
+{
+    const int n = static_cast<int>(code.size());
+    const int shift = static_cast<int>(replacement.size()) - (end - begin);
+    auto mapIndex = [&](int k) { return k < begin ? k : (k < end ? begin : k + shift); };
+
+    std::vector<Instruction> result;
+    result.reserve(n + shift);
+    for (int i = 0; i < n; ++i)
+    {
+        if (i == begin)
+            result.insert(result.end(), replacement.begin(), replacement.end());
+        if (i >= begin && i < end)
+            continue;
+        Instruction instr = code[i];
+        if (isJump(instr.op))
+        {
+            int target = jumpTarget(code, i);
+            if (target >= 0 && target <= n)
+            {
+                int offset = mapIndex(target) - mapIndex(i);
+                instr.operand = instr.op == OpCode::JUMP ? offset - 1 : offset;
+            }
+        }
+        result.push_back(instr);
+    }
+    if (begin == n)
+        result.insert(result.end(), replacement.begin(), replacement.end());
+    code.swap(result);
+}
+
+//-----------------------------------------------------------------------------
+// 各优化遍，返回是否有改动
+//-----------------------------------------------------------------------------
+
+// 结果被这些指令消费时，常量与单元素序列的行为完全相同
+static bool acceptsScalar(OpCode op, int position)
+{
+    if (isBinaryOp(op))
+        return true;
+    switch (op)
+    {
+    case OpCode::SUBSCRIPT:
+        return position == 0; // 只有偏移量可以是常量，被索引的必须仍是序列
+    case OpCode::STORE_GLOBAL:
+    case OpCode::STORE_EXPORT:
+    case OpCode::POP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool foldConstants(Bytecode& bytecode)
+{
+    std::vector<Instruction>& code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+    const std::vector<bool> targets = findJumpTargets(code);
+    std::vector<bool> removed(n, false);
+    bool changed = false;
+
+    for (int i = 2; i < n; ++i)
+    {
+        if (!isBinaryOp(code[i].op) || removed[i - 1] || removed[i - 2] || targets[i - 1] || targets[i])
+            continue;
+        double left_storage, right_storage;
+        const double* left = numericConstant(bytecode, code[i - 2], left_storage);
+        const double* right = numericConstant(bytecode, code[i - 1], right_storage);
+        if (!left || !right)
+            continue;
+        int position;
+        int consumer = findConsumer(bytecode, targets, i + 1, position);
+        if (consumer < 0 || !acceptsScalar(code[consumer].op, position))
+            continue;
+
+        bytecode.constant_pool.push_back(applyBinaryOp(code[i].op, *left, *right));
+        code[i - 2] = {OpCode::PUSH_CONST, static_cast<int>(bytecode.constant_pool.size()) - 1};
+        removed[i - 1] = removed[i] = true;
+        changed = true;
+    }
+    if (changed)
+        removeInstructions(code, removed);
+    return changed;
+}
+
+// 同一基本块内被再次写入前没有被读取的 STORE_GLOBAL 改为 POP (值本身仍会被计算，由窥孔决定能否删除)
+static bool removeDeadStores(Bytecode& bytecode)
+{
+    std::vector<Instruction>& code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+    const std::vector<bool> targets = findJumpTargets(code);
+    bool changed = false;
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (code[i].op != OpCode::STORE_GLOBAL)
+            continue;
+        for (int j = i + 1; j < n && !targets[j]; ++j)
+        {
+            const Instruction& next = code[j];
+            if (isJump(next.op) || next.op == OpCode::HALT)
+                break;
+            if (next.operand != code[i].operand)
+                continue;
+            if (next.op == OpCode::LOAD_GLOBAL)
+                break;
+            if (next.op == OpCode::STORE_GLOBAL || next.op == OpCode::STORE_EXPORT)
+            {
+                code[i] = {OpCode::POP};
+                changed = true;
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+static bool removeDeadCode(Bytecode& bytecode)
+{
+    std::vector<Instruction>& code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+    const std::vector<bool> targets = findJumpTargets(code);
+    std::vector<bool> removed(n, false);
+    bool reachable = true;
+    bool changed = false;
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (targets[i])
+            reachable = true;
+        if (!reachable || (code[i].op == OpCode::JUMP && code[i].operand == 0))
+        {
+            removed[i] = true;
+            changed = true;
+            continue;
+        }
+        if (code[i].op == OpCode::JUMP || code[i].op == OpCode::HALT)
+            reachable = false;
+    }
+    if (changed)
+        removeInstructions(code, removed);
+    return changed;
+}
+
+static bool peephole(Bytecode& bytecode)
+{
+    std::vector<Instruction>& code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+    const std::vector<bool> targets = findJumpTargets(code);
+    std::vector<bool> removed(n, false);
+    bool changed = false;
+
+    for (int i = 0; i + 1 < n; ++i)
+    {
+        if (code[i + 1].op != OpCode::POP || targets[i + 1] || removed[i])
+            continue;
+        if (isPurePush(code[i].op))
+        {
+            // 压入后立即弹出
+            removed[i] = removed[i + 1] = true;
+            changed = true;
+        }
+        else if (isBinaryOp(code[i].op) || code[i].op == OpCode::SUBSCRIPT)
+        {
+            // 结果无人使用的运算：直接弹出两个操作数，使其来源有机会继续被删除
+            code[i] = {OpCode::POP};
+            changed = true;
+        }
+    }
+    if (changed)
+        removeInstructions(code, removed);
+    return changed;
+}
+
+//-----------------------------------------------------------------------------
+// 常量池与中间变量整理
+//-----------------------------------------------------------------------------
+
+static bool usesConstantOperand(OpCode op)
+{
+    return op == OpCode::PUSH_CONST || op == OpCode::LOAD_BUILTIN_VAR || op == OpCode::CALL_BUILTIN_FUNC;
+}
+
+// 按类型和内容 (double 按位比较，保留 -0.0 与 NaN 的区别) 生成去重键；序列常量按对象区分
+static std::pair<size_t, std::string> constantKey(const Value& value)
+{
+    std::string bytes;
+    if (const auto* d = std::get_if<double>(&value))
+    {
+        bytes.resize(sizeof(double));
+        std::memcpy(&bytes[0], d, sizeof(double));
+    }
+    else if (const auto* b = std::get_if<bool>(&value))
+        bytes = *b ? "1" : "0";
+    else if (const auto* s = std::get_if<std::string>(&value))
+        bytes = *s;
+    else if (const auto* series = std::get_if<std::shared_ptr<Series>>(&value))
+        bytes = std::to_string(reinterpret_cast<uintptr_t>(series->get()));
+    return {value.index(), bytes};
+}
+
+static void compactConstantPool(Bytecode& bytecode)
+{
+    const int pool_size = static_cast<int>(bytecode.constant_pool.size());
+    for (const Instruction& instr : bytecode.instructions)
+    {
+        if (usesConstantOperand(instr.op) && (instr.operand < 0 || instr.operand >= pool_size))
+            return; // 非法下标留给 VM 在执行时报告
+    }
+
+    std::vector<Value> pool;
+    std::vector<int> remap(pool_size, -1);
+    std::map<std::pair<size_t, std::string>, int> seen;
+    for (Instruction& instr : bytecode.instructions)
+    {
+        if (!usesConstantOperand(instr.op))
+            continue;
+        int& mapped = remap[instr.operand];
+        if (mapped < 0)
+        {
+            const Value& value = bytecode.constant_pool[instr.operand];
+            auto inserted = seen.emplace(constantKey(value), static_cast<int>(pool.size()));
+            if (inserted.second)
+                pool.push_back(value);
+            mapped = inserted.first->second;
+        }
+        instr.operand = mapped;
+    }
+    bytecode.constant_pool.swap(pool);
+}
+
+static void compactIntermediateVars(Bytecode& bytecode)
+{
+    auto usesVar = [](OpCode op) { return isBinaryOp(op) || op == OpCode::SUBSCRIPT; };
+    for (const Instruction& instr : bytecode.instructions)
+    {
+        if (usesVar(instr.op) && (instr.operand < 0 || instr.operand >= bytecode.varNum))
+            return;
+    }
+
+    std::vector<int> remap(bytecode.varNum, -1);
+    int next = 0;
+    for (Instruction& instr : bytecode.instructions)
+    {
+        if (!usesVar(instr.op))
+            continue;
+        if (remap[instr.operand] < 0)
+            remap[instr.operand] = next++;
+        instr.operand = remap[instr.operand];
+    }
+    bytecode.varNum = next;
+}
+
+//-----------------------------------------------------------------------------
+// 公共子表达式消除
+//-----------------------------------------------------------------------------
+
+// 符号栈上的一个值：值编号，以及在字节码中计算它的连续区间 [start, 当前指令]
+struct StackEntry {
+    int vn;
+    int start;          // -1 表示来源未知 (基本块开头栈上已有的值)
+    bool replaceable;   // 区间内只有表达式指令，可以整体替换
+    int ops;            // 区间内的运算/调用条数
+    bool has_call;
+};
+
+// 值编号第一次出现的位置，以及保存了它、此后可以直接读取的隐藏全局变量
+struct ValueHome {
+    int first_end = -1;
+    int global = -1;
+    int global_version = -1;
+};
+
+static std::string uniqueGlobalName(const Bytecode& bytecode)
+{
+    for (size_t k = 0;; ++k)
+    {
+        std::string name = "__cse" + std::to_string(k);
+        if (std::find(bytecode.global_name_pool.begin(), bytecode.global_name_pool.end(), name) == bytecode.global_name_pool.end())
+            return name;
+    }
+}
+
+// 在基本块内做值编号：相同的纯内置函数调用 (参数值编号相同) 或相同的运算只计算一次，
+// 在第一次计算之后插入 STORE_GLOBAL / LOAD_GLOBAL 到一个新的隐藏全局变量 (__cseN)，后面改为读取它
+// (已经存入隐藏全局变量的值直接读取)。隐藏全局变量由 VM 逐根复制保存，不与调用结果共享序列，
+// 也不会被别名或改名 (见 PineVM::storeGlobal)；用户全局变量的序列可能被之后的赋值改写或改名，不作为共享来源。
+// 每次只改写一处，返回是否有改动。
+static bool eliminateCommonSubexpression(Bytecode& bytecode)
+{
+    std::vector<Instruction>& code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+    const int pool_size = static_cast<int>(bytecode.constant_pool.size());
+    const int global_count = static_cast<int>(bytecode.global_name_pool.size());
+    const std::vector<bool> targets = findJumpTargets(code);
+
+    std::vector<int> store_count(global_count, 0);
+    for (const Instruction& instr : code)
+    {
+        if ((instr.op == OpCode::STORE_GLOBAL || instr.op == OpCode::STORE_EXPORT) && instr.operand >= 0 && instr.operand < global_count)
+            store_count[instr.operand]++;
+    }
+    // 直接存入会被再次赋值的全局变量的值：全局变量与调用结果 (或中间变量) 共享序列，之后的赋值会改写它，
+    // 这样的计算不能与其他地方共用
+    auto storedToReassigned = [&](int end) {
+        if (end + 1 >= n)
+            return false;
+        const Instruction& next = code[end + 1];
+        return (next.op == OpCode::STORE_GLOBAL || next.op == OpCode::STORE_EXPORT) &&
+               next.operand >= 0 && next.operand < global_count && store_count[next.operand] > 1;
+    };
+
+    std::map<std::vector<int>, int> table;
+    std::vector<ValueHome> homes;
+    std::vector<int> version(global_count, 0);
+    std::vector<StackEntry> stack;
+
+    auto reset = [&]() {
+        table.clear();
+        stack.clear();
+    };
+    auto pop = [&]() {
+        if (stack.empty())
+        {
+            homes.emplace_back();
+            return StackEntry{static_cast<int>(homes.size()) - 1, -1, false, 0, false};
+        }
+        StackEntry entry = stack.back();
+        stack.pop_back();
+        return entry;
+    };
+    // 表达式中间夹着 POP / STORE 时，栈上剩余的值的区间不再是纯表达式
+    auto markBarrier = [&]() {
+        for (StackEntry& entry : stack)
+            entry.replaceable = false;
+    };
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (targets[i])
+            reset();
+        const Instruction& instr = code[i];
+        StackEntry result{-1, i, true, 0, false};
+        std::vector<int> key;
+
+        if (instr.op == OpCode::PUSH_CONST || instr.op == OpCode::LOAD_BUILTIN_VAR)
+        {
+            key = {static_cast<int>(instr.op), instr.operand};
+        }
+        else if (instr.op == OpCode::LOAD_GLOBAL)
+        {
+            if (instr.operand < 0 || instr.operand >= global_count)
+            {
+                reset();
+                continue;
+            }
+            key = {static_cast<int>(instr.op), instr.operand, version[instr.operand]};
+        }
+        else if (isBinaryOp(instr.op) || instr.op == OpCode::SUBSCRIPT)
+        {
+            StackEntry right = pop();
+            StackEntry left = pop();
+            result.start = left.start;
+            result.replaceable = left.replaceable && right.replaceable && left.start >= 0;
+            result.ops = left.ops + right.ops + 1;
+            result.has_call = left.has_call || right.has_call;
+            key = {static_cast<int>(instr.op), left.vn, right.vn};
+        }
+        else if (instr.op == OpCode::CALL_BUILTIN_FUNC)
+        {
+            int pops, pushes;
+            if (!stackEffect(bytecode, i, pops, pushes) || instr.operand < 0 || instr.operand >= pool_size ||
+                !std::holds_alternative<std::string>(bytecode.constant_pool[instr.operand]))
+            {
+                reset();
+                continue;
+            }
+            // 参数 (含参数数量) 按压栈顺序排列
+            std::vector<StackEntry> args(pops);
+            for (int k = pops - 1; k >= 0; --k)
+                args[k] = pop();
+            result.start = args.front().start;
+            result.replaceable = result.start >= 0;
+            result.ops = 1;
+            result.has_call = true;
+            for (const StackEntry& arg : args)
+            {
+                result.replaceable = result.replaceable && arg.replaceable;
+                result.ops += arg.ops;
+            }
+            if (PineVM::isPureBuiltin(std::get<std::string>(bytecode.constant_pool[instr.operand])))
+            {
+                key = {static_cast<int>(instr.op), instr.operand};
+                for (const StackEntry& arg : args)
+                    key.push_back(arg.vn);
+            }
+            else
+            {
+                // 有副作用的调用不能被合并，也不能被整体删除
+                result.replaceable = false;
+            }
+        }
+        else if (instr.op == OpCode::STORE_GLOBAL || instr.op == OpCode::STORE_EXPORT)
+        {
+            StackEntry value = pop();
+            markBarrier();
+            if (instr.operand < 0 || instr.operand >= global_count)
+            {
+                reset();
+                continue;
+            }
+            version[instr.operand]++;
+            ValueHome& home = homes[value.vn];
+            if (home.global < 0 && isHiddenGlobal(bytecode.global_name_pool[instr.operand]))
+            {
+                home.global = instr.operand;
+                home.global_version = version[instr.operand];
+            }
+            continue;
+        }
+        else if (instr.op == OpCode::POP)
+        {
+            pop();
+            markBarrier();
+            continue;
+        }
+        else
+        {
+            // 跳转、HALT、RENAME_SERIES 等：结束当前基本块
+            reset();
+            continue;
+        }
+
+        auto found = key.empty() ? table.end() : table.find(key);
+        if (found != table.end())
+        {
+            const ValueHome home = homes[found->second];
+            const bool worthwhile = result.has_call || result.ops >= 2;
+            if (worthwhile && result.replaceable && home.first_end >= 0 &&
+                !storedToReassigned(home.first_end) && !storedToReassigned(i))
+            {
+                if (home.global >= 0 && version[home.global] == home.global_version)
+                {
+                    replaceInstructions(code, result.start, i + 1, {{OpCode::LOAD_GLOBAL, home.global}});
+                    return true;
+                }
+                const int temp = global_count;
+                bytecode.global_name_pool.push_back(uniqueGlobalName(bytecode));
+                // 先替换后面的区间，插入点在它之前，下标不受影响
+                replaceInstructions(code, result.start, i + 1, {{OpCode::LOAD_GLOBAL, temp}});
+                replaceInstructions(code, home.first_end + 1, home.first_end + 1,
+                                    {{OpCode::STORE_GLOBAL, temp}, {OpCode::LOAD_GLOBAL, temp}});
+                return true;
+            }
+            result.vn = found->second;
+        }
+        else
+        {
+            homes.emplace_back();
+            homes.back().first_end = i;
+            result.vn = static_cast<int>(homes.size()) - 1;
+            if (!key.empty())
+                table.emplace(std::move(key), result.vn);
+        }
+        stack.push_back(result);
+    }
+    return false;
+}
+
+void optimizeBytecode(Bytecode& bytecode)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        changed |= foldConstants(bytecode);
+        changed |= removeDeadStores(bytecode);
+        changed |= removeDeadCode(bytecode);
+        changed |= peephole(bytecode);
+    }
+    // 值编号依赖"常量下标相同即值相同"，因此在常量池去重之后进行
+    compactConstantPool(bytecode);
+    while (eliminateCommonSubexpression(bytecode))
+        ;
+    compactConstantPool(bytecode);
+    compactIntermediateVars(bytecode);
+}
+
+//-----------------------------------------------------------------------------
+// 参数扫描拆分
+//-----------------------------------------------------------------------------
+
+std::string hoistedVarName(const std::string& global)
+{
+    return "__sweep." + global;
+}
+
+// 参数赋值中常量所在的指令：N:=5 的 PUSH_CONST，或 N:=input.int(5, ...) 的第一个参数
+static int findParameterSite(const Bytecode& bytecode, const std::string& parameter)
+{
+    const std::vector<Instruction>& code = bytecode.instructions;
+    auto found = std::find(bytecode.global_name_pool.begin(), bytecode.global_name_pool.end(), parameter);
+    if (found == bytecode.global_name_pool.end())
+        throw std::invalid_argument("Sweep parameter '" + parameter + "' is not a global variable.");
+    const int global = static_cast<int>(found - bytecode.global_name_pool.begin());
+
+    int store = -1;
+    for (int i = 0; i < static_cast<int>(code.size()); ++i)
+    {
+        if ((code[i].op == OpCode::STORE_GLOBAL || code[i].op == OpCode::STORE_EXPORT) && code[i].operand == global)
+        {
+            if (store >= 0)
+                throw std::invalid_argument("Sweep parameter '" + parameter + "' is assigned more than once.");
+            store = i;
+        }
+    }
+
+    double storage;
+    if (store >= 1 && numericConstant(bytecode, code[store - 1], storage))
+        return store - 1;
+    if (store >= 2 && code[store - 1].op == OpCode::CALL_BUILTIN_FUNC)
+    {
+        const Value& name = bytecode.constant_pool[code[store - 1].operand];
+        const double* count = numericConstant(bytecode, code[store - 2], storage);
+        const int argc = count ? static_cast<int>(*count) : -1;
+        const int first = store - 2 - argc;
+        if (std::holds_alternative<std::string>(name) && std::get<std::string>(name).rfind("input.", 0) == 0 &&
+            argc >= 1 && first >= 0)
+        {
+            bool constant = true;
+            for (int k = first; k < store - 2; ++k)
+                constant = constant && code[k].op == OpCode::PUSH_CONST;
+            if (constant && numericConstant(bytecode, code[first], storage))
+                return first;
+        }
+    }
+    throw std::invalid_argument("Sweep parameter '" + parameter + "' must be assigned a numeric constant or input.*.");
+}
+
+// 符号栈上的一个值：由 [start, end) 的指令计算；tainted 表示依赖参数或含有非纯函数调用，
+// constant 表示只由常量和运算组成 (不移到共享程序，以免常量参数变成序列)
+struct SweepValue {
+    int start;
+    int end;
+    bool tainted;
+    bool constant;
+};
+
+// 分析一条语句 [begin, end)，返回其中是否有依赖参数的值；
+// hoists 非空时收集被依赖参数的运算消费、自身不依赖参数的最大子表达式
+static bool analyzeStatement(const Bytecode& bytecode, int begin, int end, const std::vector<bool>& tainted_globals,
+                             std::vector<std::pair<int, int>>* hoists)
+{
+    const std::vector<Instruction>& code = bytecode.instructions;
+    std::vector<SweepValue> stack;
+    bool tainted = false;
+    for (int i = begin; i < end; ++i)
+    {
+        const Instruction& instr = code[i];
+        int pops = 0, pushes = 0;
+        stackEffect(bytecode, i, pops, pushes);
+        SweepValue result{i, i + 1, false, instr.op == OpCode::PUSH_CONST};
+        if (instr.op == OpCode::LOAD_GLOBAL)
+            result.tainted = tainted_globals[instr.operand];
+        else if (instr.op == OpCode::CALL_BUILTIN_FUNC)
+        {
+            const Value& name = bytecode.constant_pool[instr.operand];
+            result.tainted = !std::holds_alternative<std::string>(name) || !PineVM::isPureBuiltin(std::get<std::string>(name));
+        }
+
+        std::vector<SweepValue> operands(stack.end() - pops, stack.end());
+        stack.resize(stack.size() - pops);
+        if (!operands.empty())
+        {
+            result.start = operands.front().start;
+            result.constant = isBinaryOp(instr.op);
+        }
+        for (const SweepValue& operand : operands)
+        {
+            result.tainted = result.tainted || operand.tainted;
+            result.constant = result.constant && operand.constant;
+        }
+        if (result.tainted && hoists)
+        {
+            for (const SweepValue& operand : operands)
+                if (!operand.tainted && !operand.constant && operand.end - operand.start > 1)
+                    hoists->push_back({operand.start, operand.end});
+        }
+        tainted = tainted || result.tainted;
+        if (pushes)
+            stack.push_back(result);
+    }
+    return tainted;
+}
+
+static bool isStore(OpCode op)
+{
+    return op == OpCode::STORE_GLOBAL || op == OpCode::STORE_EXPORT;
+}
+
+ParameterSplit splitParameterInvariant(const Bytecode& bytecode, const std::vector<std::string>& parameters)
+{
+    const std::vector<Instruction>& code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+    const int global_count = static_cast<int>(bytecode.global_name_pool.size());
+
+    std::vector<int> sites;
+    for (const std::string& parameter : parameters)
+        sites.push_back(findParameterSite(bytecode, parameter));
+
+    // 按栈深度回到 0 的位置切分语句；有跳转或栈效应无法确定时不拆分
+    std::vector<std::pair<int, int>> statements;
+    bool splittable = true;
+    int depth = 0;
+    for (int i = 0, begin = 0; i < n && splittable; ++i)
+    {
+        if (code[i].op == OpCode::HALT)
+        {
+            splittable = depth == 0 && i == n - 1;
+            break;
+        }
+        int pops, pushes;
+        if (!stackEffect(bytecode, i, pops, pushes) || pops > depth)
+        {
+            splittable = false;
+            break;
+        }
+        depth += pushes - pops;
+        if (depth == 0)
+        {
+            statements.push_back({begin, i + 1});
+            begin = i + 1;
+        }
+    }
+    splittable = splittable && depth == 0;
+
+    ParameterSplit split;
+    split.shared.constant_pool = bytecode.constant_pool;
+    split.shared.varNum = bytecode.varNum;
+    split.lane = bytecode;
+    split.parameter_sites = sites;
+    if (!splittable)
+    {
+        split.shared.instructions.push_back({OpCode::HALT, 0});
+        return split;
+    }
+
+    // 依赖参数的全局变量：参数本身、被依赖参数的值赋值过的变量、在第一次赋值之前就被读取的变量
+    std::vector<bool> tainted(global_count, false);
+    for (const std::string& parameter : parameters)
+        tainted[std::find(bytecode.global_name_pool.begin(), bytecode.global_name_pool.end(), parameter) - bytecode.global_name_pool.begin()] = true;
+    std::vector<bool> stored(global_count, false);
+    for (int i = 0; i < n; ++i)
+    {
+        if (code[i].op == OpCode::LOAD_GLOBAL && !stored[code[i].operand])
+            tainted[code[i].operand] = true;
+        else if (isStore(code[i].op))
+            stored[code[i].operand] = true;
+    }
+    auto inLane = [&](const std::pair<int, int>& statement) {
+        const Instruction& last = code[statement.second - 1];
+        return analyzeStatement(bytecode, statement.first, statement.second, tainted, nullptr) ||
+               (isStore(last.op) && tainted[last.operand]);
+    };
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (const auto& statement : statements)
+        {
+            const Instruction& last = code[statement.second - 1];
+            if (isStore(last.op) && !tainted[last.operand] && inLane(statement))
+            {
+                tainted[last.operand] = true;
+                changed = true;
+            }
+        }
+    }
+
+    split.shared.global_name_pool = bytecode.global_name_pool;
+    split.lane.instructions.clear();
+    split.lane.constant_pool = bytecode.constant_pool;
+    std::vector<int> lane_index(n, -1);
+    auto laneLoad = [&](const std::string& name) {
+        split.lane.constant_pool.push_back(hoistedVarName(name));
+        return Instruction{OpCode::LOAD_BUILTIN_VAR, static_cast<int>(split.lane.constant_pool.size()) - 1};
+    };
+
+    for (const auto& statement : statements)
+    {
+        if (!inLane(statement))
+        {
+            split.shared.instructions.insert(split.shared.instructions.end(), code.begin() + statement.first, code.begin() + statement.second);
+            const Instruction& last = code[statement.second - 1];
+            if (isStore(last.op) && std::find(split.hoisted.begin(), split.hoisted.end(), bytecode.global_name_pool[last.operand]) == split.hoisted.end())
+                split.hoisted.push_back(bytecode.global_name_pool[last.operand]);
+            continue;
+        }
+
+        std::vector<std::pair<int, int>> hoists;
+        analyzeStatement(bytecode, statement.first, statement.second, tainted, &hoists);
+        std::sort(hoists.begin(), hoists.end());
+        size_t next = 0;
+        for (int i = statement.first; i < statement.second; ++i)
+        {
+            if (next < hoists.size() && hoists[next].first == i)
+            {
+                // 子表达式在共享程序中计算并存入新的隐藏全局变量
+                std::string name;
+                for (size_t k = 0;; ++k)
+                {
+                    name = "__hoist" + std::to_string(k);
+                    if (std::find(split.shared.global_name_pool.begin(), split.shared.global_name_pool.end(), name) == split.shared.global_name_pool.end())
+                        break;
+                }
+                split.shared.instructions.insert(split.shared.instructions.end(), code.begin() + hoists[next].first, code.begin() + hoists[next].second);
+                split.shared.instructions.push_back({OpCode::STORE_GLOBAL, static_cast<int>(split.shared.global_name_pool.size())});
+                split.shared.global_name_pool.push_back(name);
+                split.hoisted.push_back(name);
+                split.lane.instructions.push_back(laneLoad(name));
+                i = hoists[next].second - 1;
+                ++next;
+                continue;
+            }
+            lane_index[i] = static_cast<int>(split.lane.instructions.size());
+            if (code[i].op == OpCode::LOAD_GLOBAL && !tainted[code[i].operand])
+                split.lane.instructions.push_back(laneLoad(bytecode.global_name_pool[code[i].operand]));
+            else
+                split.lane.instructions.push_back(code[i]);
+        }
+    }
+    split.shared.instructions.push_back({OpCode::HALT, 0});
+    split.lane.instructions.push_back({OpCode::HALT, 0});
+    for (int& site : split.parameter_sites)
+        site = lane_index[site];
+    return split;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "VMCommon.h"
+
+//-----------------------------------------------------------------------------
+// 字节码优化 (三个编译器在生成 HALT 之后、bytecodeToTxt 之前统一调用)
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief 在不改变执行结果的前提下精简字节码，依次执行以下各遍直到不再变化：
+ *        1. 常量折叠：PUSH_CONST a; PUSH_CONST b; <运算> → PUSH_CONST (a op b)，
+ *           一元负号 PUSH_CONST 0; PUSH_CONST c; SUB 也由此折叠；
+ *           只有结果被运算、下标偏移或存储消费时才折叠 (内置函数可能要求参数是序列)；
+ *        2. 死存储消除：同一基本块内被再次写入、且中间没有读取的 STORE_GLOBAL；
+ *        3. 死代码消除：JUMP / HALT 之后不可达的指令、跳到下一条的 JUMP；
+ *        4. 窥孔：PUSH_CONST / LOAD_GLOBAL / LOAD_BUILTIN_VAR 紧跟 POP 时两条一起删除。
+ *        然后对常量池去重，并在每个基本块内做公共子表达式消除：参数相同的纯内置函数调用
+ *        和相同的运算只计算一次，结果经新增的隐藏全局变量 (__cseN) 共享。
+ *        最后删除未使用的常量，对中间变量重新编号并收缩 varNum。
+ *        跳转偏移会按删除后的位置重新计算。
+ */
+void optimizeBytecode(Bytecode& bytecode);
+
+//-----------------------------------------------------------------------------
+// 参数扫描：把与参数无关的计算拆分出来只算一次
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief 共享程序中的全局变量在参数程序里以内置变量的形式读取时使用的名字。
+ */
+std::string hoistedVarName(const std::string& global);
+
+/**
+ * @brief splitParameterInvariant 的结果。
+ *        shared 只计算与参数无关的语句和子表达式，每组输入执行一次；
+ *        lane 是每个参数组合执行的程序，其中对共享结果的读取改为 LOAD_BUILTIN_VAR hoistedVarName(名字)，
+ *        全局变量表与原字节码相同 (由共享程序计算的变量在 lane 中不会被赋值)。
+ */
+struct ParameterSplit {
+    Bytecode shared;
+    Bytecode lane;
+    std::vector<std::string> hoisted;  // shared 中需要提供给 lane 的全局变量名
+    std::vector<int> parameter_sites;  // 各参数的值在 lane 中所在的 PUSH_CONST 指令下标
+};
+
+/**
+ * @brief 按参数拆分字节码。参数必须是只赋值一次的全局变量，值为数值常量或
+ *        input.* (第一个参数为数值常量、其余参数也是常量)，例如 N:=14; 或 N:=input.int(14, "Length");
+ *        依赖参数的语句 (以及含有 rand、plot 等非纯函数的语句) 留在 lane 中，
+ *        其中不依赖参数的子表达式移到 shared；含跳转的字节码不拆分，shared 为空。
+ * @throws std::invalid_argument 参数不是全局变量或赋值方式不符合上述要求。
+ */
+ParameterSplit splitParameterInvariant(const Bytecode& bytecode, const std::vector<std::string>& parameters);
@@ -0,0 +1,240 @@
+#include "CompileCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+static const char kCacheFileMagic[4] = {'P', 'V', 'M', 'C'};
+
+CompileCache::CompileCache(size_t capacity, const std::string& directory)
+    : capacity_(capacity), directory_(directory)
+{
+}
+
+CompileCache& CompileCache::shared()
+{
+    static CompileCache cache;
+    return cache;
+}
+
+std::string CompileCache::normalizeSource(const std::string& language, const std::string& source)
+{
+    const bool collapse = language != "pine";
+    std::string result;
+    std::string line;
+    std::istringstream lines(source);
+    size_t content_end = 0; // 去掉末尾空行
+    while (std::getline(lines, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        std::string normalized;
+        char quote = 0;
+        for (char c : line)
+        {
+            const bool space = c == ' ' || c == '\t';
+            if (quote)
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '"' || c == '\'')
+            {
+                quote = c;
+            }
+            else if (space && collapse)
+            {
+                if (!normalized.empty() && normalized.back() != ' ')
+                    normalized += ' ';
+                continue;
+            }
+            normalized += c;
+        }
+        while (!normalized.empty() && (normalized.back() == ' ' || normalized.back() == '\t'))
+            normalized.pop_back();
+        if (normalized.empty() && result.empty())
+            continue; // 去掉开头空行
+        if (!result.empty())
+            result += '\n';
+        result += normalized;
+        if (!normalized.empty())
+            content_end = result.size();
+    }
+    result.resize(content_end);
+    return result;
+}
+
+std::shared_ptr<const Bytecode> CompileCache::get(const std::string& language, const std::string& source, const CompileFunction& compile)
+{
+    const std::string normalized = normalizeSource(language, source);
+    std::string key = language;
+    key += '\0';
+    key += std::to_string(kCompilerVersion);
+    key += '\0';
+    key += normalized;
+
+    if (auto bytecode = lookup(key))
+        return bytecode;
+
+    std::shared_ptr<const Bytecode> bytecode = readDisk(key);
+    if (!bytecode)
+    {
+        bytecode = std::make_shared<const Bytecode>(compile(normalized));
+        writeDisk(key, *bytecode);
+    }
+    insert(key, bytecode);
+    return bytecode;
+}
+
+std::shared_ptr<const Bytecode> CompileCache::lookup(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end())
+    {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->bytecode;
+}
+
+void CompileCache::insert(const std::string& key, const std::shared_ptr<const Bytecode>& bytecode)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0 || index_.count(key))
+        return;
+    entries_.push_front({key, bytecode});
+    index_[key] = entries_.begin();
+    while (entries_.size() > capacity_)
+    {
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+}
+
+void CompileCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    while (entries_.size() > capacity_)
+    {
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+}
+
+void CompileCache::setDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    directory_ = directory;
+}
+
+void CompileCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    hits_ = misses_ = 0;
+}
+
+size_t CompileCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+size_t CompileCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t CompileCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+// 文件名取键的 64 位 FNV-1a 哈希；文件中保存完整的键，哈希冲突时按未命中处理
+std::string CompileCache::diskPath(const std::string& key) const
+{
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory = directory_;
+    }
+    if (directory.empty())
+        return "";
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.pvmc", static_cast<unsigned long long>(hash));
+    const char last = directory.back();
+    return directory + (last == '/' || last == '\\' ? "" : "/") + name;
+}
+
+std::shared_ptr<const Bytecode> CompileCache::readDisk(const std::string& key) const
+{
+    const std::string path = diskPath(key);
+    if (path.empty())
+        return nullptr;
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return nullptr;
+    const std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const size_t header = sizeof(kCacheFileMagic) + sizeof(uint32_t);
+    uint32_t key_size = 0;
+    if (contents.size() < header || std::memcmp(contents.data(), kCacheFileMagic, sizeof(kCacheFileMagic)) != 0)
+        return nullptr;
+    std::memcpy(&key_size, contents.data() + sizeof(kCacheFileMagic), sizeof(key_size));
+    if (contents.size() - header < key_size || contents.compare(header, key_size, key) != 0)
+        return nullptr;
+    try
+    {
+        return std::make_shared<const Bytecode>(binaryToBytecode(contents.data() + header + key_size, contents.size() - header - key_size));
+    }
+    catch (const std::runtime_error&)
+    {
+        return nullptr; // 损坏的缓存文件按未命中处理，重新编译后覆盖
+    }
+}
+
+// 先写临时文件再改名，并发的读取者不会读到写了一半的文件
+void CompileCache::writeDisk(const std::string& key, const Bytecode& bytecode) const
+{
+    const std::string path = diskPath(key);
+    if (path.empty())
+        return;
+    std::ostringstream temp_name;
+    temp_name << path << ".tmp" << std::hash<std::thread::id>()(std::this_thread::get_id());
+    const std::string temp = temp_name.str();
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return;
+        const uint32_t key_size = static_cast<uint32_t>(key.size());
+        const std::string binary = bytecodeToBinary(bytecode);
+        out.write(kCacheFileMagic, sizeof(kCacheFileMagic));
+        out.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+        out.write(key.data(), static_cast<std::streamsize>(key.size()));
+        out.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+        if (!out)
+        {
+            out.close();
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    std::remove(path.c_str()); // Windows 下 rename 不覆盖已有文件
+    if (std::rename(temp.c_str(), path.c_str()) != 0)
+        std::remove(temp.c_str());
+}
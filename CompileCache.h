@@ -0,0 +1,74 @@
+#pragma once
+
+#include "VMCommon.h"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+//-----------------------------------------------------------------------------
+// 编译结果缓存
+//-----------------------------------------------------------------------------
+
+/**
+ * @class CompileCache
+ * @brief 以 (语言, 规范化后的源码, 编译器版本) 为键缓存编译好的字节码，相同公式重复编译时只需一次哈希查找。
+ *        内存中按最近最少使用 (LRU) 淘汰；设置目录后同时把字节码以二进制格式 (见 bytecodeToBinary)
+ *        写入磁盘，进程重启后首次编译也可以直接读取。编译失败的结果不缓存。多线程安全。
+ *
+ *        规范化：统一换行为 \n、去掉行尾空白和首尾空行；除 "pine" (缩进有意义) 外，
+ *        字符串字面量以外的连续空白合并为一个空格。
+ */
+class CompileCache {
+public:
+    // 编译器输出的字节码发生变化时递增，旧版本的缓存 (包括磁盘上的) 自动失效
+    static constexpr uint32_t kCompilerVersion = 1;
+
+    using CompileFunction = std::function<Bytecode(const std::string& source)>;
+
+    explicit CompileCache(size_t capacity = 512, const std::string& directory = "");
+
+    /**
+     * @brief 进程级共享的缓存，供 JNI / WASM 等绑定层使用。
+     */
+    static CompileCache& shared();
+
+    /**
+     * @brief 取得 source 的字节码，缓存未命中时调用 compile 编译 (不持有锁，不同公式可以并行编译)。
+     * @param language 语言名，如 "hithink"、"pine"、"easylanguage"。
+     * @param compile 编译函数，失败时应抛出异常 (异常原样传给调用者)。
+     */
+    std::shared_ptr<const Bytecode> get(const std::string& language, const std::string& source, const CompileFunction& compile);
+
+    void setCapacity(size_t capacity);
+    // 为空时只缓存在内存中
+    void setDirectory(const std::string& directory);
+    void clear();
+
+    size_t size() const;
+    size_t hits() const;
+    size_t misses() const;
+
+    static std::string normalizeSource(const std::string& language, const std::string& source);
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const Bytecode> bytecode;
+    };
+
+    std::shared_ptr<const Bytecode> lookup(const std::string& key);
+    void insert(const std::string& key, const std::shared_ptr<const Bytecode>& bytecode);
+    std::string diskPath(const std::string& key) const;
+    std::shared_ptr<const Bytecode> readDisk(const std::string& key) const;
+    void writeDisk(const std::string& key, const Bytecode& bytecode) const;
+
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    std::string directory_;
+    std::list<Entry> entries_; // 最近使用的在前
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
@@ -2,11 +2,27 @@
 #include <iostream>
 #include <algorithm> // for std::max/min
 
+void DataSource::loadData(PineVM& vm) {
+    if (!columns_loaded) {
+        columns = readColumns();
+        columns_loaded = true;
+    }
+    for (const auto& pair : columns) {
+        vm.registerSeries(pair.first, pair.second);
+    }
+}
+
+std::shared_ptr<const Series> DataSource::makeColumn(const std::string& name, std::vector<double> data) {
+    auto series = std::make_shared<Series>();
+    series->name = name;
+    series->data = std::move(data);
+    return series;
+}
+
 MockDataSource::MockDataSource(int num_bars) : num_bars(num_bars) {
-    generateData();
 }
 
-void MockDataSource::generateData() {
+DataSource::Columns MockDataSource::readColumns() {
     std::vector<double> time_data(num_bars);
     std::vector<double> close_prices(num_bars);
     std::vector<double> open_prices(num_bars);
@@ -23,25 +39,14 @@ void MockDataSource::generateData() {
         volume_data[i] = 1000.0 + (i % 5) * 100;
     }
 
-    market_data["time"] = time_data;
-    market_data["close"] = close_prices;
-    market_data["open"] = open_prices;
-    market_data["high"] = high_prices;
-    market_data["low"] = low_prices;
-    market_data["volume"] = volume_data;
-}
-
-void MockDataSource::loadData(PineVM& vm) {
-    auto make_series = [](const std::string& name, const std::vector<double>& data) {
-        auto series = std::make_shared<Series>();
-        series->name = name;
-        series->data = data;
-        return series;
-    };
-
-    for (const auto& pair : market_data) {
-        vm.registerSeries(pair.first, make_series(pair.first, pair.second));
-    }
+    Columns columns;
+    columns["time"] = makeColumn("time", std::move(time_data));
+    columns["close"] = makeColumn("close", std::move(close_prices));
+    columns["open"] = makeColumn("open", std::move(open_prices));
+    columns["high"] = makeColumn("high", std::move(high_prices));
+    columns["low"] = makeColumn("low", std::move(low_prices));
+    columns["volume"] = makeColumn("volume", std::move(volume_data));
+    return columns;
 }
 
 int MockDataSource::getNumBars() const {
@@ -9,21 +9,32 @@
 class DataSource {
 public:
     virtual ~DataSource() = default;
-    // 加载数据到VM中
-    virtual void loadData(PineVM& vm) = 0;
+    // 加载数据到VM中。输入列只在第一次调用时读取，之后以只读方式注册到每个 VM，
+    // 同一数据源上的多个 VM 共享同一份数据 (不复制)
+    void loadData(PineVM& vm);
     // 获取K线总数
     virtual int getNumBars() const = 0;
+
+protected:
+    using Columns = std::map<std::string, std::shared_ptr<const Series>>;
+    // 读取全部输入列 (序列名称 -> 数据)
+    virtual Columns readColumns() = 0;
+    static std::shared_ptr<const Series> makeColumn(const std::string& name, std::vector<double> data);
+
+private:
+    Columns columns;
+    bool columns_loaded = false;
 };
 
 // 一个生成示例数据的模拟数据源
 class MockDataSource : public DataSource {
 public:
     explicit MockDataSource(int num_bars);
-    void loadData(PineVM& vm) override;
     int getNumBars() const override;
 
+protected:
+    Columns readColumns() override;
+
 private:
     int num_bars;
-    std::map<std::string, std::vector<double>> market_data;
-    void generateData();
 };
\ No newline at end of file
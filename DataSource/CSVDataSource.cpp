@@ -59,7 +59,7 @@ void CSVDataSource::initialize() {
     duckdb_destroy_result(&create_result);
 }
 
-void CSVDataSource::loadData(PineVM& vm) {
+DataSource::Columns CSVDataSource::readColumns() {
     duckdb_result result;
     // This query remains IDENTICAL. The epoch() function works perfectly on both
     // DATE and TIMESTAMP types, converting them to a numeric Unix timestamp.
@@ -71,36 +71,21 @@ void CSVDataSource::loadData(PineVM& vm) {
         throw std::runtime_error(error_msg);
     }
     
-    vm.registerSeries("time", std::make_shared<Series>());
-    vm.registerSeries("date", std::make_shared<Series>());
-    vm.registerSeries("open", std::make_shared<Series>());
-    vm.registerSeries("high", std::make_shared<Series>());
-    vm.registerSeries("low", std::make_shared<Series>());
-    vm.registerSeries("close", std::make_shared<Series>());
-
-    auto* time_series = vm.getSeries("time");
-    auto* date_series = vm.getSeries("date");
-    auto* open_series = vm.getSeries("open");
-    auto* high_series = vm.getSeries("high");
-    auto* low_series = vm.getSeries("low");
-    auto* close_series = vm.getSeries("close");
-
-    if (!time_series || !date_series || !open_series || !high_series || !low_series || !close_series) {
-        duckdb_destroy_result(&result);
-        throw std::runtime_error("One or more required series (time, open, high, low, close) not found in PineVM.");
-    }
-
     idx_t row_count = duckdb_row_count(&result);
+    std::vector<std::vector<double>> data(6, std::vector<double>(row_count));
     for (idx_t r = 0; r < row_count; ++r) {
-        time_series->data.push_back(duckdb_value_double(&result, 0, r));
-        date_series->data.push_back(duckdb_value_double(&result, 1, r));
-        open_series->data.push_back(duckdb_value_double(&result, 2, r));
-        high_series->data.push_back(duckdb_value_double(&result, 3, r));
-        low_series->data.push_back(duckdb_value_double(&result, 4, r));
-        close_series->data.push_back(duckdb_value_double(&result, 5, r));
+        for (idx_t col = 0; col < data.size(); ++col) {
+            data[col][r] = duckdb_value_double(&result, col, r);
+        }
     }
-
     duckdb_destroy_result(&result);
+
+    const char* names[] = {"time", "date", "open", "high", "low", "close"};
+    Columns columns;
+    for (size_t col = 0; col < data.size(); ++col) {
+        columns[names[col]] = makeColumn(names[col], std::move(data[col]));
+    }
+    return columns;
 }
 
 int CSVDataSource::getNumBars() const {
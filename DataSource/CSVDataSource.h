@@ -10,9 +10,11 @@ class CSVDataSource : public DataSource {
 public:
     explicit CSVDataSource(const std::string& file_path);
     ~CSVDataSource() override;
-    void loadData(PineVM& vm) override;
     int getNumBars() const override;
 
+protected:
+    Columns readColumns() override;
+
 private:
     std::string file_path;
     int num_bars;
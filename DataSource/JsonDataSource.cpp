@@ -70,7 +70,7 @@ void JsonDataSource::initialize() {
     duckdb_destroy_result(&create_result);
 }
 
-void JsonDataSource::loadData(PineVM& vm) {
+DataSource::Columns JsonDataSource::readColumns() {
     duckdb_result result;
     // Because initialize() created a clean table, this query is simple and standard.
     // It reads from the 'market_data' table which now has standard column names and types.
@@ -82,42 +82,21 @@ void JsonDataSource::loadData(PineVM& vm) {
         throw std::runtime_error(error_msg);
     }
 
-    vm.registerSeries("time", std::make_shared<Series>());
-    vm.registerSeries("date", std::make_shared<Series>());
-    vm.registerSeries("open", std::make_shared<Series>());
-    vm.registerSeries("high", std::make_shared<Series>());
-    vm.registerSeries("low", std::make_shared<Series>());
-    vm.registerSeries("close", std::make_shared<Series>());
-    vm.registerSeries("volume", std::make_shared<Series>());
-    vm.registerSeries("amount", std::make_shared<Series>());
-
-    auto* time_series = vm.getSeries("time");
-    auto* date_series = vm.getSeries("date");
-    auto* open_series = vm.getSeries("open");
-    auto* high_series = vm.getSeries("high");
-    auto* low_series = vm.getSeries("low");
-    auto* close_series = vm.getSeries("close");
-    auto* volume_series = vm.getSeries("volume");
-    auto* amount_series = vm.getSeries("amount");
-
-    if (!time_series || !date_series || !open_series || !high_series || !low_series || !close_series || !volume_series || !amount_series) {
-        duckdb_destroy_result(&result);
-        throw std::runtime_error("One or more required series (open, high, low, close, volume) not found in PineVM.");
-    }
-
     idx_t row_count = duckdb_row_count(&result);
+    std::vector<std::vector<double>> data(8, std::vector<double>(row_count));
     for (idx_t r = 0; r < row_count; ++r) {
-        time_series->data.push_back(duckdb_value_double(&result, 0, r)); // epoch(time)
-        date_series->data.push_back(duckdb_value_double(&result, 1, r));
-        open_series->data.push_back(duckdb_value_double(&result, 2, r));
-        high_series->data.push_back(duckdb_value_double(&result, 3, r));
-        low_series->data.push_back(duckdb_value_double(&result, 4, r));
-        close_series->data.push_back(duckdb_value_double(&result, 5, r));
-        volume_series->data.push_back(duckdb_value_double(&result, 6, r));
-        amount_series->data.push_back(duckdb_value_double(&result, 7, r));
+        for (idx_t col = 0; col < data.size(); ++col) {
+            data[col][r] = duckdb_value_double(&result, col, r);
+        }
     }
-
     duckdb_destroy_result(&result);
+
+    const char* names[] = {"time", "date", "open", "high", "low", "close", "volume", "amount"};
+    Columns columns;
+    for (size_t col = 0; col < data.size(); ++col) {
+        columns[names[col]] = makeColumn(names[col], std::move(data[col]));
+    }
+    return columns;
 }
 
 int JsonDataSource::getNumBars() const {
@@ -10,9 +10,11 @@ class JsonDataSource : public DataSource {
 public:
     explicit JsonDataSource(const std::string& file_path);
     ~JsonDataSource() override;
-    void loadData(PineVM& vm) override;
     int getNumBars() const override;
 
+protected:
+    Columns readColumns() override;
+
 private:
     std::string file_path;
     int num_bars;
@@ -1,5 +1,6 @@
 #include "EasyLanguageCompiler.h"
 #include "EasyLanguageParser.h"
+#include "../BytecodeOptimizer.h"
 #include <stdexcept>
 #include <algorithm>
 
@@ -33,6 +34,7 @@ Bytecode EasyLanguageCompiler::compile(std::string_view source) {
     }
 
     emitByte(OpCode::HALT);
+    optimizeBytecode(bytecode);
     return bytecode;
 }
 
@@ -120,13 +122,11 @@ void EasyLanguageCompiler::visit(BinaryExpression& node) {
 }
 
 void EasyLanguageCompiler::visit(UnaryExpression& node) {
-    node.right->accept(*this);
     if (node.op.type == TokenType::MINUS) {
-        auto right = bytecode.instructions.back();
-        bytecode.instructions.pop_back();
+        // -x 编译为 0 - x；先压入 0，操作数可以是任意长度的指令序列
         int constIndex = addConstant(0.0);
         emitByteWithOperand(OpCode::PUSH_CONST, constIndex);
-        bytecode.instructions.push_back(right);
+        node.right->accept(*this);
         emitByteForMath(OpCode::SUB);
     } else {
         throw std::runtime_error("Unsupported unary operator.");
@@ -1,5 +1,6 @@
 #include "HithinkCompiler.h"
 #include "HithinkParser.h"
+#include "../BytecodeOptimizer.h"
 #include <stdexcept>
 #include <algorithm>
 #include <string>
@@ -37,6 +38,9 @@ Bytecode HithinkCompiler::compile(std::string_view source) {
     }
 
     emitByte(OpCode::HALT);
+    if (optimize_) {
+        optimizeBytecode(bytecode);
+    }
     return bytecode;
 }
 
@@ -129,13 +133,11 @@ void HithinkCompiler::visit(HithinkLiteralExpression& node) {
 }
 
 void HithinkCompiler::visit(HithinkUnaryExpression& node) {
-    node.right->accept(*this);
     if (node.op.type == TokenType::MINUS) {
-        auto right = bytecode.instructions.back();
-        bytecode.instructions.pop_back();
+        // -x 编译为 0 - x；先压入 0，操作数可以是任意长度的指令序列
         int constIndex = addConstant(0.0);
         emitByteWithOperand(OpCode::PUSH_CONST, constIndex);
-        bytecode.instructions.push_back(right);
+        node.right->accept(*this);
         emitByteForMath(OpCode::SUB);
     } else {
         throw std::runtime_error("Unsupported unary operator.");
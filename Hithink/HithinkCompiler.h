@@ -18,6 +18,9 @@ public:
 
     bool hadError() const;
 
+    // 是否在生成字节码后调用 optimizeBytecode (默认开启；关闭后用于对照优化前后的执行结果)
+    void setOptimizationEnabled(bool enabled) { optimize_ = enabled; }
+
 private:
     // HithinkAstVisitor 方法
     void visit(HithinkEmptyStatement& stmt) override;
@@ -46,6 +49,7 @@ private:
     std::unordered_map<std::string, int> globalVarSlots;
     int nextSlot = 0;
     bool hadError_ = false;
+    bool optimize_ = true;
 
     static const std::unordered_map<std::string, std::string> builtin_mappings;
 };
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "ParameterSweep.h"
+#include "BatchRunner.h"
+#include "BytecodeOptimizer.h"
+
+#include <algorithm>
+
+static int inputBars(const std::map<std::string, std::shared_ptr<const Series>>& inputs)
+{
+    int bars = 0;
+    for (const auto& pair : inputs)
+        if (pair.second)
+            bars = std::max(bars, pair.second->size());
+    return bars;
+}
+
+static void registerInputs(PineVM& vm, const std::map<std::string, std::shared_ptr<const Series>>& inputs)
+{
+    for (const auto& pair : inputs)
+        vm.registerSeries(pair.first, pair.second);
+}
+
+static std::vector<std::shared_ptr<const Series>> globalSeries(PineVM& vm)
+{
+    std::vector<std::shared_ptr<const Series>> result;
+    for (const Value& global : vm.getGlobalSeries())
+    {
+        const auto* series = std::get_if<std::shared_ptr<Series>>(&global);
+        result.push_back(series ? *series : nullptr);
+    }
+    return result;
+}
+
+std::vector<SweepResult> runSweep(const Bytecode& bytecode, const std::map<std::string, std::shared_ptr<const Series>>& inputs,
+                                  const std::vector<SweepParameter>& grid, int threads)
+{
+    std::vector<std::string> names;
+    size_t combinations = 1;
+    for (const SweepParameter& parameter : grid)
+    {
+        names.push_back(parameter.name);
+        combinations *= parameter.values.size();
+    }
+    const ParameterSplit split = splitParameterInvariant(bytecode, names);
+    const int bars = inputBars(inputs);
+
+    std::vector<SweepResult> results(combinations);
+    for (size_t k = 0; k < combinations; ++k)
+    {
+        results[k].parameters.resize(grid.size());
+        size_t rest = k;
+        for (size_t p = grid.size(); p-- > 0;)
+        {
+            results[k].parameters[p] = grid[p].values[rest % grid[p].values.size()];
+            rest /= grid[p].values.size();
+        }
+    }
+    if (combinations == 0)
+        return results;
+
+    // 与参数无关的部分只执行一次
+    std::map<std::string, std::shared_ptr<const Series>> hoisted;
+    if (!split.hoisted.empty())
+    {
+        PineVM vm;
+        registerInputs(vm, inputs);
+        vm.loadBytecode(split.shared);
+        if (vm.execute(bars) != 0)
+        {
+            for (SweepResult& result : results)
+            {
+                result.status = 1;
+                result.error_message = vm.getLastErrorMessage();
+            }
+            return results;
+        }
+        for (const std::string& name : split.hoisted)
+        {
+            const Value global = vm.getGlobal(name);
+            if (const auto* series = std::get_if<std::shared_ptr<Series>>(&global); series && *series)
+                hoisted[name] = *series;
+        }
+    }
+
+    runTasks(combinations, threads, [&](size_t k) {
+        SweepResult& result = results[k];
+        try
+        {
+            // 参数值追加到常量池末尾再改指令的操作数：原常量可能被其他指令共用
+            Bytecode lane = split.lane;
+            for (size_t p = 0; p < grid.size(); ++p)
+            {
+                lane.constant_pool.push_back(result.parameters[p]);
+                lane.instructions[split.parameter_sites[p]].operand = static_cast<int>(lane.constant_pool.size()) - 1;
+            }
+            PineVM vm;
+            registerInputs(vm, inputs);
+            for (const auto& pair : hoisted)
+                vm.registerSeries(hoistedVarName(pair.first), pair.second);
+            vm.loadBytecode(lane);
+            result.status = vm.execute(bars);
+            if (result.status != 0)
+                result.error_message = vm.getLastErrorMessage();
+            // 隐藏全局变量追加在末尾，去掉后下标与其余的全局变量名一一对应
+            std::vector<std::string> visible;
+            for (const std::string& name : bytecode.global_name_pool)
+                if (!isHiddenGlobal(name))
+                    visible.push_back(name);
+            result.series = globalSeries(vm);
+            result.series.resize(visible.size());
+            for (size_t i = 0; i < result.series.size(); ++i)
+            {
+                auto found = hoisted.find(visible[i]);
+                if (!result.series[i] && found != hoisted.end())
+                    result.series[i] = found->second;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            result.status = 1;
+            result.error_message = e.what();
+        }
+    });
+    return results;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "PineVM.h"
+
+//-----------------------------------------------------------------------------
+// 参数扫描
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief 一个扫描参数：脚本中只赋值一次的全局变量 (N:=14; 或 N:=input.int(14, "Length");) 及其取值。
+ */
+struct SweepParameter {
+    std::string name;
+    std::vector<double> values;
+};
+
+/**
+ * @brief 一个参数组合的计算结果。
+ */
+struct SweepResult {
+    std::vector<double> parameters; // 与 grid 顺序一致的参数值
+    int status = 0;                 // PineVM::execute 的返回值，0 表示成功
+    std::string error_message;      // status 非 0 时的错误信息
+    // 全局序列，顺序与原字节码的 global_name_pool (不含隐藏全局变量) 一致，未赋值的为空；
+    // 与参数无关的序列只计算一次，所有组合共享同一个对象
+    std::vector<std::shared_ptr<const Series>> series;
+};
+
+/**
+ * @brief 对参数网格的所有组合 (笛卡尔积，最后一个参数变化最快) 计算同一份字节码。
+ *        与参数无关的语句和子表达式 (见 splitParameterInvariant) 对整组输入只计算一次，
+ *        结果以只读序列提供给各组合；各组合只把参数常量换成自己的值，不重新编译，
+ *        并由 runTasks 分配到多个线程执行。
+ * @param bytecode 编译器输出的字节码。
+ * @param inputs 输入列 (open、high、low、close 等)，以只读方式注册，不复制。
+ * @param grid 扫描参数。
+ * @param threads 工作线程数；<= 0 时使用 std::thread::hardware_concurrency()。
+ * @throws std::invalid_argument 参数不符合 splitParameterInvariant 的要求。
+ */
+std::vector<SweepResult> runSweep(const Bytecode& bytecode, const std::map<std::string, std::shared_ptr<const Series>>& inputs,
+                                  const std::vector<SweepParameter>& grid, int threads = 0);
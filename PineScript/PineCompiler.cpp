@@ -1,6 +1,7 @@
 #include "PineCompiler.h"
 #include <stdexcept> // For std::runtime_error
 #include "PineParser.h" // 需要包含解析器来生成 AST
+#include "../BytecodeOptimizer.h"
 
 PineCompiler::PineCompiler() {}
 
@@ -14,6 +15,7 @@ Bytecode PineCompiler::compile(const std::string& source) {
     }
 
     emitByte(OpCode::HALT);
+    optimizeBytecode(bytecode);
     return bytecode;
 }
 
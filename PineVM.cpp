@@ -1,4 +1,5 @@
 #include "PineVM.h"
+#include "VMKernels.h"
 #include <iostream>
 #include <iomanip>
 #include <numeric>
@@ -8,26 +9,49 @@
 #include <map>       // For opCodeMap in txtToBytecode
 #include <optional>  // For std::optional in txtToBytecode
 #include <cstdint>   // for uint64_t
+#include <limits>
 
 
 // --- FunctionContext 方法实现 ---
 
+Value FunctionContext::getArg(size_t index) const {
+    return vm_.toValue(getRawArg(index));
+}
+
 double FunctionContext::getArgAsNumeric(size_t index) const {
-    return vm_.getNumericValue(getArg(index));
+    return vm_.getNumericValue(getRawArg(index));
 }
 
-std::shared_ptr<Series> FunctionContext::getArgAsSeries(size_t index) const {
-    const Value& val = getArg(index);
-    if (auto* p = std::get_if<std::shared_ptr<Series>>(&val)) {
-        return *p;
+bool FunctionContext::getArgAsBool(size_t index) const {
+    const StackValue& val = getRawArg(index);
+    if (val.tag == StackValue::Tag::Bool) {
+        return val.boolean;
+    }
+    // 与 PineVM::getBoolValue 一致：数值按非零判断 (NaN 视为 true)
+    return static_cast<bool>(vm_.getNumericValue(val));
+}
+
+Series& FunctionContext::getArgSeries(size_t index) const {
+    const StackValue& val = getRawArg(index);
+    if (val.tag == StackValue::Tag::Series && val.series) {
+        return *val.series;
     }
     throw std::runtime_error("Argument " + std::to_string(index) + " is not a Series.");
 }
 
-std::string FunctionContext::getArgAsString(size_t index) const {
-    const Value& val = getArg(index);
-    if (auto* p = std::get_if<std::string>(&val)) {
-        return *p;
+Series* FunctionContext::getArgSeriesOrNull(size_t index) const {
+    const StackValue& val = getRawArg(index);
+    return val.tag == StackValue::Tag::Series ? val.series : nullptr;
+}
+
+std::shared_ptr<Series> FunctionContext::getArgAsSeries(size_t index) const {
+    return getArgSeries(index).shared_from_this();
+}
+
+const std::string& FunctionContext::getArgString(size_t index) const {
+    const StackValue& val = getRawArg(index);
+    if (val.tag == StackValue::Tag::String) {
+        return vm_.string_pool[val.string_index];
     }
     throw std::runtime_error("Argument " + std::to_string(index) + " is not a String.");
 }
@@ -36,11 +60,612 @@ int FunctionContext::getCurrentBarIndex() const {
     return vm_.getCurrentBarIndex();
 }
 
+Series& FunctionContext::getStateSeries(const char* name, int history) {
+    if (!state_slots_) {
+        state_slots_ = &vm_.state_series_index[result_series_.get()];
+    }
+    Series *indexed = nullptr;
+    for (const auto &slot : *state_slots_) {
+        if (slot.first == name) {
+            indexed = slot.second;
+            break;
+        }
+    }
+    if (!indexed) {
+        std::string key = "__call__";
+        key += name;
+        key += '@';
+        key += std::to_string(reinterpret_cast<std::uintptr_t>(result_series_.get()));
+        std::shared_ptr<Series> &state = vm_.builtin_func_cache[key];
+        if (!state) {
+            state = std::make_shared<Series>();
+            state->name = key;
+        }
+        indexed = state.get();
+        state_slots_->push_back({name, indexed});
+    }
+    if (result_series_->isBounded()) {
+        indexed->setCapacity(history + 1); // 只会增大，容量已够时直接返回
+    }
+    return *indexed;
+}
+
+// 不超过这个长度的窗口直接逐根扫描：比查找状态序列更快，结果也与逐根扫描逐位一致
+static constexpr int kRescanWindow = 32;
+
+FunctionContext::WindowSum FunctionContext::windowSum(Series& source, int length, bool count_nonzero) {
+    const int bar = getCurrentBarIndex();
+    auto value = [&](int i) {
+        double val = source.getCurrent(i);
+        return count_nonzero ? (!std::isnan(val) && val != 0.0 ? 1.0 : 0.0) : val;
+    };
+    // 与原来的逐根求和顺序相同 (从当前根往前)
+    auto rescan = [&]() {
+        WindowSum window;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            double val = value(bar - i);
+            if (!std::isnan(val)) {
+                window.sum += val;
+                window.valid++;
+            }
+        }
+        return window;
+    };
+    if (length <= kRescanWindow) {
+        return rescan();
+    }
+
+    Series &sum_state = getStateSeries("window.sum");
+    Series &valid_state = getStateSeries("window.valid");
+    Series &length_state = getStateSeries("window.length");
+    WindowSum window;
+    const double prev_valid = valid_state.getCurrent(bar - 1);
+    bool exact = bar % length == 0 || std::isnan(prev_valid) || length_state.getCurrent(bar - 1) != length;
+    if (!exact) {
+        window.sum = sum_state.getCurrent(bar - 1);
+        window.valid = static_cast<int>(prev_valid);
+        double incoming = value(bar);
+        if (!std::isnan(incoming)) {
+            window.sum += incoming;
+            window.valid++;
+        }
+        if (bar - length >= 0) {
+            double outgoing = value(bar - length);
+            if (!std::isnan(outgoing)) {
+                window.sum -= outgoing;
+                window.valid--;
+            }
+        }
+        // 窗口刚变为全部有效 (开头填满或 NaN 移出) 时重算，第一个有效结果与逐根求和一致
+        exact = window.valid == length && static_cast<int>(prev_valid) < length;
+    }
+    if (exact) {
+        window = rescan();
+    }
+    sum_state.setCurrent(bar, window.sum);
+    valid_state.setCurrent(bar, window.valid);
+    length_state.setCurrent(bar, length);
+    return window;
+}
+
+FunctionContext::WindowMoments FunctionContext::windowMoments(Series& source, int length) {
+    const int bar = getCurrentBarIndex();
+    // 与原来的两遍扫描顺序相同 (从当前根往前)：先求均值，再求离差平方和
+    auto rescan = [&]() {
+        WindowMoments moments;
+        double sum = 0.0;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            double val = source.getCurrent(bar - i);
+            if (!std::isnan(val)) {
+                sum += val;
+                moments.valid++;
+            }
+        }
+        if (moments.valid == 0) {
+            return moments;
+        }
+        moments.mean = sum / moments.valid;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            double val = source.getCurrent(bar - i);
+            if (!std::isnan(val)) {
+                moments.sum_sq_dev += (val - moments.mean) * (val - moments.mean);
+            }
+        }
+        return moments;
+    };
+    if (length <= kRescanWindow) {
+        return rescan();
+    }
+
+    // 递推 Σ(x - shift) 和 Σ(x - shift)²，shift 取最近一次完整重算时的窗口均值，避免大数相减损失精度
+    Series &shift_state = getStateSeries("moments.shift");
+    Series &sum_state = getStateSeries("moments.sum");
+    Series &sq_state = getStateSeries("moments.sq");
+    Series &valid_state = getStateSeries("moments.valid");
+    Series &length_state = getStateSeries("moments.length");
+    const double prev_valid = valid_state.getCurrent(bar - 1);
+    double shift = shift_state.getCurrent(bar - 1);
+    double sum = sum_state.getCurrent(bar - 1);
+    double sq = sq_state.getCurrent(bar - 1);
+    int valid = static_cast<int>(prev_valid);
+    bool exact = bar % length == 0 || std::isnan(prev_valid) || length_state.getCurrent(bar - 1) != length;
+    if (!exact) {
+        double incoming = source.getCurrent(bar);
+        if (!std::isnan(incoming)) {
+            sum += incoming - shift;
+            sq += (incoming - shift) * (incoming - shift);
+            valid++;
+        }
+        if (bar - length >= 0) {
+            double outgoing = source.getCurrent(bar - length);
+            if (!std::isnan(outgoing)) {
+                sum -= outgoing - shift;
+                sq -= (outgoing - shift) * (outgoing - shift);
+                valid--;
+            }
+        }
+        exact = valid == length && static_cast<int>(prev_valid) < length;
+    }
+
+    WindowMoments moments;
+    if (exact) {
+        moments = rescan();
+        // 以新的均值重新居中：平移后的和为 0，平方和就是离差平方和
+        shift = std::isnan(moments.mean) ? 0.0 : moments.mean;
+        sum = 0.0;
+        sq = moments.sum_sq_dev;
+        valid = moments.valid;
+    } else if (valid > 0) {
+        moments.valid = valid;
+        moments.mean = shift + sum / valid;
+        moments.sum_sq_dev = std::max(0.0, sq - sum * sum / valid);
+    } else {
+        // 窗口全是 NaN：平移后的和与平方和应为 0，清掉累计的舍入误差
+        sum = 0.0;
+        sq = 0.0;
+    }
+    shift_state.setCurrent(bar, shift);
+    sum_state.setCurrent(bar, sum);
+    sq_state.setCurrent(bar, sq);
+    valid_state.setCurrent(bar, valid);
+    length_state.setCurrent(bar, length);
+    return moments;
+}
+
+FunctionContext::WindowRegression FunctionContext::windowRegression(const Series* x, const Series& y, int length, PairSource source) {
+    const int bar = getCurrentBarIndex();
+    // 第 i 根的样本点，任一分量无效时返回 false
+    auto sample = [&](int i, double &px, double &py) {
+        switch (source) {
+        case PairSource::Time:
+            px = i;
+            py = y.getCurrent(i);
+            break;
+        case PairSource::Values:
+            px = x->getCurrent(i);
+            py = y.getCurrent(i);
+            break;
+        case PairSource::Returns: {
+            double x_prev = x->getCurrent(i - 1);
+            double y_prev = y.getCurrent(i - 1);
+            px = x_prev == 0.0 ? NAN : x->getCurrent(i) / x_prev - 1.0;
+            py = y_prev == 0.0 ? NAN : y.getCurrent(i) / y_prev - 1.0;
+            break;
+        }
+        }
+        return !std::isnan(px) && !std::isnan(py);
+    };
+    // 两遍扫描：先求均值，再求离差平方和与乘积和
+    auto rescan = [&]() {
+        WindowRegression regression;
+        double sum_x = 0.0, sum_y = 0.0, px = NAN, py = NAN;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            if (sample(bar - i, px, py)) {
+                sum_x += px;
+                sum_y += py;
+                regression.valid++;
+            }
+        }
+        if (regression.valid == 0) {
+            return regression;
+        }
+        regression.mean_x = sum_x / regression.valid;
+        regression.mean_y = sum_y / regression.valid;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            if (sample(bar - i, px, py)) {
+                const double dx = px - regression.mean_x;
+                const double dy = py - regression.mean_y;
+                regression.sxx += dx * dx;
+                regression.syy += dy * dy;
+                regression.sxy += dx * dy;
+            }
+        }
+        return regression;
+    };
+    if (length <= kRescanWindow) {
+        return rescan();
+    }
+
+    // 状态依次为 x、y 的中心，平移后的 Σx、Σy、Σxy、Σx²、Σy²，样本个数和窗口长度
+    static const char *const kStateNames[] = {
+        "regression.shift_x", "regression.shift_y", "regression.sum_x", "regression.sum_y",
+        "regression.sum_xy", "regression.sum_xx", "regression.sum_yy", "regression.valid", "regression.length",
+    };
+    Series *states[9];
+    double state[9];
+    for (int k = 0; k < 9; ++k) {
+        states[k] = &getStateSeries(kStateNames[k]);
+        state[k] = states[k]->getCurrent(bar - 1);
+    }
+    double &shift_x = state[0], &shift_y = state[1], &sum_x = state[2], &sum_y = state[3];
+    double &sum_xy = state[4], &sum_xx = state[5], &sum_yy = state[6], &valid = state[7];
+    const double prev_valid = valid;
+    bool exact = bar % length == 0 || std::isnan(prev_valid) || state[8] != length;
+    if (!exact) {
+        auto add = [&](int i, double sign) {
+            double px = NAN, py = NAN;
+            if (!sample(i, px, py)) {
+                return;
+            }
+            const double dx = px - shift_x;
+            const double dy = py - shift_y;
+            sum_x += sign * dx;
+            sum_y += sign * dy;
+            sum_xy += sign * dx * dy;
+            sum_xx += sign * dx * dx;
+            sum_yy += sign * dy * dy;
+            valid += sign;
+        };
+        add(bar, 1.0);
+        if (bar - length >= 0) {
+            add(bar - length, -1.0);
+        }
+        exact = valid == length && prev_valid < length;
+    }
+
+    WindowRegression regression;
+    if (exact) {
+        regression = rescan();
+        // 以新的均值重新居中
+        shift_x = std::isnan(regression.mean_x) ? 0.0 : regression.mean_x;
+        shift_y = std::isnan(regression.mean_y) ? 0.0 : regression.mean_y;
+        sum_x = sum_y = 0.0;
+        sum_xx = regression.sxx;
+        sum_yy = regression.syy;
+        sum_xy = regression.sxy;
+        valid = regression.valid;
+    } else if (valid > 0) {
+        regression.valid = static_cast<int>(valid);
+        regression.mean_x = shift_x + sum_x / valid;
+        regression.mean_y = shift_y + sum_y / valid;
+        regression.sxx = std::max(0.0, sum_xx - sum_x * sum_x / valid);
+        regression.syy = std::max(0.0, sum_yy - sum_y * sum_y / valid);
+        regression.sxy = sum_xy - sum_x * sum_y / valid;
+    } else {
+        sum_x = sum_y = sum_xy = sum_xx = sum_yy = 0.0;
+    }
+    state[8] = length;
+    for (int k = 0; k < 9; ++k) {
+        states[k]->setCurrent(bar, state[k]);
+    }
+    return regression;
+}
+
+//-----------------------------------------------------------------------------
+// 有序窗口 (avedev 用)
+//-----------------------------------------------------------------------------
+
+/**
+ * @class SortedWindow
+ * @brief 按 (值, K 线下标) 排序的窗口 (treap)，插入、删除和求大于某值的元素个数与和都是 O(log n)。
+ *        节点优先级由 K 线下标确定，同一组元素的树形与插入顺序无关，所以滑动得到的和与重建得到的逐位一致。
+ *        不进入快照：记录对应的窗口 (结束下标、长度和最后一根的值)，下一根时滑动，同一根重算时替换最后一根，
+ *        其余情况 (首次使用、跳过 K 线、恢复快照后) 从源序列重建。
+ */
+class SortedWindow {
+public:
+    int end = -1;     // 窗口最后一根的下标，-1 表示需要重建
+    int length = 0;
+    double last = NAN; // 最后一根加入的值，NaN 表示没有加入
+
+    void clear()
+    {
+        nodes_.clear();
+        free_.clear();
+        root_ = -1;
+    }
+    int size() const { return count(root_); }
+    double sum() const { return total(root_); }
+
+    void insert(double value, int index)
+    {
+        int node;
+        if (free_.empty()) {
+            node = static_cast<int>(nodes_.size());
+            nodes_.emplace_back();
+        } else {
+            node = free_.back();
+            free_.pop_back();
+        }
+        nodes_[node] = {value, index, priority(index), -1, -1, 1, value};
+        int left, right;
+        split(root_, value, index, left, right);
+        root_ = merge(merge(left, node), right);
+    }
+
+    void erase(double value, int index)
+    {
+        int left, rest, node, right;
+        split(root_, value, index, left, rest);
+        split(rest, value, index + 1, node, right);
+        if (node >= 0) {
+            free_.push_back(node); // (value, index) 唯一，node 没有子树
+        }
+        root_ = merge(left, right);
+    }
+
+    // 值大于 threshold 的元素个数与和
+    void above(double threshold, int &n, double &s) const
+    {
+        n = 0;
+        s = 0.0;
+        for (int node = root_; node >= 0;) {
+            const Node &current = nodes_[node];
+            if (current.value > threshold) {
+                n += 1 + count(current.right);
+                s += current.value + total(current.right);
+                node = current.left;
+            } else {
+                node = current.right;
+            }
+        }
+    }
+
+private:
+    struct Node {
+        double value;
+        int index;
+        uint32_t priority;
+        int left, right;
+        int count;
+        double sum;
+    };
+
+    // 下标的双射散列，窗口内各元素的优先级互不相同
+    static uint32_t priority(int index)
+    {
+        uint32_t h = static_cast<uint32_t>(index);
+        h ^= h >> 16;
+        h *= 0x7feb352dU;
+        h ^= h >> 15;
+        h *= 0x846ca68bU;
+        h ^= h >> 16;
+        return h;
+    }
+    int count(int node) const { return node < 0 ? 0 : nodes_[node].count; }
+    double total(int node) const { return node < 0 ? 0.0 : nodes_[node].sum; }
+    void update(int node)
+    {
+        Node &n = nodes_[node];
+        n.count = 1 + count(n.left) + count(n.right);
+        n.sum = total(n.left) + n.value + total(n.right);
+    }
+    static bool less(const Node &n, double value, int index)
+    {
+        return n.value < value || (n.value == value && n.index < index);
+    }
+    // left 为小于 (value, index) 的元素，right 为其余
+    void split(int node, double value, int index, int &left, int &right)
+    {
+        if (node < 0) {
+            left = right = -1;
+            return;
+        }
+        if (less(nodes_[node], value, index)) {
+            split(nodes_[node].right, value, index, nodes_[node].right, right);
+            left = node;
+        } else {
+            split(nodes_[node].left, value, index, left, nodes_[node].left);
+            right = node;
+        }
+        update(node);
+    }
+    int merge(int left, int right)
+    {
+        if (left < 0 || right < 0) {
+            return left < 0 ? right : left;
+        }
+        if (nodes_[left].priority > nodes_[right].priority) {
+            nodes_[left].right = merge(nodes_[left].right, right);
+            update(left);
+            return left;
+        }
+        nodes_[right].left = merge(left, nodes_[right].left);
+        update(right);
+        return right;
+    }
+
+    std::vector<Node> nodes_;
+    std::vector<int> free_;
+    int root_ = -1;
+};
+
+// 有序窗口每根要做几次 O(log n) 的插入删除，窗口不超过这个长度时直接扫描更快
+static constexpr int kRescanAbsDeviation = 80;
+
+double FunctionContext::windowMeanAbsDeviation(Series& source, int length) {
+    const int bar = getCurrentBarIndex();
+    if (length <= kRescanAbsDeviation) {
+        // 与原来的两遍扫描顺序相同 (从当前根往前)
+        double sum = 0.0;
+        int valid = 0;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            double val = source.getCurrent(bar - i);
+            if (!std::isnan(val)) {
+                sum += val;
+                valid++;
+            }
+        }
+        if (valid == 0) {
+            return NAN;
+        }
+        const double mean = sum / valid;
+        double sum_dev = 0.0;
+        for (int i = 0; i < length && bar - i >= 0; ++i) {
+            double val = source.getCurrent(bar - i);
+            if (!std::isnan(val)) {
+                sum_dev += std::abs(val - mean);
+            }
+        }
+        return sum_dev / valid;
+    }
+
+    std::shared_ptr<SortedWindow> &slot = vm_.sorted_windows[result_series_.get()];
+    if (!slot) {
+        slot = std::make_shared<SortedWindow>();
+    }
+    SortedWindow &window = *slot;
+    const double incoming = source.getCurrent(bar);
+    if (window.length == length && window.end == bar) {
+        // 同一根重算 (盘中试算)：换掉上次加入的值
+        if (!std::isnan(window.last)) {
+            window.erase(window.last, bar);
+        }
+    } else if (window.length == length && window.end == bar - 1) {
+        if (bar - length >= 0) {
+            double outgoing = source.getCurrent(bar - length);
+            if (!std::isnan(outgoing)) {
+                window.erase(outgoing, bar - length);
+            }
+        }
+    } else {
+        window.clear();
+        window.length = length;
+        for (int i = std::max(0, bar - length + 1); i < bar; ++i) {
+            double val = source.getCurrent(i);
+            if (!std::isnan(val)) {
+                window.insert(val, i);
+            }
+        }
+    }
+    if (!std::isnan(incoming)) {
+        window.insert(incoming, bar);
+    }
+    window.end = bar;
+    window.last = incoming;
+
+    const int n = window.size();
+    if (n == 0) {
+        return NAN;
+    }
+    // Σ|x - mean| = Σ(x > mean)(x - mean) + Σ(x <= mean)(mean - x)
+    const double total = window.sum();
+    const double mean = total / n;
+    int above_count;
+    double above_sum;
+    window.above(mean, above_count, above_sum);
+    const double sum_dev = (above_sum - mean * above_count) + (mean * (n - above_count) - (total - above_sum));
+    return sum_dev / n;
+}
+
+// 窗口按 length 对齐分块 (van Herk / Gil-Werman)：窗口 [start, end] 至多跨两块，
+// 等于上一块的后缀 [start, b - 1] 与本块的前缀 [b, end] 合并。前缀逐根递推；
+// 上一块的后缀在进入新块时一次算好 (每 length 根扫描 length - 1 根)，所以每根的均摊开销与 length 无关。
+// 状态都按 K 线下标保存 (同一根重算时结果相同)，临时计算和快照无需特殊处理。
+int FunctionContext::windowExtreme(Series& source, int length, bool highest, bool oldest_on_tie, int offset) {
+    const int end = getCurrentBarIndex() - offset;
+    if (end < 0 || length <= 0) {
+        return -1;
+    }
+    // older 早于 newer，返回两者中的极值所在下标；-1 表示没有有效值
+    auto better = [&](int older, int newer) {
+        if (older < 0) return newer;
+        if (newer < 0) return older;
+        double a = source.getCurrent(older);
+        double b = source.getCurrent(newer);
+        if (a == b) return oldest_on_tie ? older : newer;
+        return (highest ? a > b : a < b) ? older : newer;
+    };
+    auto valid = [&](int i) { return std::isnan(source.getCurrent(i)) ? -1 : i; };
+
+    const int start = end - length + 1;
+    if (length <= kRescanWindow) {
+        int best = -1;
+        for (int i = end; i >= 0 && i >= start; --i) {
+            best = better(valid(i), best);
+        }
+        return best;
+    }
+
+    Series &prefix_state = getStateSeries("extreme.prefix");
+    Series &suffix_state = getStateSeries("extreme.suffix", length);
+    Series &length_state = getStateSeries("extreme.length");
+    const int block = end - end % length;
+    int prefix;
+    if (end % length != 0 && length_state.getCurrent(end - 1) == length) {
+        prefix = better(static_cast<int>(prefix_state.getCurrent(end - 1)), valid(end));
+    } else {
+        // 进入新块或上一根的状态不可用：重建本块的前缀和上一块的后缀
+        prefix = -1;
+        for (int i = block; i <= end; ++i) {
+            prefix = better(prefix, valid(i));
+        }
+        int suffix = -1;
+        for (int i = block - 1; i >= 0 && i >= start; --i) {
+            suffix = better(valid(i), suffix);
+            suffix_state.setCurrent(i, suffix);
+        }
+    }
+    prefix_state.setCurrent(end, prefix);
+    length_state.setCurrent(end, length);
+    if (start >= block) {
+        return prefix;
+    }
+    return better(static_cast<int>(suffix_state.getCurrent(start)), prefix);
+}
+
+
+// --- BuiltinRegistry 实现 ---
+
+const PineVM::BuiltinRegistry& PineVM::BuiltinRegistry::instance()
+{
+    static const BuiltinRegistry registry;
+    return registry;
+}
+
+PineVM::BuiltinRegistry::BuiltinRegistry()
+{
+    std::map<std::string, BuiltinInfo> built_in_funcs;
+    registerBuiltins(built_in_funcs);
+
+    funcs_.reserve(built_in_funcs.size());
+    names_.reserve(built_in_funcs.size());
+    ids_.reserve(built_in_funcs.size());
+    for (auto &pair : built_in_funcs)
+    {
+        ids_.emplace(pair.first, static_cast<int>(funcs_.size()));
+        names_.push_back(pair.first);
+        funcs_.push_back(std::move(pair.second));
+    }
+}
+
+int PineVM::BuiltinRegistry::find(const std::string &name) const
+{
+    auto it = ids_.find(name);
+    return it == ids_.end() ? -1 : it->second;
+}
+
+bool PineVM::isPureBuiltin(const std::string &name)
+{
+    const BuiltinRegistry &registry = BuiltinRegistry::instance();
+    int id = registry.find(name);
+    return id >= 0 && registry.get(id).pure;
+}
+
 
 PineVM::PineVM()
-    : total_bars(0), bar_index(0), ip(nullptr)
+    : total_bars(0), bar_index(0)
 {
-    registerBuiltins();
 }
 
 PineVM::~PineVM()
@@ -50,13 +675,25 @@ PineVM::~PineVM()
 // loadBytecode 现在负责加载代码并重置整个VM的状态
 void PineVM::loadBytecode(const std::string &code)
 {
-    std::cout << "----- Loading bytecode and resetting VM -----" << std::endl;
-    bytecode = txtToBytecode(code);
-    std::cout << bytecodeToTxt(bytecode);
+    loadBytecode(txtToBytecode(code));
+}
+
+void PineVM::loadBytecode(const Bytecode &code)
+{
+    if (log_bytecode)
+    {
+        std::cout << "----- Loading bytecode and resetting VM -----" << std::endl;
+        std::cout << bytecodeToTxt(code);
+    }
+    bytecode = code;
 
     // 重置所有计算状态，为新的执行做准备
     globals.clear();
     globals.resize(bytecode.global_name_pool.size());
+    hidden_globals.clear();
+    for (size_t i = 0; i < bytecode.global_name_pool.size(); ++i)
+        if (isHiddenGlobal(bytecode.global_name_pool[i]))
+            hidden_globals.push_back(static_cast<int>(i));
     exports.clear();
 
     vars.clear();
@@ -70,62 +707,1203 @@ void PineVM::loadBytecode(const std::string &code)
     
     // 清空绘图结果和函数状态缓存
     builtin_func_cache.clear();
+    state_series_index.clear();
+    sorted_windows.clear();
+    linkCallSites();
+    checkRangeEligible();
+
+    // 常量池预先转换为 StackValue，读取常量操作数时只需拷贝 16 字节
+    pinned_series.clear();
+    string_pool.clear();
+    constant_values.clear();
+    constant_values.reserve(bytecode.constant_pool.size());
+    for (const Value &constant : bytecode.constant_pool)
+    {
+        if (auto *p = std::get_if<std::shared_ptr<Series>>(&constant))
+            pinned_series.push_back(*p);
+        constant_values.push_back(toStackValue(constant));
+    }
+    lowerToRegisterIR();
+    analyzeLookback();
+    pc = nullptr;
 
     // 重置执行上下文
     bar_index = 0;
     total_bars = 0;
+    tentative_active = false;
+    tentative_evaluated = false;
 }
 
-// execute 现在可以处理批量和增量计算
-int PineVM::execute(int new_total_bars)
+// 为每个 CALL_BUILTIN_FUNC 解析函数、校验参数数量并创建结果序列。
+// 链接错误不在此处抛出，而是记录下来，等执行到该指令时再报告，
+// 这样错误信息仍然带有 bar_index 和 ip，与之前的行为一致 (见 lowerToRegisterIR 的 Trap)。
+void PineVM::linkCallSites()
 {
-    // 如果新的目标K线数不大于当前已计算的K线数，则无需操作
-    if (new_total_bars <= this->bar_index) {
-        // std::cout << "No new bars to execute. Current index: " << bar_index 
-        //           << ", requested total: " << new_total_bars << std::endl;
-        return 0; // 不是错误，只是无事可做
+    call_sites.clear();
+    call_sites.resize(bytecode.instructions.size());
+
+    for (size_t i = 0; i < bytecode.instructions.size(); ++i)
+    {
+        const Instruction &instr = bytecode.instructions[i];
+        if (instr.op != OpCode::CALL_BUILTIN_FUNC)
+            continue;
+
+        CallSite &site = call_sites[i];
+        const auto *name_ptr = std::get_if<std::string>(&bytecode.constant_pool.at(instr.operand));
+        if (!name_ptr)
+        {
+            site.link_error = "Invalid function name constant at index " + std::to_string(instr.operand) + ".";
+            continue;
+        }
+        const std::string &func_name = *name_ptr;
+
+        const BuiltinRegistry &registry = BuiltinRegistry::instance();
+        int builtin_id = registry.find(func_name);
+        if (builtin_id < 0)
+        {
+            site.link_error = "Undefined built-in function: " + func_name;
+            continue;
+        }
+        const BuiltinInfo &builtin_info = registry.get(builtin_id);
+
+        // 编译器总是在调用前用 PUSH_CONST 压入参数数量，可以在加载时直接确定。
+        if (i > 0 && bytecode.instructions[i - 1].op == OpCode::PUSH_CONST)
+        {
+            const Value &count_val = bytecode.constant_pool.at(bytecode.instructions[i - 1].operand);
+            if (const auto *count_ptr = std::get_if<double>(&count_val))
+            {
+                int actual_args = static_cast<int>(*count_ptr);
+                if (actual_args < builtin_info.min_args || actual_args > builtin_info.max_args)
+                {
+                    std::string expected;
+                    if (builtin_info.min_args == builtin_info.max_args) {
+                        expected = std::to_string(builtin_info.min_args);
+                    } else {
+                        expected = "between " + std::to_string(builtin_info.min_args) +
+                                   " and " + std::to_string(builtin_info.max_args);
+                    }
+                    site.link_error = "Invalid number of arguments for '" + func_name + "'. "
+                                      "Expected " + expected + " arguments, but got "
+                                      + std::to_string(actual_args) + ".";
+                    continue;
+                }
+                site.arg_count = actual_args;
+            }
+        }
+
+        // 基于函数和指令位置创建唯一的缓存键，以支持状态保持
+        // (常量池去重后多个调用点会共用同一个函数名常量，不能再用常量下标区分)
+        std::string cache_key = "__call__" + func_name + "__" + std::to_string(i);
+        auto &cached = builtin_func_cache[cache_key];
+        if (!cached)
+        {
+            cached = std::make_shared<Series>();
+            cached->name = cache_key;
+        }
+        site.result_series = cached;
+        site.info = &builtin_info;
     }
+}
 
-    this->total_bars = new_total_bars;
+// 判定脚本能否按列执行。条件：
+//   1. 没有跳转指令 (所有 bar 执行同一条直线路径)；
+//   2. 每个全局变量只被写一次，且所有读取都出现在写入之后。
+// 满足时，第 i 条指令在 bar j 上只依赖前面指令在 bar <= j 上的结果，
+// 因此"先指令后 bar"与"先 bar 后指令"两种遍历顺序的结果完全相同。
+void PineVM::checkRangeEligible()
+{
+    range_eligible = false;
+    std::vector<bool> stored(bytecode.global_name_pool.size(), false);
 
-    try
+    for (const Instruction &instr : bytecode.instructions)
     {
-        // 循环从当前 bar_index 继续，直到达到新的 total_bars
-        // 这个 for 循环的结构是实现增量计算的关键
-        for (; bar_index < this->total_bars; ++bar_index)
+        switch (instr.op)
         {
-            // std::cout << "--- Executing Bar #" << bar_index << " ---" << std::endl;
-            runCurrentBar();
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+            return;
+        case OpCode::LOAD_GLOBAL:
+            if (instr.operand < 0 || static_cast<size_t>(instr.operand) >= stored.size() || !stored[instr.operand])
+                return;
+            break;
+        case OpCode::STORE_GLOBAL:
+        case OpCode::STORE_EXPORT:
+            if (instr.operand < 0 || static_cast<size_t>(instr.operand) >= stored.size() || stored[instr.operand])
+                return;
+            stored[instr.operand] = true;
+            break;
+        default:
+            break;
         }
     }
-    catch (const std::exception &e)
+    range_eligible = true;
+}
+
+// 把栈式字节码降级为寄存器式 IR。
+// 用一个符号栈模拟执行：PUSH_CONST / LOAD_GLOBAL / LOAD_BUILTIN_VAR 不生成指令，只把操作数压入符号栈，
+// 运算、存储和调用直接引用它们。跳转前和跳转目标处把符号栈规范化为"第 d 层即寄存器 d"，
+// 保证不同路径汇合时状态一致。字节码在某处无法合法执行时 (栈下溢等) 生成 Trap 指令，
+// 错误仍然在执行到该处时才报告。
+void PineVM::lowerToRegisterIR()
+{
+    using Kind = IrOperand::Kind;
+    const std::vector<Instruction> &code = bytecode.instructions;
+    const int n = static_cast<int>(code.size());
+
+    ir.clear();
+    ir_args.clear();
+    ir_traps.clear();
+    builtin_var_names.clear();
+
+    // 与原解释器一致：JUMP_IF_FALSE 跳到 i + operand，JUMP 跳到 i + operand + 1
+    auto jumpTarget = [&](int i) {
+        return code[i].op == OpCode::JUMP ? i + code[i].operand + 1 : i + code[i].operand;
+    };
+    std::vector<bool> is_target(n + 1, false);
+    for (int i = 0; i < n; ++i)
     {
-        // 错误发生时，bar_index 会停留在出错的K线上，方便调试
-        std::stringstream ss;
-        ss << "PineVM::execute Error: " << e.what()
-                  << " @bar_index: " << bar_index
-                  << " @ip: " << (ip ? std::to_string(ip - &bytecode.instructions[0]) : "null")
-                  << std::endl;
-        lastErrorMessage = ss.str();
-        return 1;
+        if (code[i].op == OpCode::JUMP || code[i].op == OpCode::JUMP_IF_FALSE)
+        {
+            int target = jumpTarget(i);
+            if (target > i && target <= n)
+                is_target[target] = true;
+        }
+    }
+
+    std::vector<IrOperand> sym;              // 符号栈
+    size_t max_depth = 0;
+    std::vector<int> label(n + 1, -1);       // 字节码下标 -> IR 下标
+    std::vector<int> target_depth(n + 1, -1);
+    std::vector<std::pair<size_t, int>> fixups; // (跳转指令的 IR 下标, 字节码目标)
+    std::map<std::string, int> builtin_var_slots;
+    bool reachable = true;
+
+    auto emit = [&](IrInstr instr, int source) {
+        instr.source_ip = source;
+        ir.push_back(instr);
+    };
+    auto trap = [&](const std::string &message, int source) {
+        IrInstr instr;
+        instr.op = IrOp::Trap;
+        instr.operand = static_cast<int>(ir_traps.size());
+        ir_traps.push_back(message);
+        emit(instr, source);
+        reachable = false;
+    };
+    auto pushSym = [&](IrOperand operand) {
+        sym.push_back(operand);
+        max_depth = std::max(max_depth, sym.size());
+    };
+    auto reg = [](size_t depth) { return IrOperand{Kind::Reg, static_cast<int>(depth)}; };
+    // 把第 d 层的操作数搬到寄存器 d
+    auto materialize = [&](size_t depth, int source) {
+        if (sym[depth].kind == Kind::Reg && sym[depth].index == static_cast<int>(depth))
+            return;
+        IrInstr move;
+        move.op = IrOp::Move;
+        move.dst = static_cast<int>(depth);
+        move.a = sym[depth];
+        emit(move, source);
+        sym[depth] = reg(depth);
+    };
+    auto flush = [&](int source) {
+        for (size_t d = 0; d < sym.size(); ++d)
+            materialize(d, source);
+    };
+    auto validVar = [&](int index) { return index >= 0 && index < static_cast<int>(vars.size()); };
+
+    for (int i = 0; i < n; ++i)
+    {
+        const Instruction &instr = code[i];
+
+        if (is_target[i])
+        {
+            if (reachable)
+            {
+                flush(i);
+                if (target_depth[i] >= 0 && target_depth[i] != static_cast<int>(sym.size()))
+                    trap("Inconsistent stack depth at jump target.", i);
+                target_depth[i] = static_cast<int>(sym.size());
+            }
+            else if (target_depth[i] >= 0)
+            {
+                sym.clear();
+                for (int d = 0; d < target_depth[i]; ++d)
+                    pushSym(reg(d));
+                reachable = true;
+            }
+            label[i] = static_cast<int>(ir.size());
+        }
+        if (!reachable)
+            continue;
+
+        switch (instr.op)
+        {
+        case OpCode::PUSH_CONST:
+            if (instr.operand < 0 || instr.operand >= static_cast<int>(bytecode.constant_pool.size()))
+            {
+                trap("Invalid constant index (" + std::to_string(instr.operand) + ").", i);
+                break;
+            }
+            pushSym({Kind::Const, instr.operand});
+            break;
+        case OpCode::POP:
+            if (sym.empty())
+            {
+                trap("Stack underflow!", i);
+                break;
+            }
+            sym.pop_back();
+            break;
+        case OpCode::LOAD_GLOBAL:
+            if (instr.operand < 0 || instr.operand >= static_cast<int>(globals.size()))
+            {
+                trap("Invalid global variable index (" + std::to_string(instr.operand) + ").", i);
+                break;
+            }
+            pushSym({Kind::Global, instr.operand});
+            break;
+        case OpCode::LOAD_BUILTIN_VAR:
+        {
+            const bool in_range = instr.operand >= 0 && instr.operand < static_cast<int>(bytecode.constant_pool.size());
+            const auto *name = in_range ? std::get_if<std::string>(&bytecode.constant_pool[instr.operand]) : nullptr;
+            if (!name)
+            {
+                trap("Invalid built-in variable name constant at index " + std::to_string(instr.operand) + ".", i);
+                break;
+            }
+            auto it = builtin_var_slots.find(*name);
+            if (it == builtin_var_slots.end())
+            {
+                it = builtin_var_slots.emplace(*name, static_cast<int>(builtin_var_names.size())).first;
+                builtin_var_names.push_back(*name);
+            }
+            pushSym({Kind::BuiltinVar, it->second});
+            break;
+        }
+        case OpCode::STORE_GLOBAL:
+        case OpCode::STORE_EXPORT:
+        {
+            if (sym.empty())
+            {
+                trap("Stack underflow!", i);
+                break;
+            }
+            if (instr.operand < 0 || instr.operand >= static_cast<int>(globals.size()))
+            {
+                trap("Invalid global variable index (" + std::to_string(instr.operand) + ").", i);
+                break;
+            }
+            IrInstr store;
+            store.op = instr.op == OpCode::STORE_GLOBAL ? IrOp::Store : IrOp::StoreExport;
+            store.operand = instr.operand;
+            store.a = sym.back();
+            sym.pop_back();
+            // 栈上尚未读取的同一全局变量必须保留写入前的值
+            for (size_t d = 0; d < sym.size(); ++d)
+            {
+                if (sym[d].kind == Kind::Global && sym[d].index == instr.operand)
+                    materialize(d, i);
+            }
+            emit(store, i);
+            break;
+        }
+        case OpCode::RENAME_SERIES:
+        {
+            if (sym.size() < 2)
+            {
+                trap("Stack underflow!", i);
+                break;
+            }
+            IrOperand name = sym.back();
+            if (name.kind != Kind::Const || !std::holds_alternative<std::string>(bytecode.constant_pool[name.index]))
+            {
+                trap("RENAME_SERIES expects a series and a name.", i);
+                break;
+            }
+            sym.pop_back();
+            IrInstr rename;
+            rename.op = IrOp::Rename;
+            rename.a = sym.back();
+            rename.operand = name.index;
+            emit(rename, i);
+            break;
+        }
+        case OpCode::SUBSCRIPT:
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+        case OpCode::DIV:
+        case OpCode::LESS:
+        case OpCode::LESS_EQUAL:
+        case OpCode::EQUAL_EQUAL:
+        case OpCode::BANG_EQUAL:
+        case OpCode::GREATER:
+        case OpCode::GREATER_EQUAL:
+        case OpCode::LOGICAL_AND:
+        case OpCode::LOGICAL_OR:
+        {
+            if (sym.size() < 2)
+            {
+                trap("Stack underflow!", i);
+                break;
+            }
+            if (!validVar(instr.operand))
+            {
+                trap("Invalid intermediate variable index (" + std::to_string(instr.operand) + ") for arithmetic/logic operation. Max index is " + std::to_string(static_cast<int>(vars.size()) - 1) + ".", i);
+                break;
+            }
+            IrInstr op;
+            op.op = instr.op == OpCode::SUBSCRIPT ? IrOp::Subscript : IrOp::Binary;
+            op.binop = instr.op;
+            op.dst = instr.operand;
+            op.b = sym.back();
+            sym.pop_back();
+            op.a = sym.back();
+            sym.pop_back();
+            emit(op, i);
+            pushSym({Kind::Var, instr.operand});
+            break;
+        }
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::JUMP:
+        {
+            IrInstr jump;
+            jump.op = instr.op == OpCode::JUMP ? IrOp::Jump : IrOp::JumpIfFalse;
+            if (instr.op == OpCode::JUMP_IF_FALSE)
+            {
+                if (sym.empty())
+                {
+                    trap("Stack underflow!", i);
+                    break;
+                }
+                jump.a = sym.back();
+                sym.pop_back();
+            }
+            int target = jumpTarget(i);
+            if (target <= i || target > n)
+            {
+                trap("Jump target out of range.", i);
+                break;
+            }
+            flush(i);
+            if (target_depth[target] >= 0 && target_depth[target] != static_cast<int>(sym.size()))
+            {
+                trap("Inconsistent stack depth at jump target.", i);
+                break;
+            }
+            target_depth[target] = static_cast<int>(sym.size());
+            fixups.emplace_back(ir.size(), target);
+            emit(jump, i);
+            if (instr.op == OpCode::JUMP)
+                reachable = false;
+            break;
+        }
+        case OpCode::CALL_BUILTIN_FUNC:
+        {
+            const CallSite &site = call_sites[i];
+            if (!site.info)
+            {
+                trap(site.link_error, i);
+                break;
+            }
+            const std::string &func_name = std::get<std::string>(bytecode.constant_pool[instr.operand]);
+            if (sym.empty())
+            {
+                trap("Stack underflow!", i);
+                break;
+            }
+            IrOperand count = sym.back();
+            sym.pop_back();
+
+            int actual_args = site.arg_count;
+            if (actual_args < 0)
+            {
+                // 参数数量无法在链接时确定 (手写字节码)：必须是常量，在此处校验
+                const double *count_ptr = count.kind == Kind::Const ? std::get_if<double>(&bytecode.constant_pool[count.index]) : nullptr;
+                if (!count_ptr)
+                {
+                    trap("Argument count for '" + func_name + "' must be a numeric constant.", i);
+                    break;
+                }
+                actual_args = static_cast<int>(*count_ptr);
+                if (actual_args < site.info->min_args || actual_args > site.info->max_args)
+                {
+                    trap("Invalid number of arguments for '" + func_name + "'. "
+                         "Got " + std::to_string(actual_args) + ".", i);
+                    break;
+                }
+            }
+            if (sym.size() < static_cast<size_t>(actual_args))
+            {
+                trap("Stack underflow during call to '" + func_name + "'. "
+                     "Not enough values on stack for " + std::to_string(actual_args) + " arguments.", i);
+                break;
+            }
+
+            IrInstr call;
+            call.op = IrOp::Call;
+            call.operand = i;
+            call.arg_begin = static_cast<int>(ir_args.size());
+            call.arg_count = actual_args;
+            ir_args.insert(ir_args.end(), sym.end() - actual_args, sym.end());
+            sym.resize(sym.size() - actual_args);
+            if (site.info->implicit_input)
+            {
+                // 隐式读取的内置变量追加为最后一个参数，回看分析和流式容量随之覆盖它
+                auto it = builtin_var_slots.find(site.info->implicit_input);
+                if (it == builtin_var_slots.end())
+                {
+                    it = builtin_var_slots.emplace(site.info->implicit_input, static_cast<int>(builtin_var_names.size())).first;
+                    builtin_var_names.push_back(site.info->implicit_input);
+                }
+                ir_args.push_back({Kind::BuiltinVar, it->second});
+                call.arg_count++;
+            }
+            call.dst = static_cast<int>(sym.size());
+            emit(call, i);
+            pushSym(reg(sym.size()));
+            break;
+        }
+        case OpCode::HALT:
+        {
+            IrInstr halt;
+            halt.op = IrOp::Halt;
+            emit(halt, i);
+            reachable = false;
+            break;
+        }
+        default:
+            trap("Unknown opcode!", i);
+            break;
+        }
+    }
+
+    // 字节码末尾的跳转目标，以及缺少 HALT 的字节码
+    if (is_target[n])
+        label[n] = static_cast<int>(ir.size());
+    IrInstr halt;
+    halt.op = IrOp::Halt;
+    emit(halt, n > 0 ? n - 1 : 0);
+
+    for (const auto &fixup : fixups)
+        ir[fixup.first].operand = label[fixup.second];
+
+    regs.assign(max_depth, StackValue());
+    size_t max_args = 0;
+    for (const IrInstr &instr : ir)
+    {
+        if (instr.op == IrOp::Call)
+            max_args = std::max(max_args, static_cast<size_t>(instr.arg_count));
+    }
+    call_args.assign(max_args, StackValue());
+    builtin_var_values.assign(builtin_var_names.size(), StackValue());
+    builtin_var_defined.assign(builtin_var_names.size(), false);
+
+    assignScalarTemps();
+}
+
+// 中间变量的历史分析：只被运算 (两侧) 和下标偏移读取的中间变量永远不会按历史访问，
+// 改为标量临时变量，不再为它们分配整段K线长度的序列。
+// 被下标索引、作为内置函数参数、存入全局变量、改名或经寄存器搬运的中间变量仍然保留序列。
+// 按列执行时再按活跃区间 (定义到最后一次读取) 给临时变量分配可复用的缓冲区。
+void PineVM::assignScalarTemps()
+{
+    using Kind = IrOperand::Kind;
+    const int var_count = static_cast<int>(vars.size());
+    std::vector<bool> keeps_series(var_count, false);
+    std::vector<int> definitions(var_count, 0);
+
+    auto escapes = [&](const IrOperand &operand) {
+        if (operand.kind == Kind::Var)
+            keeps_series[operand.index] = true;
+    };
+    // 在写入之前就被读取的槽位读到的是上一根K线的值，同样需要保留序列
+    auto reads = [&](const IrOperand &operand) {
+        if (operand.kind == Kind::Var && definitions[operand.index] == 0)
+            keeps_series[operand.index] = true;
+    };
+    for (const IrInstr &instr : ir)
+    {
+        switch (instr.op)
+        {
+        case IrOp::Binary:
+            reads(instr.a);
+            reads(instr.b);
+            definitions[instr.dst]++;
+            break;
+        case IrOp::Subscript:
+            reads(instr.b);
+            escapes(instr.a);
+            definitions[instr.dst]++;
+            break;
+        case IrOp::Move:
+        case IrOp::Store:
+        case IrOp::StoreExport:
+        case IrOp::Rename:
+        case IrOp::JumpIfFalse:
+            escapes(instr.a);
+            break;
+        default:
+            break;
+        }
+    }
+    for (const IrOperand &arg : ir_args)
+        escapes(arg);
+
+    // 按定义顺序编号；被多条指令写入的槽位 (手写字节码) 保持原样
+    std::vector<int> temp_of_var(var_count, -1);
+    int temp_count = 0;
+    for (IrInstr &instr : ir)
+    {
+        if (instr.op != IrOp::Binary && instr.op != IrOp::Subscript)
+            continue;
+        auto toTemp = [&](IrOperand &operand) {
+            if (operand.kind == Kind::Var && temp_of_var[operand.index] >= 0)
+                operand = {Kind::Temp, temp_of_var[operand.index]};
+        };
+        toTemp(instr.a);
+        toTemp(instr.b);
+        if (!keeps_series[instr.dst] && definitions[instr.dst] == 1)
+        {
+            temp_of_var[instr.dst] = temp_count++;
+            instr.dst = temp_of_var[instr.dst];
+            instr.temp_dst = true;
+        }
+    }
+
+    // 活跃区间：最后一次读取之后缓冲区即可交给后面定义的临时变量
+    std::vector<int> last_use(temp_count, -1);
+    for (int k = 0; k < static_cast<int>(ir.size()); ++k)
+    {
+        for (const IrOperand *operand : {&ir[k].a, &ir[k].b})
+        {
+            if (operand->kind == Kind::Temp)
+                last_use[operand->index] = k;
+        }
+    }
+    temp_column_slot.assign(temp_count, -1);
+    std::vector<int> free_slots;
+    int slot_count = 0;
+    for (int k = 0; k < static_cast<int>(ir.size()); ++k)
+    {
+        const IrInstr &instr = ir[k];
+        // 输入先释放：内核允许输出与输入是同一块内存
+        for (const IrOperand *operand : {&instr.a, &instr.b})
+        {
+            if (operand->kind == Kind::Temp && last_use[operand->index] == k)
+                free_slots.push_back(temp_column_slot[operand->index]);
+        }
+        if (!instr.temp_dst)
+            continue;
+        int slot;
+        if (free_slots.empty())
+        {
+            slot = slot_count++;
+        }
+        else
+        {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        temp_column_slot[instr.dst] = slot;
+        if (last_use[instr.dst] < 0)
+            free_slots.push_back(slot);
+    }
+    temp_values.assign(temp_count, NAN);
+    temp_column_count = slot_count;
+    temp_columns.release();
+}
+
+// 分析流式模式下每个序列最多需要回看多少根K线，得出环形缓冲区容量。
+// 寄存器和序列型 STORE_GLOBAL 会让多个名字指向同一个序列，先用并查集合并成存储节点；
+// 常量偏移 k 的下标需要 k 根历史，内置函数按 BuiltinInfo::lookback 计算，
+// 其余读取 (运算、存储、条件跳转) 只用当前 bar。偏移或窗口不是常量时该节点无界。
+void PineVM::analyzeLookback()
+{
+    using Kind = IrOperand::Kind;
+    constexpr long long kUnbounded = -1;
+    constexpr long long kMaxBounded = 1 << 20; // 更长的窗口不如直接用无界存储
+
+    const int global_base = static_cast<int>(builtin_var_names.size());
+    const int var_base = global_base + static_cast<int>(globals.size());
+    const int site_base = var_base + static_cast<int>(vars.size());
+    const int reg_base = site_base + static_cast<int>(call_sites.size());
+    std::vector<int> parent(reg_base + regs.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&](int x) {
+        while (parent[x] != x)
+            x = parent[x] = parent[parent[x]];
+        return x;
+    };
+    auto node = [&](const IrOperand &operand) {
+        switch (operand.kind)
+        {
+        case Kind::BuiltinVar: return operand.index;
+        case Kind::Global:     return global_base + operand.index;
+        case Kind::Var:        return var_base + operand.index;
+        case Kind::Reg:        return reg_base + operand.index;
+        default:               return -1;
+        }
+    };
+    auto unite = [&](int x, int y) {
+        if (x >= 0 && y >= 0)
+            parent[find(x)] = find(y);
+    };
+    auto constant = [&](const IrOperand &operand, double &value) {
+        if (operand.kind != Kind::Const)
+            return false;
+        const auto *number = std::get_if<double>(&bytecode.constant_pool[operand.index]);
+        if (number)
+            value = *number;
+        return number != nullptr;
+    };
+
+    for (const IrInstr &instr : ir)
+    {
+        if (instr.op == IrOp::Move)
+            unite(reg_base + instr.dst, node(instr.a));
+        else if (instr.op == IrOp::Call)
+            unite(reg_base + instr.dst, site_base + instr.operand);
+        else if (instr.op == IrOp::Store || instr.op == IrOp::StoreExport)
+            unite(global_base + instr.operand, node(instr.a));
+    }
+
+    std::vector<long long> demand(parent.size(), 0);
+    auto need = [&](int x, long long bars) {
+        if (x < 0)
+            return;
+        long long &d = demand[find(x)];
+        if (d == kUnbounded)
+            return;
+        d = (bars < 0 || bars > kMaxBounded) ? kUnbounded : std::max(d, bars);
+    };
+    for (const IrInstr &instr : ir)
+    {
+        if (instr.op == IrOp::Subscript)
+        {
+            double offset;
+            const bool fixed = constant(instr.b, offset) && offset >= 0;
+            need(node(instr.a), fixed ? static_cast<long long>(offset) : kUnbounded);
+        }
+        else if (instr.op == IrOp::Call)
+        {
+            const CallSite &site = call_sites[instr.operand];
+            long long bars = kUnbounded;
+            if (site.info && site.info->lookback.bounded)
+            {
+                const Lookback &lookback = site.info->lookback;
+                bars = lookback.bars;
+                double window;
+                if (lookback.window_arg >= 0)
+                {
+                    if (lookback.window_arg < instr.arg_count &&
+                        constant(ir_args[instr.arg_begin + lookback.window_arg], window) && window >= 0)
+                        bars = std::max(0LL, static_cast<long long>(window) + lookback.bars);
+                    else
+                        bars = kUnbounded;
+                }
+                need(site_base + instr.operand, lookback.self);
+            }
+            else
+            {
+                need(site_base + instr.operand, kUnbounded);
+            }
+            for (int k = 0; k < instr.arg_count; ++k)
+                need(node(ir_args[instr.arg_begin + k]), bars);
+        }
+    }
+
+    auto capacity = [&](int x) -> size_t {
+        const long long d = demand[find(x)];
+        return d == kUnbounded ? 0 : static_cast<size_t>(d + 1);
+    };
+    builtin_var_capacity.resize(builtin_var_names.size());
+    for (size_t i = 0; i < builtin_var_capacity.size(); ++i)
+        builtin_var_capacity[i] = capacity(static_cast<int>(i));
+    global_capacity.resize(globals.size());
+    for (size_t i = 0; i < global_capacity.size(); ++i)
+        global_capacity[i] = capacity(global_base + static_cast<int>(i));
+    var_capacity.resize(vars.size());
+    for (size_t i = 0; i < var_capacity.size(); ++i)
+        var_capacity[i] = capacity(var_base + static_cast<int>(i));
+    site_capacity.resize(call_sites.size());
+    for (size_t i = 0; i < site_capacity.size(); ++i)
+        site_capacity[i] = capacity(site_base + static_cast<int>(i));
+}
+
+// 最后一根K线的所有全局变量精确所需的、在它之前还要执行的K线根数，-1 表示需要全部历史。
+// 直线型脚本每条定义 (运算、下标、调用) 是一个节点，记录它需要在最后一根之前多少根就算对：
+// 运算的操作数与结果相同，常量下标 k 再加 k 根，函数参数再加回看窗口；
+// converging 的递推函数自身从更早 last_bar_warmup 根开始算，其他读取自身历史或未标注的函数需要全部历史。
+// 同一全局变量的各次赋值合并为一个节点 (寄存器、中间变量槽会被复用，按定义区分)。
+long long PineVM::lastBarHistory() const
+{
+    using Kind = IrOperand::Kind;
+    constexpr long long kUnbounded = -1;
+    constexpr long long kMaxBounded = 1 << 20;
+    constexpr long long kInfinite = 1LL << 40;
+
+    std::vector<int> parent;
+    std::vector<long long> warmups;
+    auto make = [&]() {
+        parent.push_back(static_cast<int>(parent.size()));
+        warmups.push_back(0);
+        return parent.back();
+    };
+    auto find = [&](int x) {
+        while (parent[x] != x)
+            x = parent[x] = parent[parent[x]];
+        return x;
+    };
+    auto constant = [&](const IrOperand &operand, double &value) {
+        if (operand.kind != Kind::Const)
+            return false;
+        const auto *number = std::get_if<double>(&bytecode.constant_pool[operand.index]);
+        if (number)
+            value = *number;
+        return number != nullptr;
+    };
+
+    // 输入序列的节点在前，不需要计算
+    for (size_t i = 0; i < builtin_var_names.size(); ++i)
+        make();
+    const int input_count = static_cast<int>(parent.size());
+    std::vector<int> global_node(globals.size());
+    for (int &n : global_node)
+        n = make();
+    std::vector<bool> global_stored(globals.size(), false);
+    std::vector<int> var_def(vars.size(), -1), temp_def(temp_values.size(), -1), reg_def(regs.size(), -1);
+
+    // 在本根K线写入之前读取的槽位读到的是上一根的值，按需要全部历史处理
+    bool unbounded = false;
+    auto resolve = [&](const IrOperand &operand) {
+        int n = -1;
+        switch (operand.kind)
+        {
+        case Kind::BuiltinVar: return operand.index;
+        case Kind::Global:
+            unbounded = unbounded || !global_stored[operand.index];
+            return global_node[operand.index];
+        case Kind::Var:  n = var_def[operand.index]; break;
+        case Kind::Temp: n = temp_def[operand.index]; break;
+        case Kind::Reg:  n = reg_def[operand.index]; break;
+        default:         return -1;
+        }
+        unbounded = unbounded || n < 0;
+        return n;
+    };
+
+    // 依赖边：consumer 需要回看 reach 根时，producer 需要回看 reach + bars 根
+    struct Edge {
+        int consumer;
+        int producer;
+        long long bars;
+    };
+    std::vector<Edge> edges;
+    auto depend = [&](int consumer, const IrOperand &producer, long long bars) {
+        const int p = resolve(producer);
+        if (p >= 0)
+            edges.push_back({consumer, p, bars});
+    };
+    for (const IrInstr &instr : ir)
+    {
+        switch (instr.op)
+        {
+        case IrOp::Jump:
+        case IrOp::JumpIfFalse:
+            // 条件分支下的赋值在未执行的K线上的取值取决于更早的历史
+            return kUnbounded;
+        case IrOp::Move:
+            reg_def[instr.dst] = resolve(instr.a);
+            break;
+        case IrOp::Store:
+        case IrOp::StoreExport:
+        {
+            const int value = resolve(instr.a);
+            if (value >= 0)
+                parent[find(value)] = find(global_node[instr.operand]);
+            global_stored[instr.operand] = true;
+            break;
+        }
+        case IrOp::Binary:
+        case IrOp::Subscript:
+        {
+            const int n = make();
+            double offset;
+            const bool fixed = instr.op == IrOp::Binary || (constant(instr.b, offset) && offset >= 0);
+            depend(n, instr.a, !fixed ? kInfinite : instr.op == IrOp::Subscript ? static_cast<long long>(offset) : 0);
+            depend(n, instr.b, 0);
+            (instr.temp_dst ? temp_def : var_def)[instr.dst] = n;
+            break;
+        }
+        case IrOp::Call:
+        {
+            const int n = make();
+            const CallSite &site = call_sites[instr.operand];
+            long long bars = kInfinite;
+            long long warmup = kInfinite;
+            if (site.info && site.info->lookback.bounded)
+            {
+                const Lookback &lookback = site.info->lookback;
+                bars = lookback.bars;
+                double window;
+                if (lookback.window_arg >= 0)
+                {
+                    if (lookback.window_arg < instr.arg_count &&
+                        constant(ir_args[instr.arg_begin + lookback.window_arg], window) && window >= 0)
+                        bars = std::max(0LL, static_cast<long long>(window) + lookback.bars);
+                    else
+                        bars = kInfinite;
+                }
+                warmup = lookback.self == 0 ? 0 : lookback.converges ? last_bar_warmup : kInfinite;
+            }
+            // 递推函数需要从更早的K线开始算，参数也随之提前
+            warmups[n] = warmup;
+            for (int k = 0; k < instr.arg_count; ++k)
+                depend(n, ir_args[instr.arg_begin + k], std::min(kInfinite, bars + warmup));
+            reg_def[instr.dst] = n;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    if (unbounded)
+        return kUnbounded;
+
+    // 只有同一全局变量的多次赋值可能成环；仍在增长说明存在经由下标的正权环，只能执行全部历史
+    std::vector<long long> reach(parent.size(), 0), extra(parent.size(), 0);
+    for (size_t i = 0; i < parent.size(); ++i)
+        extra[find(static_cast<int>(i))] = std::max(extra[find(static_cast<int>(i))], warmups[i]);
+    bool changed = true;
+    for (size_t round = 0; changed; ++round)
+    {
+        if (round > parent.size())
+            return kUnbounded;
+        changed = false;
+        for (const Edge &edge : edges)
+        {
+            const int consumer = find(edge.consumer);
+            const int producer = find(edge.producer);
+            const long long needed = std::min(kInfinite, reach[consumer] + edge.bars);
+            if (needed > reach[producer])
+            {
+                reach[producer] = needed;
+                changed = true;
+            }
+        }
+    }
+
+    long long history = 0;
+    for (int i = input_count; i < static_cast<int>(parent.size()); ++i)
+        history = std::max(history, std::min(kInfinite, reach[find(i)] + extra[find(i)]));
+    return history > kMaxBounded ? kUnbounded : history;
+}
+
+void PineVM::setLastBarMode(bool enabled, int warmup_bars)
+{
+    last_bar_mode = enabled;
+    last_bar_warmup = std::max(warmup_bars, 0);
+}
+
+int PineVM::lastBarStart(int total_bars) const
+{
+    const long long history = lastBarHistory();
+    if (history < 0)
+        return 0;
+    return static_cast<int>(std::max(0LL, total_bars - 1 - history));
+}
+
+size_t PineVM::streamingCapacity(size_t capacity) const
+{
+    return capacity == 0 ? 0 : std::max(capacity, static_cast<size_t>(std::max(streaming_keep_bars, 1)));
+}
+
+void PineVM::setStreamingMode(bool enabled, int keep_bars)
+{
+    streaming = enabled;
+    streaming_keep_bars = keep_bars;
+    applyLookbackCapacities();
+}
+
+// 按 analyzeLookback 的结果设置 VM 持有的序列和输入序列的容量。
+// 输入序列可能由多个 VM 共享，Series::setCapacity 只会增大已有容量 (只读共享的输入保持不变)；
+// 脚本没有引用的输入序列只保留 keep_bars 根 (cost 等函数按名称读取当前值)。
+// 关闭流式模式时 VM 持有的序列恢复为无界，输入序列保持不变。
+void PineVM::applyLookbackCapacities()
+{
+    auto apply = [this](Series *series, size_t capacity) {
+        if (series)
+            series->setCapacity(streaming ? streamingCapacity(capacity) : 0);
+    };
+    for (size_t i = 0; i < vars.size(); ++i)
+        apply(vars[i].get(), var_capacity[i]);
+    for (size_t i = 0; i < call_sites.size(); ++i)
+        apply(call_sites[i].result_series.get(), site_capacity[i]);
+    for (size_t i = 0; i < globals.size(); ++i)
+        if (auto *series = std::get_if<std::shared_ptr<Series>>(&globals[i]))
+            apply(series->get(), global_capacity[i]);
+    if (!streaming)
+    {
+        for (auto &pair : builtin_func_cache)
+            pair.second->setCapacity(0);
+        return;
+    }
+    for (auto &pair : built_in_vars)
+    {
+        auto *series = std::get_if<std::shared_ptr<Series>>(&pair.second);
+        if (!series || !*series || isSharedInput(series->get()))
+            continue;
+        auto it = std::find(builtin_var_names.begin(), builtin_var_names.end(), pair.first);
+        apply(series->get(), it == builtin_var_names.end() ? 1 : builtin_var_capacity[it - builtin_var_names.begin()]);
+    }
+}
+
+// 执行前为 VM 持有的无界序列 (保留历史的中间变量、调用结果、全局变量) 预留到 total_bars，
+// 逐 bar 写入和按列写入都不再重新分配；流式增量执行时由 Series::reserve 按几何倍数增长。
+void PineVM::reserveSeries()
+{
+    for (const IrInstr &instr : ir)
+        if ((instr.op == IrOp::Binary || instr.op == IrOp::Subscript) && !instr.temp_dst)
+            vars[instr.dst]->reserve(total_bars);
+    for (const CallSite &site : call_sites)
+        if (site.result_series)
+            site.result_series->reserve(total_bars);
+    for (const Value &global : globals)
+        if (auto *series = std::get_if<std::shared_ptr<Series>>(&global))
+            (*series)->reserve(total_bars);
+}
+
+// 解析 LOAD_BUILTIN_VAR 引用的变量。序列可能在 loadBytecode 之后才注册或被替换，
+// 所以每次 execute 开始时重新解析。
+void PineVM::resolveBuiltinVars()
+{
+    for (size_t i = 0; i < builtin_var_names.size(); ++i)
+    {
+        auto it = built_in_vars.find(builtin_var_names[i]);
+        builtin_var_defined[i] = it != built_in_vars.end();
+        builtin_var_values[i] = builtin_var_defined[i] ? toStackValue(it->second) : StackValue();
+    }
+}
+
+// execute 现在可以处理批量和增量计算
+int PineVM::execute(int new_total_bars)
+{
+    // 如果新的目标K线数不大于当前已计算的K线数，则无需操作
+    if (new_total_bars <= this->bar_index) {
+        // std::cout << "No new bars to execute. Current index: " << bar_index 
+        //           << ", requested total: " << new_total_bars << std::endl;
+        return 0; // 不是错误，只是无事可做
+    }
+
+    // 未确认的试算K线按普通K线重新计算
+    rollbackTentative();
+
+    // 最后一根K线模式：首次执行时跳过最后一根用不到的历史
+    if (last_bar_mode && this->bar_index == 0)
+        this->bar_index = lastBarStart(new_total_bars);
+
+    this->total_bars = new_total_bars;
+    resolveBuiltinVars();
+    reserveSeries();
+
+    if (streaming)
+        applyLookbackCapacities();
+
+    if (isVectorizedExecution())
+    {
+        const int begin = bar_index;
+        try
+        {
+            runRange(begin, this->total_bars);
+            bar_index = this->total_bars;
+        }
+        catch (const std::exception &e)
+        {
+            // 按列执行时无法定位到具体K线，报告区间起点，并回退 bar_index 以便重新执行整个区间
+            std::stringstream ss;
+            ss << "PineVM::execute Error: " << e.what()
+                      << " @bar_range: [" << begin << ", " << this->total_bars << ")"
+                      << " @ip: " << (pc ? std::to_string(pc->source_ip) : "null")
+                      << std::endl;
+            lastErrorMessage = ss.str();
+            bar_index = begin;
+            return 1;
+        }
+        return 0;
+    }
+
+    try
+    {
+        // 循环从当前 bar_index 继续，直到达到新的 total_bars
+        // 这个 for 循环的结构是实现增量计算的关键
+        for (; bar_index < this->total_bars; ++bar_index)
+        {
+            // std::cout << "--- Executing Bar #" << bar_index << " ---" << std::endl;
+            runCurrentBar();
+        }
+    }
+    catch (const std::exception &e)
+    {
+        // 错误发生时，bar_index 会停留在出错的K线上，方便调试
+        std::stringstream ss;
+        ss << "PineVM::execute Error: " << e.what()
+                  << " @bar_index: " << bar_index
+                  << " @ip: " << (pc ? std::to_string(pc->source_ip) : "null")
+                  << std::endl;
+        lastErrorMessage = ss.str();
+        return 1;
+    }
+
+    // 所有请求的K线都成功执行
+    return 0;
+}
+
+// 撤销试算：回退随机数状态和运行时字符串，并把 VM 持有的序列 (全局变量、调用结果、内置函数状态) 在试算K线上的值
+// 清回计算前的 NaN。同一根K线内先读后写的全局变量 (如 R:SUM(C,N); N:=10;) 重新计算时不能读到上一次试算写入的值
+void PineVM::rollbackTentative()
+{
+    if (!tentative_active)
+        return;
+    random_engine = tentative_random_engine;
+    string_pool.resize(tentative_string_count);
+
+    // 全局变量可能直接别名到输入序列，输入序列在试算K线上的值由调用方提供，不能清除
+    auto is_input = [this](const Series *series) {
+        for (const auto &[name, value] : built_in_vars)
+        {
+            const auto *input = std::get_if<std::shared_ptr<Series>>(&value);
+            if (input && input->get() == series)
+                return true;
+        }
+        return false;
+    };
+    auto reset = [&](Series *series) {
+        if (series && !is_input(series))
+            series->setCurrent(bar_index, NAN);
+    };
+    for (auto &global : globals)
+        if (auto *series = std::get_if<std::shared_ptr<Series>>(&global))
+            reset(series->get());
+    for (auto &[key, series] : builtin_func_cache)
+        reset(series.get());
+
+    tentative_active = false;
+    tentative_evaluated = false;
+}
+
+int PineVM::executeTentative()
+{
+    rollbackTentative();
+    tentative_random_engine = random_engine;
+    tentative_string_count = string_pool.size();
+    tentative_active = true;
+
+    total_bars = std::max(total_bars, bar_index + 1);
+    resolveBuiltinVars();
+    if (streaming)
+        applyLookbackCapacities();
+    try
+    {
+        runCurrentBar();
+    }
+    catch (const std::exception &e)
+    {
+        std::stringstream ss;
+        ss << "PineVM::executeTentative Error: " << e.what()
+                  << " @bar_index: " << bar_index
+                  << " @ip: " << (pc ? std::to_string(pc->source_ip) : "null")
+                  << std::endl;
+        lastErrorMessage = ss.str();
+        return 1;
+    }
+    tentative_evaluated = true;
+    return 0;
+}
+
+int PineVM::commitBar()
+{
+    if (!tentative_evaluated)
+    {
+        const int status = executeTentative();
+        if (status != 0)
+            return status;
+    }
+    tentative_active = false;
+    tentative_evaluated = false;
+    ++bar_index;
+    return 0;
+}
+
+// 取指定K线上的数值 (按列执行时使用)；逐 bar 执行时 bar 即 bar_index
+static inline double numericValueAt(const StackValue &val, int bar)
+{
+    switch (val.tag)
+    {
+    case StackValue::Tag::Number: return val.number;
+    case StackValue::Tag::Series: return val.series ? val.series->getCurrent(bar) : NAN;
+    case StackValue::Tag::Bool:   return static_cast<double>(val.boolean);
+    case StackValue::Tag::None:   return NAN;
+    default:
+        throw std::runtime_error("Unsupported operand type for numeric operation.");
     }
+}
 
-    // 所有请求的K线都成功执行
-    return 0;
+double PineVM::getNumericValue(const StackValue &val) const
+{
+    return numericValueAt(val, bar_index);
+}
+
+// Value -> StackValue：序列只取裸指针 (由 globals / built_in_vars / 常量池持有)，
+// 运行时产生的字符串追加到字符串池。
+StackValue PineVM::toStackValue(const Value &val)
+{
+    if (auto *p = std::get_if<double>(&val))
+        return StackValue::makeNumber(*p);
+    if (auto *p = std::get_if<std::shared_ptr<Series>>(&val))
+        return StackValue::makeSeries(p->get());
+    if (auto *p = std::get_if<bool>(&val))
+        return StackValue::makeBool(*p);
+    if (auto *p = std::get_if<std::string>(&val))
+    {
+        string_pool.push_back(*p);
+        return StackValue::makeString(static_cast<int>(string_pool.size() - 1));
+    }
+    return StackValue();
 }
 
-void PineVM::push(Value val)
+// 内置函数返回值 -> StackValue。绝大多数函数返回调用点自己的结果序列，无需额外持有；
+// 其他序列被固定在 pinned_series 中，保证裸指针在 VM 生命周期内有效。
+StackValue PineVM::toStackValue(Value &&val, const CallSite &site)
 {
-    stack.push_back(std::move(val));
+    if (auto *p = std::get_if<std::shared_ptr<Series>>(&val))
+    {
+        Series *raw = p->get();
+        if (raw && raw != site.result_series.get() &&
+            std::none_of(pinned_series.begin(), pinned_series.end(),
+                         [raw](const std::shared_ptr<Series> &s) { return s.get() == raw; }))
+        {
+            pinned_series.push_back(std::move(*p));
+        }
+        return StackValue::makeSeries(raw);
+    }
+    return toStackValue(val);
 }
 
-Value PineVM::pop()
+// StackValue -> Value，供 FunctionContext::getArg 等兼容接口使用
+Value PineVM::toValue(const StackValue &val) const
 {
-    if (stack.empty())
-        throw std::runtime_error("Stack underflow!");
-    Value val = stack.back();
-    stack.pop_back();
-    return val;
+    switch (val.tag)
+    {
+    case StackValue::Tag::Number: return val.number;
+    case StackValue::Tag::Bool:   return val.boolean;
+    case StackValue::Tag::String: return string_pool[val.string_index];
+    case StackValue::Tag::Series:
+        return val.series ? val.series->shared_from_this() : std::shared_ptr<Series>();
+    default:
+        return std::monostate{};
+    }
 }
 
 double PineVM::getNumericValue(const Value &val)
@@ -170,51 +1948,22 @@ bool PineVM::getBoolValue(const Value &val)
     throw std::runtime_error("Unsupported operand type for bool operation.");
 }
 
-void PineVM::pushNumbericValue(double val, int operand)
+Value &PineVM::storeGlobal(int operand, const StackValue &val)
 {
-    // 这个函数处理算术/逻辑运算的结果。
-    // 在PineScript中，这些操作通常产生一个新的序列。
-    // 'operand' 参数是编译器分配的中间变量槽的索引，
-    // 用于存储这个新序列。
+    const bool is_scalar = val.tag == StackValue::Tag::Number || val.tag == StackValue::Tag::Bool;
 
-    // 检查操作数是否是有效的中间变量索引
-    if (operand < 0 || operand >= vars.size())
-    {
-        // 这是一个严重的字节码错误。如果一个操作需要存储中间结果，
-        // 编译器必须提供一个有效的槽位索引。
-        // 一个简单的回退方案是直接压入double值，但这会破坏序列的连续性。
-        // push(val); // 这是一个不正确的简化方案
-        throw std::runtime_error("Invalid intermediate variable index (" + std::to_string(operand) + ") for arithmetic/logic operation. Max index is " + std::to_string(vars.size() - 1) + ".");
-    }
-
-    // 1. 从预先分配的池中获取中间序列
-    auto &result_series = vars[operand];
-
-    // 2. 为当前K线柱设置计算出的值
-    result_series->setCurrent(bar_index, val);
-
-    // 3. 将这个（现在已更新的）序列的智能指针压入栈中，
-    // 以便后续操作（如另一个算术运算或存储到全局变量）可以使用它。
-    push(result_series);
-}
-
-Value &PineVM::storeGlobal(int operand, const Value &val)
-{
     // 检查全局变量槽位是否已经是一个Series
-    if (std::holds_alternative<std::shared_ptr<Series>>(globals[operand]))
+    if (auto *slot = std::get_if<std::shared_ptr<Series>>(&globals[operand]))
     {
-        auto series_ptr = std::get<std::shared_ptr<Series>>(globals[operand]);
-        if (std::holds_alternative<double>(val) || std::holds_alternative<bool>(val))
+        if (is_scalar)
         {
-            // 如果弹出的值是double，则设置Series的当前bar值
-            series_ptr->setCurrent(bar_index,
-                                   std::holds_alternative<bool>(val) ? static_cast<double>(std::get<bool>(val)) : std::get<double>(val));
+            // 如果弹出的值是double/bool，则设置Series的当前bar值
+            (*slot)->setCurrent(bar_index, getNumericValue(val));
         }
-        else if (std::holds_alternative<std::shared_ptr<Series>>(val))
+        else if (val.tag == StackValue::Tag::Series)
         {
             // 如果弹出的值是Series，则替换bar对应数值
-            auto val_series_ptr = std::get<std::shared_ptr<Series>>(val);
-            series_ptr->setCurrent(bar_index, val_series_ptr->getCurrent(bar_index));
+            (*slot)->setCurrent(bar_index, val.series->getCurrent(bar_index));
         }
         else
         {
@@ -222,268 +1971,718 @@ Value &PineVM::storeGlobal(int operand, const Value &val)
             throw std::runtime_error("Attempted to store unsupported type into existing Series global.");
         }
     }
-    else if (std::holds_alternative<std::monostate>(globals[operand]))
+    else if (val.tag == StackValue::Tag::String &&
+             (std::holds_alternative<std::monostate>(globals[operand]) || std::holds_alternative<std::string>(globals[operand])))
     {
-        // 如果是monostate，说明这个槽位是空的，可以根据弹出的值类型来初始化
-        if (std::holds_alternative<double>(val) || std::holds_alternative<bool>(val))
-        {
-            // 如果是double/bool，创建一个新的Series来存储它
-            auto new_series = std::make_shared<Series>();
-            new_series->setCurrent(bar_index,
-                                   std::holds_alternative<bool>(val) ? static_cast<double>(std::get<bool>(val)) : std::get<double>(val));
-            new_series->setName(bytecode.global_name_pool[operand]);
-            globals[operand] = new_series;
-        }
-        else
-        {
-            // 其他类型直接存储
-            globals[operand] = val;
-            auto series_ptr = std::get<std::shared_ptr<Series>>(globals[operand]);
-            series_ptr->setName(bytecode.global_name_pool[operand]);
-        }
+        // 字符串不按K线保存，槽位只保留最后一次写入的值
+        globals[operand] = string_pool[val.string_index];
+    }
+    else if (std::holds_alternative<std::monostate>(globals[operand]) &&
+             (is_scalar || (val.tag == StackValue::Tag::Series && isProtectedSeries(val.series)) ||
+              std::find(hidden_globals.begin(), hidden_globals.end(), operand) != hidden_globals.end()))
+    {
+        // 如果是monostate，说明这个槽位是空的；double/bool 创建一个新的Series来存储它
+        // (只读共享的输入序列和隐藏全局变量的序列不能别名和改名，隐藏全局变量也不别名其他序列，同样逐 bar 复制到新序列)
+        auto new_series = std::make_shared<Series>();
+        if (streaming)
+            new_series->setCapacity(streamingCapacity(global_capacity[operand]));
+        new_series->setCurrent(bar_index, getNumericValue(val));
+        new_series->setName(bytecode.global_name_pool[operand]);
+        globals[operand] = new_series;
     }
     else
     {
-        // 如果不是Series，直接存储弹出的值
-        globals[operand] = val;
-        auto series_ptr = std::get<std::shared_ptr<Series>>(globals[operand]);
-        series_ptr->setName(bytecode.global_name_pool[operand]);
+        // 其他情况直接存储弹出的序列 (与之共享数据)，只有序列可以存入全局变量
+        if (val.tag != StackValue::Tag::Series || !val.series)
+            throw std::runtime_error("Attempted to store unsupported type into Series global.");
+        globals[operand] = val.series->shared_from_this();
+        val.series->setName(bytecode.global_name_pool[operand]);
     }
     return globals[operand];
 }
 
-void PineVM::runCurrentBar()
+// 读取 IR 操作数的当前值
+StackValue PineVM::read(const IrOperand &operand)
 {
-    ip = &bytecode.instructions[0];
+    switch (operand.kind)
+    {
+    case IrOperand::Kind::Const:
+        return constant_values[operand.index];
+    case IrOperand::Kind::Global:
+        return toStackValue(globals[operand.index]);
+    case IrOperand::Kind::BuiltinVar:
+        if (!builtin_var_defined[operand.index])
+            throw std::runtime_error("Undefined built-in variable: " + builtin_var_names[operand.index]);
+        return builtin_var_values[operand.index];
+    case IrOperand::Kind::Var:
+        return StackValue::makeSeries(vars[operand.index].get());
+    case IrOperand::Kind::Reg:
+        return regs[operand.index];
+    case IrOperand::Kind::Temp:
+        return StackValue::makeNumber(temp_values[operand.index]);
+    default:
+        return StackValue();
+    }
+}
+
+// 把一次内置函数调用的参数按源码顺序读入参数缓冲区，返回缓冲区起始地址。
+const StackValue* PineVM::collectCallArgs(const IrInstr &instr)
+{
+    for (int i = 0; i < instr.arg_count; ++i) {
+        call_args[i] = read(ir_args[instr.arg_begin + i]);
+    }
+    return call_args.data();
+}
 
-    while (ip->op != OpCode::HALT)
+void PineVM::runCurrentBar()
+{
+    size_t next = 0;
+    while (true)
     {
-        switch (ip->op)
-        {
-        case OpCode::PUSH_CONST:
+        pc = &ir[next++];
+        const IrInstr &instr = *pc;
+        switch (instr.op)
         {
-            push(bytecode.constant_pool[ip->operand]);
+        case IrOp::Move:
+            regs[instr.dst] = read(instr.a);
             break;
-        }
-        case OpCode::POP:
+        case IrOp::Binary:
         {
-            pop();
+            double right = getNumericValue(read(instr.b));
+            double left = getNumericValue(read(instr.a));
+            double result = applyBinaryOp(instr.binop, left, right);
+            if (instr.temp_dst)
+                temp_values[instr.dst] = result;
+            else
+                vars[instr.dst]->setCurrent(bar_index, result);
             break;
         }
-        case OpCode::SUBSCRIPT: // 新增：处理下标操作
+        case IrOp::Subscript:
         {
-            Value index_val = pop();
-            Value callee_val = pop();
-
-            int offset = static_cast<int>(getNumericValue(index_val));
-            
-            auto* series_ptr = std::get_if<std::shared_ptr<Series>>(&callee_val);
-            if (!series_ptr || !*series_ptr) {
-                 // 如果被索引的不是一个有效的序列，则结果为 NaN
-                pushNumbericValue(NAN, ip->operand);
-            } else {
-                double result = (*series_ptr)->getCurrent(bar_index - offset);
-                pushNumbericValue(result, ip->operand);
-            }
+            int offset = static_cast<int>(getNumericValue(read(instr.b)));
+            StackValue callee = read(instr.a);
+            // 如果被索引的不是一个有效的序列，则结果为 NaN
+            double result = (callee.tag == StackValue::Tag::Series && callee.series)
+                                ? callee.series->getCurrent(bar_index - offset) : NAN;
+            if (instr.temp_dst)
+                temp_values[instr.dst] = result;
+            else
+                vars[instr.dst]->setCurrent(bar_index, result);
             break;
         }
-        case OpCode::ADD:
-        case OpCode::SUB:
-        case OpCode::MUL:
-        case OpCode::DIV:
-        case OpCode::LESS:
-        case OpCode::LESS_EQUAL:
-        case OpCode::EQUAL_EQUAL:
-        case OpCode::BANG_EQUAL:
-        case OpCode::GREATER:
-        case OpCode::GREATER_EQUAL:
-        case OpCode::LOGICAL_AND:
-        case OpCode::LOGICAL_OR:
+        case IrOp::Store:
+            storeGlobal(instr.operand, read(instr.a));
+            break;
+        case IrOp::StoreExport:
         {
-            double right = getNumericValue(pop());
-            double left = getNumericValue(pop());
-            if(!std::isnan(left) && !std::isnan(right))
-            {
-                if (ip->op == OpCode::ADD)
-                {
-                    pushNumbericValue(left + right, ip->operand);
-                }
-                else if (ip->op == OpCode::DIV)
-                {
-                    if (right == 0.0)
-                    {
-                        pushNumbericValue(NAN, ip->operand);
-                    }
-                    else
-                        pushNumbericValue(left / right, ip->operand);
-                }
-                else if (ip->op == OpCode::SUB)
-                    pushNumbericValue(left - right, ip->operand);
-                else if (ip->op == OpCode::MUL)
-                    pushNumbericValue(left * right, ip->operand);
-                else if (ip->op == OpCode::DIV)
-                    pushNumbericValue(left / right, ip->operand);
-                else if (ip->op == OpCode::LESS)
-                    pushNumbericValue(left < right, ip->operand);
-                else if (ip->op == OpCode::LESS_EQUAL)
-                    pushNumbericValue(left <= right, ip->operand);
-                else if (ip->op == OpCode::EQUAL_EQUAL)
-                    pushNumbericValue(left == right, ip->operand);
-                else if (ip->op == OpCode::BANG_EQUAL)
-                    pushNumbericValue(left != right, ip->operand);
-                else if (ip->op == OpCode::GREATER)
-                    pushNumbericValue(left > right, ip->operand);
-                else if (ip->op == OpCode::GREATER_EQUAL)
-                    pushNumbericValue(left >= right, ip->operand);
-                else if (ip->op == OpCode::LOGICAL_AND)
-                {
-                    // 在Hithink中, 非0且非NaN为true, 结果为1.0或0.0
-                    bool result = (left != 0.0 && right != 0.0);
-                    pushNumbericValue(result ? 1.0 : 0.0, ip->operand);
-                }
-                else if (ip->op == OpCode::LOGICAL_OR)
-                {
-                    // 在Hithink中, 非0且非NaN为true, 结果为1.0或0.0
-                    bool result = (left != 0.0 || right != 0.0);
-                    pushNumbericValue(result ? 1.0 : 0.0, ip->operand);
-                }
-            }
-            else
+            std::string& name = bytecode.global_name_pool[instr.operand];
+            auto it = exports.find(name);
+            if (it == exports.end())
             {
-                pushNumbericValue(NAN, ip->operand);
+                exports[name] = {name, "default_color"};
             }
+            storeGlobal(instr.operand, read(instr.a));
             break;
         }
-        case OpCode::LOAD_GLOBAL:
+        case IrOp::Rename:
         {
-            push(globals[ip->operand]);
+            StackValue target = read(instr.a);
+            if (target.tag != StackValue::Tag::Series || !target.series)
+                throw std::runtime_error("RENAME_SERIES expects a series and a name.");
+            if (!isProtectedSeries(target.series)) // 只读共享的输入序列和隐藏全局变量保持原名
+                target.series->name = std::get<std::string>(bytecode.constant_pool[instr.operand]);
             break;
         }
-        case OpCode::STORE_GLOBAL:
+        case IrOp::Call:
         {
-            storeGlobal(ip->operand, pop());
+            // 调用点已在 loadBytecode 时链接好，参数直接从操作数读取
+            const CallSite &site = call_sites[instr.operand];
+            FunctionContext context(*this, site.result_series, collectCallArgs(instr), instr.arg_count);
+            regs[instr.dst] = toStackValue(site.info->function(context), site);
             break;
         }
-        case OpCode::STORE_EXPORT:
+        case IrOp::JumpIfFalse:
         {
-            std::string& name = bytecode.global_name_pool[ip->operand];
-            auto it = exports.find(name);
-            if (it == exports.end())
-            {
-                exports[name] = {name, "default_color"};
-            }
-            storeGlobal(ip->operand, pop());
+            StackValue condition = read(instr.a);
+            if (condition.tag != StackValue::Tag::Bool)
+                throw std::runtime_error("JUMP_IF_FALSE expects a boolean condition.");
+            if (!condition.boolean)
+                next = instr.operand;
             break;
         }
-        case OpCode::RENAME_SERIES:
+        case IrOp::Jump:
+            next = instr.operand;
+            break;
+        case IrOp::Trap:
+            throw std::runtime_error(ir_traps[instr.operand]);
+        case IrOp::Halt:
+            return;
+        }
+    }
+}
+
+// 按列写入全局变量：第一根K线走 storeGlobal (保持命名、别名等语义不变)，
+// 其余K线直接把整段数据拷贝过去；若全局变量本身就是源序列则无需拷贝。
+void PineVM::storeGlobalRange(int operand, const StackValue &val, int begin, int end)
+{
+    bar_index = begin;
+    Value &slot = storeGlobal(operand, val);
+    auto *dst = std::get_if<std::shared_ptr<Series>>(&slot);
+
+    if (!dst || (val.tag == StackValue::Tag::Series && val.series == dst->get()))
+        return;
+    Series &series = **dst;
+    if (series.data.size() < static_cast<size_t>(end))
+        series.data.resize(end, NAN);
+    for (int j = begin + 1; j < end; ++j)
+        series.data[j] = numericValueAt(val, j);
+}
+
+// 按列执行：每条 IR 指令一次处理 [begin, end) 整个区间。
+// 操作数的值与逐 bar 执行时相同 (序列指针或标量)，区别只在于序列已经填满了整个区间。
+void PineVM::runRange(int begin, int end)
+{
+    bar_index = end - 1; // 标量取值 (下标等) 按最后一根K线解释
+
+    // 临时变量缓冲区只覆盖当前区间，执行前统一预留，之后取到的指针在整个区间内有效
+    temp_columns.reserve(temp_column_count, end - begin);
+    auto readColumn = [this](const IrOperand &operand) {
+        if (operand.kind == IrOperand::Kind::Temp)
+            return StackValue::makeColumn(temp_columns.column(temp_column_slot[operand.index]));
+        return read(operand);
+    };
+    auto valueAt = [begin](const StackValue &v, int j) {
+        return v.tag == StackValue::Tag::Column ? v.column[j - begin] : numericValueAt(v, j);
+    };
+    // 运算结果的写入位置，已对齐到区间起点
+    auto output = [&](const IrInstr &instr) -> double * {
+        if (instr.temp_dst)
+            return temp_columns.column(temp_column_slot[instr.dst]);
+        auto &out = vars[instr.dst];
+        if (out->data.size() < static_cast<size_t>(end))
+            out->data.resize(end, NAN);
+        return out->data.data() + begin;
+    };
+
+    for (const IrInstr &instr : ir)
+    {
+        pc = &instr;
+        switch (instr.op)
+        {
+        case IrOp::Move:
+            regs[instr.dst] = read(instr.a);
+            break;
+        case IrOp::Subscript:
         {
-            Value name_val = pop();
-            Value &series_val = stack.back(); // Peek at the top of the stack
-            auto series_ptr = std::get<std::shared_ptr<Series>>(series_val);
-            series_ptr->name = std::get<std::string>(name_val);
+            StackValue index_val = readColumn(instr.b);
+            StackValue callee_val = read(instr.a);
+            double *out = output(instr);
+
+            Series *callee = callee_val.tag == StackValue::Tag::Series ? callee_val.series : nullptr;
+            for (int j = begin; j < end; ++j)
+            {
+                if (!callee)
+                {
+                    out[j - begin] = NAN;
+                    continue;
+                }
+                int offset = static_cast<int>(valueAt(index_val, j));
+                out[j - begin] = callee->getCurrent(j - offset);
+            }
             break;
         }
-        case OpCode::LOAD_BUILTIN_VAR:
+        case IrOp::Binary:
         {
-            const std::string &name = std::get<std::string>(bytecode.constant_pool[ip->operand]);
-            if (built_in_vars.count(name))
+            StackValue right = readColumn(instr.b);
+            StackValue left = readColumn(instr.a);
+            // 先扩容结果序列，再取输入指针，避免结果与输入是同一序列时指针失效
+            double *dst = output(instr);
+
+            // 输入覆盖整个区间时直接走连续内存 (指针已对齐到区间起点)，否则逐个取值 (越界部分为 NaN)
+            auto column = [begin, end](const StackValue &v) -> const double * {
+                if (v.tag == StackValue::Tag::Column)
+                    return v.column;
+                return (v.tag == StackValue::Tag::Series && v.series && !v.series->isBounded() && v.series->data.size() >= static_cast<size_t>(end)) ? v.series->data.data() + begin : nullptr;
+            };
+            const double *l = column(left);
+            const double *r = column(right);
+            const OpCode op = instr.binop;
+
+            const bool left_scalar = left.tag != StackValue::Tag::Series && left.tag != StackValue::Tag::Column;
+            const bool right_scalar = right.tag != StackValue::Tag::Series && right.tag != StackValue::Tag::Column;
+            if ((l || left_scalar) && (r || right_scalar))
             {
-                push(built_in_vars.at(name));
+                // 连续内存或标量广播：交给 SIMD 内核
+                const double lv = l ? 0.0 : numericValueAt(left, begin);
+                const double rv = r ? 0.0 : numericValueAt(right, begin);
+                binaryOpKernel(op, l, lv, r, rv, dst, static_cast<size_t>(end - begin));
             }
             else
             {
-                throw std::runtime_error("Undefined built-in variable: " + name);
+                for (int j = begin; j < end; ++j)
+                    dst[j - begin] = applyBinaryOp(op, valueAt(left, j), valueAt(right, j));
             }
             break;
         }
-        case OpCode::JUMP_IF_FALSE:
+        case IrOp::Store:
+            storeGlobalRange(instr.operand, read(instr.a), begin, end);
+            bar_index = end - 1;
+            break;
+        case IrOp::StoreExport:
         {
-            Value condition = pop();
-            if (!std::get<bool>(condition))
+            std::string& name = bytecode.global_name_pool[instr.operand];
+            if (exports.find(name) == exports.end())
             {
-                ip += ip->operand; // Jump forward
-                continue;          // Skip the default ip++
+                exports[name] = {name, "default_color"};
             }
+            storeGlobalRange(instr.operand, read(instr.a), begin, end);
+            bar_index = end - 1;
             break;
         }
-        case OpCode::JUMP:
-            ip += ip->operand; // Jump forward
+        case IrOp::Rename:
+        {
+            StackValue target = read(instr.a);
+            if (target.tag != StackValue::Tag::Series || !target.series)
+                throw std::runtime_error("RENAME_SERIES expects a series and a name.");
+            if (!isProtectedSeries(target.series)) // 只读共享的输入序列和隐藏全局变量保持原名
+                target.series->name = std::get<std::string>(bytecode.constant_pool[instr.operand]);
             break;
-        case OpCode::CALL_BUILTIN_FUNC:
+        }
+        case IrOp::Call:
         {
-            const std::string &func_name = std::get<std::string>(bytecode.constant_pool[ip->operand]);
-            auto it = built_in_funcs.find(func_name);
-            if (it == built_in_funcs.end()) {
-                 throw std::runtime_error("Undefined built-in function: " + func_name);
-            }
-            const auto& builtin_info = it->second;
-
-            // 1. 弹出由编译器压入的 "实际参数数量"。
-            //    这是新的调用约定：argN, ..., arg1, arg0, arg_count
-            Value arg_count_val = pop();
-            int actual_args = static_cast<int>(getNumericValue(arg_count_val));
+            // 内置函数本身是逐 bar 的状态机，这里按 bar 顺序连续调用；
+            // 参数在整个区间内不变 (序列或常量)，只需收集一次。
+            const CallSite &site = call_sites[instr.operand];
+            const StackValue *args = collectCallArgs(instr);
 
-            // 2. 验证实际参数数量是否在函数声明的范围内。
-            if (actual_args < builtin_info.min_args || actual_args > builtin_info.max_args) {
-                std::string expected;
-                if (builtin_info.min_args == builtin_info.max_args) {
-                    expected = std::to_string(builtin_info.min_args);
-                } else {
-                    expected = "between " + std::to_string(builtin_info.min_args) + 
-                               " and " + std::to_string(builtin_info.max_args);
+            StackValue result;
+            for (bar_index = begin; bar_index < end; ++bar_index)
+            {
+                FunctionContext context(*this, site.result_series, args, instr.arg_count);
+                result = toStackValue(site.info->function(context), site);
+                // 返回标量的函数：逐 bar 的值写入结果序列，以序列的形式参与后续计算
+                if (result.tag == StackValue::Tag::Number || result.tag == StackValue::Tag::Bool)
+                {
+                    site.result_series->setCurrent(bar_index, numericValueAt(result, bar_index));
                 }
-                throw std::runtime_error("Invalid number of arguments for '" + func_name + "'. "
-                                         "Expected " + expected + " arguments, but got " 
-                                         + std::to_string(actual_args) + ".");
-            }
-
-            // 3. 检查堆栈深度是否足够。
-            //    (现在栈上应该有 `actual_args` 个参数)
-            if (stack.size() < actual_args) {
-                throw std::runtime_error("Stack underflow during call to '" + func_name + "'. "
-                                         "Not enough values on stack for " + std::to_string(actual_args) + " arguments.");
             }
+            bar_index = end - 1;
 
-            // 4. 弹出结果序列和所有实际参数。
-            // 基于函数和序号创建唯一的缓存键，以支持状态保持
-            std::string cache_key = "__call__" + func_name + "__" + std::to_string(ip->operand);
-            std::shared_ptr<Series> result_series;
-            if (builtin_func_cache.count(cache_key))
-            {
-                result_series = builtin_func_cache.at(cache_key);
-            }
-            else
+            if (result.tag == StackValue::Tag::Number || result.tag == StackValue::Tag::Bool)
             {
-                result_series = std::make_shared<Series>();
-                result_series->name = cache_key;
-                builtin_func_cache[cache_key] = result_series;
+                result = StackValue::makeSeries(site.result_series.get());
             }
+            regs[instr.dst] = result;
+            break;
+        }
+        case IrOp::Jump:
+        case IrOp::JumpIfFalse:
+            throw std::runtime_error("Jumps are not supported in column execution.");
+        case IrOp::Trap:
+            throw std::runtime_error(ir_traps[instr.operand]);
+        case IrOp::Halt:
+            return;
+        }
+    }
+}
 
-            std::vector<Value> args;
-            args.reserve(actual_args);
-            for (int i = 0; i < actual_args; ++i) {
-                args.push_back(pop());
-            }
-            std::reverse(args.begin(), args.end()); // 恢复参数顺序
+void PineVM::registerSeries(const std::string &name, std::shared_ptr<Series> series)
+{
+    Value &slot = built_in_vars[name];
+    auto *old = std::get_if<std::shared_ptr<Series>>(&slot);
+    const Series *replaced = old ? old->get() : nullptr;
+    slot = series;
+    releaseSharedInput(replaced);
+}
 
-            // 5. 创建上下文并调用函数。
-            FunctionContext context(*this, result_series, std::move(args));
-            Value result = builtin_info.function(context);
-            
-            // 6. 将最终结果压栈。
-            push(result);
+void PineVM::registerSeries(const std::string &name, std::shared_ptr<const Series> series)
+{
+    // 内部统一按 Series* 读取；是否可写由 shared_inputs 判断
+    Value &slot = built_in_vars[name];
+    auto *old = std::get_if<std::shared_ptr<Series>>(&slot);
+    const Series *replaced = old ? old->get() : nullptr;
+    slot = std::const_pointer_cast<Series>(series);
+    if (series)
+        shared_inputs.emplace(series.get(), series);
+    if (replaced != series.get())
+        releaseSharedInput(replaced);
+}
+
+Series *PineVM::getSeries(const std::string &name)
+{
+    auto it = built_in_vars.find(name);
+    if (it == built_in_vars.end())
+        return nullptr;
+    auto *series = std::get_if<std::shared_ptr<Series>>(&it->second);
+    if (!series || !*series)
+        return nullptr;
+    if (isSharedInput(series->get()))
+    {
+        const Series *shared = series->get();
+        *series = std::make_shared<Series>(**series);
+        releaseSharedInput(shared);
+    }
+    return series->get();
+}
+
+//-----------------------------------------------------------------------------
+// 状态快照
+//-----------------------------------------------------------------------------
+
+static const char kCheckpointMagic[8] = {'P', 'V', 'M', 'C', 'K', 'P', 'T', '2'};
+
+template <typename T>
+static void writePod(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static void writeString(std::ostream &out, const std::string &value)
+{
+    writePod(out, static_cast<uint32_t>(value.size()));
+    out.write(value.data(), static_cast<std::streamsize>(value.size()));
+}
+
+template <typename T>
+static T readPod(std::istream &in)
+{
+    T value;
+    if (!in.read(reinterpret_cast<char *>(&value), sizeof(T)))
+        throw std::runtime_error("Checkpoint is truncated.");
+    return value;
+}
+
+static std::string readString(std::istream &in)
+{
+    std::string value(readPod<uint32_t>(in), '\0');
+    if (!in.read(&value[0], static_cast<std::streamsize>(value.size())))
+        throw std::runtime_error("Checkpoint is truncated.");
+    return value;
+}
+
+// 函数状态序列以结果序列的地址为键 (如 ta.rsi 的 "__call__ta.rsi__gain@<地址>")，
+// 地址在快照中改写为序列编号 "@#<编号>"，恢复时再换成新对象的地址
+static std::string checkpointCacheKey(const std::string &key, const std::map<const Series *, uint32_t> &ids)
+{
+    const size_t at = key.rfind('@');
+    if (at == std::string::npos || at + 1 >= key.size() || key.find_first_not_of("0123456789", at + 1) != std::string::npos)
+        return key;
+    const auto *address = reinterpret_cast<const Series *>(static_cast<std::uintptr_t>(std::stoull(key.substr(at + 1))));
+    auto it = ids.find(address);
+    return it == ids.end() ? key : key.substr(0, at) + "@#" + std::to_string(it->second);
+}
+
+enum class CheckpointValue : uint8_t { None, Number, Bool, Series, String };
+
+void PineVM::saveCheckpoint(std::ostream &out) const
+{
+    // 每个序列对象只写一次，多处引用 (全局变量与调用点结果共用序列等) 记录同一编号
+    std::vector<const Series *> table;
+    std::map<const Series *, uint32_t> ids;
+    auto id = [&](const std::shared_ptr<Series> &series) {
+        auto it = ids.find(series.get());
+        if (it != ids.end())
+            return it->second;
+        table.push_back(series.get());
+        return ids[series.get()] = static_cast<uint32_t>(table.size() - 1);
+    };
+    std::vector<uint32_t> var_ids;
+    for (const auto &var : vars)
+        var_ids.push_back(id(var));
+    std::vector<std::pair<std::string, uint32_t>> cache;
+    for (const auto &pair : builtin_func_cache)
+        cache.push_back({pair.first, id(pair.second)});
+    for (const Value &global : globals)
+        if (auto *series = std::get_if<std::shared_ptr<Series>>(&global))
+            id(*series);
+    std::map<const Series *, std::string> inputs;
+    for (const auto &pair : built_in_vars)
+        if (auto *series = std::get_if<std::shared_ptr<Series>>(&pair.second))
+            inputs.emplace(series->get(), pair.first);
+
+    out.write(kCheckpointMagic, sizeof(kCheckpointMagic));
+    writePod(out, _generateChecksum(bytecode));
+    writePod(out, static_cast<int32_t>(bar_index));
+    writePod(out, static_cast<int32_t>(total_bars));
+    std::stringstream engine;
+    engine << (tentative_active ? tentative_random_engine : random_engine);
+    writeString(out, engine.str());
+
+    writePod(out, static_cast<uint32_t>(table.size()));
+    for (const Series *series : table)
+    {
+        // 输入序列只记录注册名
+        auto input = inputs.find(series);
+        writePod(out, static_cast<uint8_t>(input != inputs.end()));
+        if (input != inputs.end())
+        {
+            writeString(out, input->second);
+            continue;
+        }
+        writeString(out, series->name);
+        writePod(out, static_cast<uint64_t>(series->capacity));
+        writePod(out, static_cast<int32_t>(series->length));
+        writePod(out, static_cast<uint64_t>(series->data.size()));
+        out.write(reinterpret_cast<const char *>(series->data.data()), static_cast<std::streamsize>(series->data.size() * sizeof(double)));
+    }
+
+    writePod(out, static_cast<uint32_t>(var_ids.size()));
+    for (uint32_t var : var_ids)
+        writePod(out, var);
+    writePod(out, static_cast<uint32_t>(cache.size()));
+    for (const auto &pair : cache)
+    {
+        writeString(out, checkpointCacheKey(pair.first, ids));
+        writePod(out, pair.second);
+    }
+    // 全局变量按槽位保存；序列同时记录名字，直接别名输入序列时改过的名字 (如 A:=C 中的 A) 也要还原
+    writePod(out, static_cast<uint32_t>(globals.size()));
+    for (const Value &global : globals)
+    {
+        if (auto *series = std::get_if<std::shared_ptr<Series>>(&global))
+        {
+            writePod(out, CheckpointValue::Series);
+            writePod(out, ids.at(series->get()));
+            writeString(out, (*series)->name);
+        }
+        else if (auto *text = std::get_if<std::string>(&global))
+        {
+            writePod(out, CheckpointValue::String);
+            writeString(out, *text);
+        }
+        else if (auto *number = std::get_if<double>(&global))
+        {
+            writePod(out, CheckpointValue::Number);
+            writePod(out, *number);
+        }
+        else if (auto *boolean = std::get_if<bool>(&global))
+        {
+            writePod(out, CheckpointValue::Bool);
+            writePod(out, static_cast<uint8_t>(*boolean));
+        }
+        else
+        {
+            writePod(out, CheckpointValue::None);
+        }
+    }
+    writePod(out, static_cast<uint32_t>(exports.size()));
+    for (const auto &pair : exports)
+    {
+        writeString(out, pair.first);
+        writeString(out, pair.second.name);
+        writeString(out, pair.second.color);
+    }
+}
+
+void PineVM::restoreCheckpoint(std::istream &in)
+{
+    char magic[sizeof(kCheckpointMagic)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kCheckpointMagic))
+        throw std::runtime_error("Not a PineVM checkpoint.");
+    const uint32_t checksum = readPod<uint32_t>(in);
+    if (checksum != _generateChecksum(bytecode))
+        throw std::runtime_error("Checkpoint was saved for different bytecode (checksum " + std::to_string(checksum) +
+                                 ", loaded " + std::to_string(_generateChecksum(bytecode)) + ").");
+    const int saved_bar_index = readPod<int32_t>(in);
+    const int saved_total_bars = readPod<int32_t>(in);
+    std::mt19937 engine;
+    std::stringstream engine_state(readString(in));
+    engine_state >> engine;
+
+    // 先读出全部内容并校验，再改动 VM 状态
+    struct SavedSeries {
+        std::string input;
+        Series series;
+    };
+    std::vector<SavedSeries> table(readPod<uint32_t>(in));
+    for (SavedSeries &saved : table)
+    {
+        if (readPod<uint8_t>(in))
+        {
+            saved.input = readString(in);
+            auto it = built_in_vars.find(saved.input);
+            if (it == built_in_vars.end() || !std::holds_alternative<std::shared_ptr<Series>>(it->second))
+                throw std::runtime_error("Checkpoint references unregistered input series '" + saved.input + "'.");
+            continue;
+        }
+        saved.series.name = readString(in);
+        saved.series.capacity = static_cast<size_t>(readPod<uint64_t>(in));
+        saved.series.length = readPod<int32_t>(in);
+        saved.series.data.resize(static_cast<size_t>(readPod<uint64_t>(in)));
+        if (!in.read(reinterpret_cast<char *>(saved.series.data.data()), static_cast<std::streamsize>(saved.series.data.size() * sizeof(double))))
+            throw std::runtime_error("Checkpoint is truncated.");
+    }
+    auto readId = [&]() {
+        const uint32_t id = readPod<uint32_t>(in);
+        if (id >= table.size())
+            throw std::runtime_error("Checkpoint is corrupted.");
+        return id;
+    };
+    std::vector<uint32_t> var_ids(readPod<uint32_t>(in));
+    if (var_ids.size() != vars.size())
+        throw std::runtime_error("Checkpoint is corrupted.");
+    for (uint32_t &var : var_ids)
+        var = readId();
+    std::vector<std::pair<std::string, uint32_t>> cache(readPod<uint32_t>(in));
+    for (auto &pair : cache)
+    {
+        pair.first = readString(in);
+        pair.second = readId();
+    }
+    struct SavedGlobal {
+        CheckpointValue kind;
+        double number = 0.0; // 数值、布尔值或序列编号
+        std::string text;    // 字符串的值或序列的名字
+    };
+    std::vector<SavedGlobal> saved_globals(readPod<uint32_t>(in));
+    if (saved_globals.size() != globals.size())
+        throw std::runtime_error("Checkpoint is corrupted.");
+    for (auto &global : saved_globals)
+    {
+        global.kind = readPod<CheckpointValue>(in);
+        if (global.kind == CheckpointValue::Series)
+        {
+            global.number = readId();
+            global.text = readString(in);
+        }
+        else if (global.kind == CheckpointValue::Number)
+            global.number = readPod<double>(in);
+        else if (global.kind == CheckpointValue::Bool)
+            global.number = readPod<uint8_t>(in);
+        else if (global.kind == CheckpointValue::String)
+            global.text = readString(in);
+        else if (global.kind != CheckpointValue::None)
+            throw std::runtime_error("Checkpoint is corrupted.");
+    }
+    std::map<std::string, ExportedSeries> saved_exports;
+    for (uint32_t n = readPod<uint32_t>(in); n > 0; --n)
+    {
+        std::string key = readString(in);
+        ExportedSeries exported;
+        exported.name = readString(in);
+        exported.color = readString(in);
+        saved_exports[key] = exported;
+    }
+
+    // 调用点的结果序列和中间变量沿用 loadBytecode 创建的对象，其余序列新建
+    std::vector<std::shared_ptr<Series>> objects(table.size());
+    for (size_t i = 0; i < table.size(); ++i)
+        if (!table[i].input.empty())
+            objects[i] = std::get<std::shared_ptr<Series>>(built_in_vars[table[i].input]);
+    auto bind = [&](uint32_t id, const std::shared_ptr<Series> &existing) -> std::shared_ptr<Series> & {
+        if (!objects[id])
+            objects[id] = existing ? existing : std::make_shared<Series>();
+        return objects[id];
+    };
+    for (const auto &pair : cache)
+    {
+        auto it = pair.first.find("@#") == std::string::npos ? builtin_func_cache.find(pair.first) : builtin_func_cache.end();
+        bind(pair.second, it == builtin_func_cache.end() ? nullptr : it->second);
+    }
+    for (size_t i = 0; i < vars.size(); ++i)
+        vars[i] = bind(var_ids[i], vars[i]);
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        bind(static_cast<uint32_t>(i), nullptr);
+        if (table[i].input.empty())
+        {
+            Series &series = *objects[i];
+            series.name = table[i].series.name;
+            series.capacity = table[i].series.capacity;
+            series.length = table[i].series.length;
+            series.data = std::move(table[i].series.data);
+        }
+    }
+
+    builtin_func_cache.clear();
+    state_series_index.clear();
+    sorted_windows.clear();
+    for (const auto &pair : cache)
+    {
+        std::string key = pair.first;
+        const size_t at = key.rfind("@#");
+        if (at != std::string::npos)
+        {
+            const auto *target = objects.at(std::stoul(key.substr(at + 2))).get();
+            key = key.substr(0, at + 1) + std::to_string(reinterpret_cast<std::uintptr_t>(target));
+        }
+        builtin_func_cache[key] = objects[pair.second];
+    }
+    for (size_t i = 0; i < globals.size(); ++i)
+    {
+        const auto &saved = saved_globals[i];
+        switch (saved.kind)
+        {
+        case CheckpointValue::Series:
+        {
+            const auto &series = objects[static_cast<size_t>(saved.number)];
+            series->name = saved.text;
+            globals[i] = series;
             break;
         }
-        default:
-            throw std::runtime_error("Unknown opcode!");
+        case CheckpointValue::Number: globals[i] = saved.number; break;
+        case CheckpointValue::Bool:   globals[i] = saved.number != 0.0; break;
+        case CheckpointValue::String: globals[i] = saved.text; break;
+        default:                      globals[i] = std::monostate{}; break;
         }
-        ip++;
     }
+    exports = std::move(saved_exports);
+    bar_index = saved_bar_index;
+    total_bars = saved_total_bars;
+    random_engine = engine;
+    tentative_active = false;
+    tentative_evaluated = false;
 }
 
-void PineVM::registerSeries(const std::string &name, std::shared_ptr<Series> series)
+bool PineVM::isSharedInput(const Series *series) const
+{
+    return series && shared_inputs.count(series);
+}
+
+// 输入名不再引用该只读序列时删除登记 (同一序列可能以多个名字注册)
+void PineVM::releaseSharedInput(const Series *series)
+{
+    if (!series || !shared_inputs.count(series))
+        return;
+    for (const auto &[name, value] : built_in_vars)
+    {
+        const auto *input = std::get_if<std::shared_ptr<Series>>(&value);
+        if (input && input->get() == series)
+            return;
+    }
+    shared_inputs.erase(series);
+}
+
+// 不能被别名和改名的序列：只读共享的输入序列，以及隐藏全局变量的序列 (可能被多处读取)
+bool PineVM::isProtectedSeries(const Series *series) const
+{
+    if (isSharedInput(series))
+        return true;
+    for (int index : hidden_globals)
+    {
+        auto *slot = std::get_if<std::shared_ptr<Series>>(&globals[index]);
+        if (slot && slot->get() == series)
+            return true;
+    }
+    return false;
+}
+
+std::vector<Value> PineVM::getGlobalSeries() const
+{
+    std::vector<Value> result;
+    result.reserve(globals.size() - hidden_globals.size());
+    for (size_t i = 0; i < globals.size(); ++i)
+        if (std::find(hidden_globals.begin(), hidden_globals.end(), static_cast<int>(i)) == hidden_globals.end())
+            result.push_back(globals[i]);
+    return result;
+}
+
+Value PineVM::getGlobal(const std::string &name) const
 {
-    built_in_vars[name] = series;
+    auto it = std::find(bytecode.global_name_pool.begin(), bytecode.global_name_pool.end(), name);
+    if (it == bytecode.global_name_pool.end() || static_cast<size_t>(it - bytecode.global_name_pool.begin()) >= globals.size())
+        return std::monostate{};
+    return globals[it - bytecode.global_name_pool.begin()];
 }
 
 /**
@@ -534,25 +2733,25 @@ std::vector<std::shared_ptr<Series>> PineVM::getAllPlottableSeries() const {
  * @param print_value 一个函数，用于定义如何打印单个数据点。
  */
 void PineVM::printSeriesSummary(const Series& series, std::function<void(double)> print_value) const {
-    const auto &data = series.data;
-    const size_t n = data.size();
+    // 流式模式下已滑出环形缓冲区的历史读出为 NaN
+    const size_t n = series.size();
 
     std::cout << "  Data (total " << n << " points): [";
 
     if (n <= 20) {
         for (size_t i = 0; i < n; ++i) {
             if (i > 0) std::cout << ", ";
-            print_value(data[i]);
+            print_value(series.getCurrent(static_cast<int>(i)));
         }
     } else {
         for (size_t i = 0; i < 10; ++i) {
             if (i > 0) std::cout << ", ";
-            print_value(data[i]);
+            print_value(series.getCurrent(static_cast<int>(i)));
         }
         std::cout << ", ...";
         for (size_t i = n - 10; i < n; ++i) {
             std::cout << ", ";
-            print_value(data[i]);
+            print_value(series.getCurrent(static_cast<int>(i)));
         }
     }
     std::cout << "]" << std::endl;
@@ -639,23 +2838,26 @@ void PineVM::writePlottedResultsToStream(std::ostream &stream, int precision) co
     }
     stream << "\n";
 
-    // 2. 计算最大行数
-    size_t max_rows = 0;
+    // 2. 计算行范围 (流式模式下只输出仍保留在环形缓冲区中的行)
+    int max_rows = 0;
+    int first_row = std::numeric_limits<int>::max();
     if (time_series) {
-        max_rows = time_series->data.size();
+        max_rows = time_series->size();
     }
     for (const auto &series : plottable_series) {
-        max_rows = std::max(max_rows, series->data.size());
+        max_rows = std::max(max_rows, series->size());
+        first_row = std::min(first_row, series->firstIndex());
     }
+    first_row = std::min(first_row, max_rows);
 
     // 3. 逐行写入数据
-    for (size_t i = 0; i < max_rows; ++i) {
+    for (int i = first_row; i < max_rows; ++i) {
         first_column = true;
         
         // 写入时间列
         if (time_series) {
-            if (i < time_series->data.size()) {
-                double val = time_series->data[i];
+            if (i < time_series->size()) {
+                double val = time_series->getCurrent(i);
                 if (!std::isnan(val) && val > 0) {
                     time_t rawtime = static_cast<time_t>(val);
                     struct tm dt;
@@ -673,8 +2875,8 @@ void PineVM::writePlottedResultsToStream(std::ostream &stream, int precision) co
         // 写入其他数据列
         for (const auto &series : plottable_series) {
             if (!first_column) stream << ",";
-            if (i < series->data.size()) {
-                double val = series->data[i];
+            if (i < series->size()) {
+                double val = series->getCurrent(i);
                 if (std::isnan(val)) {
                      stream << "nan";
                 } else {
@@ -706,7 +2908,7 @@ std::string PineVM::getPlottedResultsAsString(int precision) const {
     return ss.str();
 }
 
-void PineVM::registerBuiltins()
+void PineVM::registerBuiltins(std::map<std::string, BuiltinInfo>& built_in_funcs)
 { 
     // `input` 函数，可以接受1个或2个参数
     built_in_funcs["input.int"] = {
@@ -726,12 +2928,13 @@ void PineVM::registerBuiltins()
             // std::cout << "Input with title: " << title << std::endl;
             
             int current_bar = ctx.getCurrentBarIndex();
-            std::shared_ptr<Series> result_series = ctx.getResultSeries();
+            const std::shared_ptr<Series> &result_series = ctx.getResultSeries();
             result_series->setCurrent(current_bar, defval);
             return result_series;
         },
         .min_args = 1, // 至少需要1个参数
-        .max_args = 2  // 最多接受2个参数
+        .max_args = 2, // 最多接受2个参数
+        .lookback = Lookback::fixed(0)
     };
      built_in_funcs["indicator"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -758,7 +2961,8 @@ void PineVM::registerBuiltins()
             
         },
         .min_args = 1,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
    
     // `plot` 函数，我们也可以让 color 可选
@@ -769,7 +2973,7 @@ void PineVM::registerBuiltins()
     built_in_funcs["plot5"] = 
     built_in_funcs["plot"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto plot_series = ctx.getArgAsSeries(0);
+            Series &plot_series = ctx.getArgSeries(0);
             
             std::string color;
             if (ctx.argCount() > 1) {
@@ -779,64 +2983,59 @@ void PineVM::registerBuiltins()
             }
 
             int current_bar = ctx.getCurrentBarIndex();
-            std::shared_ptr<Series> result_series = ctx.getResultSeries();
+            const std::shared_ptr<Series> &result_series = ctx.getResultSeries();
             PineVM& vm = ctx.getVM();
 
             auto it = vm.exports.find(result_series->name);
             if (it == vm.exports.end()) {
                 vm.exports[result_series->name] = {result_series->name, color};
             }
-            result_series->setCurrent(current_bar, plot_series->getCurrent(current_bar));
+            result_series->setCurrent(current_bar, plot_series.getCurrent(current_bar));
             return result_series;
         },
         .min_args = 1,
-        .max_args = 2
+        .max_args = 2,
+        .pure = false // 会登记输出
     };
     built_in_funcs["ta.sma"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto series = ctx.getArgAsSeries(0);
+            Series &series = ctx.getArgSeries(0);
             double length = ctx.getArgAsNumeric(1);
             int current_bar = ctx.getCurrentBarIndex();
-            std::shared_ptr<Series> result_series = ctx.getResultSeries();
+            const std::shared_ptr<Series> &result_series = ctx.getResultSeries();
 
+            // 开头不足 length 根时也要递推，窗口状态才能连续
+            auto window = ctx.windowSum(series, static_cast<int>(std::ceil(length)));
             if (current_bar < length - 1) {
                 result_series->setCurrent(current_bar, NAN);
                 return result_series;
             }
 
-            double sum = 0.0;
-            int count = 0;
-            for (int i = 0; i < length; ++i) {
-                double val = series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    sum += val;
-                    count++;
-                }
-            }
-            if (count > 0) {
-                result_series->setCurrent(current_bar, sum / count);
+            if (window.valid > 0) {
+                result_series->setCurrent(current_bar, window.sum / window.valid);
             } else {
                 result_series->setCurrent(current_bar, NAN);
             }
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     built_in_funcs["ta.ema"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto series = ctx.getArgAsSeries(0);
+            Series &series = ctx.getArgSeries(0);
             double length = ctx.getArgAsNumeric(1);
             int current_bar = ctx.getCurrentBarIndex();
-            std::shared_ptr<Series> result_series = ctx.getResultSeries();
+            const std::shared_ptr<Series> &result_series = ctx.getResultSeries();
             
             if (current_bar == 0) {
-                result_series->setCurrent(current_bar, series->getCurrent(current_bar));
+                result_series->setCurrent(current_bar, series.getCurrent(current_bar));
                 return result_series;
             }
 
             double alpha = 2.0 / (length + 1.0);
-            double current_value = series->getCurrent(current_bar);
+            double current_value = series.getCurrent(current_bar);
             double prev_ema = result_series->getCurrent(current_bar - 1);
 
             if (std::isnan(current_value) || std::isnan(prev_ema)) {
@@ -850,15 +3049,16 @@ void PineVM::registerBuiltins()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0, 1)
     };
     built_in_funcs["rsi"] = 
     built_in_funcs["ta.rsi"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto series = ctx.getArgAsSeries(0);
+            Series &series = ctx.getArgSeries(0);
             double length = ctx.getArgAsNumeric(1);
             int current_bar = ctx.getCurrentBarIndex();
-            std::shared_ptr<Series> result_series = ctx.getResultSeries();
+            const std::shared_ptr<Series> &result_series = ctx.getResultSeries();
             PineVM& vm = ctx.getVM();
 
             if (current_bar == 0) {
@@ -867,7 +3067,10 @@ void PineVM::registerBuiltins()
             }
 
             // 获取前一个 bar 的增益和损失
-            std::string cache_key = "__call__ta.rsi__gain";
+            // 以调用点的结果序列区分状态，使同一脚本中的多个 rsi 调用互不干扰。
+            // 结果序列可能被赋值语句改名，所以用它的地址而不是名字作为键。
+            const std::string state_key = std::to_string(reinterpret_cast<std::uintptr_t>(result_series.get()));
+            std::string cache_key = "__call__ta.rsi__gain@" + state_key;
             std::shared_ptr<Series> rsi__gain_series;
             if (vm.builtin_func_cache.count(cache_key))
             {
@@ -879,7 +3082,7 @@ void PineVM::registerBuiltins()
                 rsi__gain_series->name = cache_key;
                 vm.builtin_func_cache[cache_key] = rsi__gain_series;
             }
-            cache_key = "__call__ta.rsi__loss";
+            cache_key = "__call__ta.rsi__loss@" + state_key;
             std::shared_ptr<Series> rsi__loss_series;
             if (vm.builtin_func_cache.count(cache_key))
             {
@@ -891,12 +3094,18 @@ void PineVM::registerBuiltins()
                 rsi__loss_series->name = cache_key;
                 vm.builtin_func_cache[cache_key] = rsi__loss_series;
             }
+            // 增益和损失只回看一根，结果序列是环形缓冲区 (流式模式) 时同样限制容量
+            if (result_series->isBounded())
+            {
+                rsi__gain_series->setCapacity(2);
+                rsi__loss_series->setCapacity(2);
+            }
             double prev_gain = rsi__gain_series->getCurrent(current_bar - 1);
             double prev_loss = rsi__loss_series->getCurrent(current_bar - 1);
 
             // 计算当前 bar 的价格变化
-            double current_price = series->getCurrent(current_bar);
-            double prev_price = series->getCurrent(current_bar - 1);
+            double current_price = series.getCurrent(current_bar);
+            double prev_price = series.getCurrent(current_bar - 1);
 
             if (std::isnan(current_price) || std::isnan(prev_price)) {
                 result_series->setCurrent(current_bar, NAN);
@@ -929,8 +3138,9 @@ void PineVM::registerBuiltins()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(1)
     };
     //
-    registerBuiltinsHithink();
+    registerBuiltinsHithink(built_in_funcs);
 }
\ No newline at end of file
@@ -6,13 +6,50 @@
 #include <string>
 #include <variant>
 #include <map>
+#include <unordered_map>
 #include <memory>
 #include <functional>
 #include <stdexcept>
 #include <cmath> // for std::isnan, NAN
+#include <cstdint>
+#include <random>
+#include <iosfwd>
 #include "VMCommon.h"
 
 class PineVM; 
+class SortedWindow;
+
+//-----------------------------------------------------------------------------
+// StackValue (操作数栈上的紧凑值)
+//-----------------------------------------------------------------------------
+/**
+ * @struct StackValue
+ * @brief VM 内部操作数栈使用的 16 字节标记值。
+ *        序列保存为非拥有指针，字符串保存为 VM 字符串池下标，数值内联保存，
+ *        因此压栈/出栈不涉及引用计数和内存分配。指向的对象由 VM 持有，在 VM 生命周期内有效。
+ *        对外 (内置函数、绑定层) 仍然使用 Value。
+ *        Column 只在按列执行时出现，表示标量临时变量在当前区间上的取值 (下标相对区间起点)。
+ */
+struct StackValue {
+    enum class Tag : uint8_t { None, Number, Bool, String, Series, Column };
+
+    Tag tag = Tag::None;
+    union {
+        double number;
+        bool boolean;
+        int string_index;
+        Series* series;
+        const double* column;
+    };
+
+    StackValue() : number(0.0) {}
+    static StackValue makeNumber(double v) { StackValue s; s.tag = Tag::Number; s.number = v; return s; }
+    static StackValue makeBool(bool v) { StackValue s; s.tag = Tag::Bool; s.boolean = v; return s; }
+    static StackValue makeString(int index) { StackValue s; s.tag = Tag::String; s.string_index = index; return s; }
+    static StackValue makeSeries(Series* p) { StackValue s; s.tag = Tag::Series; s.series = p; return s; }
+    static StackValue makeColumn(const double* p) { StackValue s; s.tag = Tag::Column; s.column = p; return s; }
+};
+static_assert(sizeof(StackValue) <= 16, "StackValue must stay compact");
 
 //-----------------------------------------------------------------------------
 // FunctionContext 类 (The Function Call Context)
@@ -20,38 +57,123 @@ class PineVM;
 /**
  * @class FunctionContext
  * @brief 为内置函数调用提供一个安全、隔离的执行上下文。
- *        它负责管理参数传递，防止函数直接操作VM主堆栈，从而实现堆栈保护。
+ *        参数是 VM 参数缓冲区上的只读视图 (指针 + 数量)，构造上下文不分配内存；
+ *        getArgSeries / getArgAsNumeric 等类型化接口直接返回引用或数值，不复制 shared_ptr。
  */
 class FunctionContext {
 public:
-    FunctionContext(PineVM& vm, std::shared_ptr<Series> result_series, std::vector<Value>&& args)
-        : vm_(vm), result_series_(result_series), args_(std::move(args)) {}
+    FunctionContext(PineVM& vm, const std::shared_ptr<Series>& result_series, const StackValue* args, size_t arg_count)
+        : vm_(vm), result_series_(result_series), args_(args), arg_count_(arg_count) {}
 
     // --- 安全的参数访问接口 ---
-    size_t argCount() const { return args_.size(); }
+    size_t argCount() const { return arg_count_; }
     
-    const Value& getArg(size_t index) const {
-        if (index >= args_.size()) {
+    const StackValue& getRawArg(size_t index) const {
+        if (index >= arg_count_) {
             throw std::runtime_error("Argument index out of bounds: requested " + std::to_string(index) 
-                                     + ", but only " + std::to_string(args_.size()) + " provided.");
+                                     + ", but only " + std::to_string(arg_count_) + " provided.");
         }
         return args_[index];
     }
+
+    // 转换为 Value 的兼容接口 (序列参数会复制一次 shared_ptr)
+    Value getArg(size_t index) const;
     
     // --- 便利的类型转换接口 ---
     double getArgAsNumeric(size_t index) const;
+    bool getArgAsBool(size_t index) const;
+    Series& getArgSeries(size_t index) const;          // 参数不是序列时抛出异常
+    Series* getArgSeriesOrNull(size_t index) const;    // 参数不是序列时返回 nullptr
+    const std::string& getArgString(size_t index) const;
     std::shared_ptr<Series> getArgAsSeries(size_t index) const;
-    std::string getArgAsString(size_t index) const;
+    std::string getArgAsString(size_t index) const { return getArgString(index); }
 
     // --- 访问VM核心状态的接口 ---
     int getCurrentBarIndex() const;
-    std::shared_ptr<Series> getResultSeries() const { return result_series_; }
+    const std::shared_ptr<Series>& getResultSeries() const { return result_series_; }
     PineVM& getVM() { return vm_; }
 
+    /**
+     * @brief 本调用点名为 name 的状态序列，首次使用时创建并登记在 builtin_func_cache 中，
+     *        键与 ta.rsi 的增益/损失序列相同 ("__call__<name>@<结果序列地址>")，快照和临时计算无需特殊处理。
+     *        状态按 K 线下标保存，最多回看 history 根；结果序列是环形缓冲区时状态序列只保留 history + 1 根。
+     */
+    Series& getStateSeries(const char* name, int history = 1);
+
+    struct WindowSum {
+        double sum = 0.0; // 窗口内非 NaN 值的和
+        int valid = 0;    // 窗口内非 NaN 值的个数
+    };
+
+    /**
+     * @brief 对 source 最近 length 根 (含当前根；开头不足 length 根时为已有部分) 求和；
+     *        count_nonzero 为 true 时每根按 "非零且非 NaN" 记为 1 或 0。
+     *        窗口较长时用调用点状态递推 (加入新值、移出旧值)，每根的开销与 length 无关。
+     *        每隔 length 根、窗口重新变为全部有效以及上一根的状态不可用时完整重算，
+     *        所以与逐根求和相比只有不超过 length 次加减的舍入误差，计数完全一致。
+     *        递推需要读取 length 根之前的值，使用它的函数应标注 Lookback::window(参数, 0)。
+     */
+    WindowSum windowSum(Series& source, int length, bool count_nonzero = false);
+
+    /**
+     * @brief 返回 source 在窗口 [当前根 - offset - length + 1, 当前根 - offset] 中最大 (highest) 或最小值所在的
+     *        K 线下标，跳过 NaN，没有有效值时返回 -1。值相等时 oldest_on_tie 为 true 取最早的一根，否则取最近的一根。
+     *        窗口较长时用调用点状态分块递推，每根的均摊开销与 length 无关，结果与逐根扫描完全一致。
+     *        只读取窗口内的值 (Lookback::window(参数, offset - 1))。
+     */
+    int windowExtreme(Series& source, int length, bool highest, bool oldest_on_tie, int offset = 0);
+
+    struct WindowMoments {
+        int valid = 0;          // 窗口内非 NaN 值的个数
+        double mean = NAN;      // 均值
+        double sum_sq_dev = 0.0; // 离差平方和 Σ(x - mean)²
+    };
+
+    /**
+     * @brief 对 source 最近 length 根 (含当前根；开头不足 length 根时为已有部分) 的非 NaN 值求均值和离差平方和
+     *        (std/var/devsq 等共用)。窗口较长时以窗口均值为中心递推平移后的和与平方和，每根的开销与 length 无关；
+     *        重新居中与 windowSum 的完整重算时机相同，此时结果与两遍扫描逐位一致，其余各根只有舍入误差。
+     *        使用它的函数应标注 Lookback::window(参数, 0)。
+     */
+    WindowMoments windowMoments(Series& source, int length);
+
+    // windowRegression 的样本点取法
+    enum class PairSource {
+        Time,    // (K 线下标, y)
+        Values,  // (x, y)
+        Returns, // (x 的单根涨幅, y 的单根涨幅)
+    };
+
+    struct WindowRegression {
+        int valid = 0;       // x、y 都非 NaN 的样本个数
+        double mean_x = NAN;
+        double mean_y = NAN;
+        double sxx = 0.0;    // Σ(x - mean_x)²
+        double syy = 0.0;    // Σ(y - mean_y)²
+        double sxy = 0.0;    // Σ(x - mean_x)(y - mean_y)
+    };
+
+    /**
+     * @brief 最近 length 根样本点 (x, y) 的均值、离差平方和与离差乘积和 (slope/forcast/relate/covar/beta 共用)。
+     *        x 为 nullptr 时只能用 PairSource::Time。窗口较长时与 windowMoments 相同，
+     *        以最近一次完整重算时的均值为中心递推 Σx、Σy、Σxy、Σx²、Σy²，每根的开销与 length 无关。
+     *        使用它的函数应标注 Lookback::window(参数, 0)；PairSource::Returns 还要多读一根，为 window(参数, 1)。
+     */
+    WindowRegression windowRegression(const Series* x, const Series& y, int length, PairSource source);
+
+    /**
+     * @brief source 最近 length 根中非 NaN 值的平均绝对偏差 Σ|x - mean| / n，没有有效值时为 NaN。
+     *        窗口较长时用调用点的有序窗口 (见 SortedWindow) 滑动，每根 O(log length)。
+     *        使用它的函数应标注 Lookback::window(参数, 0)。
+     */
+    double windowMeanAbsDeviation(Series& source, int length);
+
 private:
     PineVM& vm_;
-    std::shared_ptr<Series> result_series_; // 函数应该写入结果的序列
-    std::vector<Value> args_;               // 本次调用的参数列表 (已从主堆栈弹出)
+    const std::shared_ptr<Series>& result_series_; // 函数应该写入结果的序列 (由调用点持有)
+    const StackValue* args_;                      // 本次调用的参数 (VM 参数缓冲区，调用期间有效)
+    size_t arg_count_;
+    std::vector<std::pair<const char*, Series*>>* state_slots_ = nullptr; // 本调用点的状态序列 (首次 getStateSeries 时查找)
 };
 
 //-----------------------------------------------------------------------------
@@ -63,6 +185,7 @@ private:
  * @brief 一个用于执行 PineScript 字节码的堆栈式虚拟机，支持全量和增量计算。
  */
 class PineVM {
+    friend class FunctionContext;
 public:
     /**
      * @brief PineVM 的构造函数。
@@ -75,6 +198,24 @@ public:
      * @param code 字节码的文本表示。
      */
     void loadBytecode(const std::string& code);
+
+    /**
+     * @brief 直接加载已编译的字节码 (不经过文本格式)，其余同上。
+     *        批量计算 (见 BatchRunner.h) 用它为每个品种加载同一份字节码；
+     *        二进制字节码和公式库 (见 binaryToBytecode、BytecodeLibrary) 解码后也由此加载。
+     */
+    void loadBytecode(const Bytecode& code);
+
+    /**
+     * @brief 开启或关闭加载日志 (默认关闭)。开启后每次 loadBytecode 把加载的程序以文本格式打印到 std::cout。
+     */
+    void setBytecodeLogging(bool enabled) { log_bytecode = enabled; }
+
+    /**
+     * @brief 设置 rand 内置函数的随机数种子。每个 VM 有独立的随机数引擎，
+     *        多线程下互不影响，同一种子在任何线程上产生相同的序列。
+     */
+    void setRandomSeed(uint32_t seed) { random_engine.seed(seed); }
     
     /**
      * @brief 执行已加载的字节码，从当前 bar_index 计算到 new_total_bars。
@@ -91,6 +232,23 @@ public:
      */
     int execute(int new_total_bars);
 
+    /**
+     * @brief 试算正在形成的K线 (下标为 getCurrentBarIndex())，不推进 bar_index。
+     *        盘中每个 tick 更新输入序列在该下标上的值后调用一次，只计算这一根K线；
+     *        每次试算前 VM 持有的序列在该下标上的值清回 NaN，rand 的随机数状态和运行时字符串回退到第一次试算之前，
+     *        所以反复试算的结果只取决于最后一次的输入。
+     * @return 0表示成功, 非0表示失败。
+     */
+    int executeTentative();
+
+    /**
+     * @brief 确认正在形成的K线：保留最后一次试算的结果并推进到下一根。
+     *        自上次确认以来没有成功试算过时先按当前输入试算一次。之后的 execute 从下一根继续；
+     *        未确认就调用 execute 时，试算的K线按当前输入重新计算。
+     * @return 0表示成功, 非0表示失败 (此时不推进)。
+     */
+    int commitBar();
+
     std::string getLastErrorMessage() const { return lastErrorMessage; }
 
   
@@ -103,10 +261,16 @@ public:
     int getTotalBars() const { return total_bars; }
 
     /**
-     * @brief 获取所有全局变量（包括绘制的序列）。
-     * @return const std::vector<Value>& 全局变量的引用。
+     * @brief 获取所有全局变量（包括绘制的序列），不含优化器新增的隐藏全局变量 (isHiddenGlobal)。
+     *        顺序与 global_name_pool 中去掉隐藏变量后的顺序一致 (隐藏变量总是追加在末尾)。
+     * @return 全局变量的副本 (序列与 VM 共享)。
+     */
+    std::vector<Value> getGlobalSeries() const;
+
+    /**
+     * @brief 按名称获取全局变量 (包括隐藏全局变量，参数扫描读取共享程序的结果时使用)，不存在时返回 monostate。
      */
-    const std::vector<Value>& getGlobalSeries() { return globals; }
+    Value getGlobal(const std::string& name) const;
 
     /**
      * @brief 打印所有已绘制的序列及其数据。
@@ -118,32 +282,90 @@ public:
     std::string getPlottedResultsAsString(int precision = 3) const;
 
     void registerSeries(const std::string& name, std::shared_ptr<Series> series);
+
+    /**
+     * @brief 以只读方式注册共享的输入序列，不复制数据。
+     *        同一份 OHLCV 可以注册到任意多个 VM (包括不同线程上的 VM)，VM 保证不修改它：
+     *        不改名、不改为环形缓冲区，全局变量直接引用它时改为逐 bar 复制到自己的序列。
+     */
+    void registerSeries(const std::string& name, std::shared_ptr<const Series> series);
  
     /**
      * @brief 获取一个已注册的序列。这是更新输入数据的关键接口。
+     *        只读共享的序列会先复制一份本 VM 私有的序列 (写时复制)，之后的写入不影响其他 VM。
      * @param name 序列的名称 (例如 "open", "close")。
      * @return Series* 指向序列对象的原始指针，如果未找到则返回 nullptr。
      */
-    Series* getSeries(const std::string& name) {
-        auto it = built_in_vars.find(name);
-        if (it != built_in_vars.end()) {
-            if (std::holds_alternative<std::shared_ptr<Series>>(it->second)) {
-                return std::get<std::shared_ptr<Series>>(it->second).get();
-            }
-        }
-        return nullptr;
-    }
+    Series* getSeries(const std::string& name);
 
     double getNumericValue(const Value& val);
     bool getBoolValue(const Value& val);
 
+    /**
+     * @brief 把计算状态写成紧凑的二进制快照 (本机字节序)：全局变量 (按槽位，含字符串)、中间变量、函数状态序列
+     *        (builtin_func_cache)、输出登记、bar_index 和 rand 的随机数状态，并记录字节码校验和。
+     *        输入序列只按注册名引用，不写入数据；未确认的试算K线不计入。
+     */
+    void saveCheckpoint(std::ostream& out) const;
+
+    /**
+     * @brief 从 saveCheckpoint 写出的快照恢复计算状态，之后用 execute 增量计算的结果与全量重放相同。
+     *        调用前须 loadBytecode 同一份字节码，并注册快照引用的输入序列 (含完整历史)。
+     * @throws std::runtime_error 校验和不符、快照损坏或引用的输入序列未注册。
+     */
+    void restoreCheckpoint(std::istream& in);
+
+    /**
+     * @brief 开启或关闭列式执行模式 (默认开启)。
+     *        对不含跳转、且每个全局变量都是先写后读的直线型脚本，execute 会逐条指令
+     *        一次性处理整个 bar 区间，而不是每根K线重新解释一遍全部字节码。
+     *        不满足条件的脚本总是逐 bar 执行，结果与此开关无关。
+     */
+    void setVectorizedExecution(bool enabled) { vectorized_execution = enabled; }
+    bool isVectorizedExecution() const { return vectorized_execution && range_eligible && !streaming; }
+
+    /**
+     * @brief 加载字节码时改为标量临时变量的中间结果个数 (只在当前K线内使用、不保留序列)。
+     */
+    int getScalarTempCount() const { return static_cast<int>(temp_values.size()); }
+
+    /**
+     * @brief 开启或关闭流式模式 (默认关闭)。
+     *        开启后 VM 持有的序列和已注册的输入序列改为环形缓冲区，容量为 loadBytecode 时
+     *        分析出的最大回看根数 + 1 (不少于 keep_bars)，内存不再随 K 线数增长；
+     *        回看根数不是常量的序列仍然无界。已有数据只保留窗口内的部分，之后只按 bar 执行。
+     *        读取结果请用 Series::getCurrent，窗口外的历史返回 NaN。
+     */
+    void setStreamingMode(bool enabled, int keep_bars = 1);
+    bool isStreamingMode() const { return streaming; }
+
+    /**
+     * @brief 开启或关闭最后一根K线模式 (默认关闭)，用于选股 (SELECT) 等只需要最新值的场景。
+     *        开启后从第 0 根开始的 execute 跳过最后一根K线用不到的历史，只执行 lastBarStart 起的后缀：
+     *        后缀长度由各函数的回看窗口逐级累加得出，最后一根K线上所有全局变量的值与全量计算相同。
+     *        EMA、DMA、SMA 递推类函数的结果依赖全部历史，按额外执行 warmup_bars 根收敛处理 (近似)；
+     *        回看不确定的函数 (BARSLAST、VALUEWHEN 等) 或含跳转的脚本仍从第 0 根执行。
+     *        后缀之前的K线上各序列为 NaN；之后的增量 execute 照常逐根计算。
+     */
+    void setLastBarMode(bool enabled, int warmup_bars = 250);
+    bool isLastBarMode() const { return last_bar_mode; }
+
+    /**
+     * @brief 最后一根K线模式下，共 total_bars 根K线时第一根需要执行的K线下标 (不会小于 0)。
+     */
+    int lastBarStart(int total_bars) const;
+
+    /**
+     * @brief 查询内置函数是否为纯函数 (无副作用，结果只取决于参数)。
+     *        字节码优化器据此合并相同参数的重复调用；未知函数返回 false。
+     */
+    static bool isPureBuiltin(const std::string& name);
+
 private:
     // --- 内部状态 ---
     Bytecode bytecode;
 
     std::string lastErrorMessage;
-    const Instruction* ip = nullptr; // 指令指针
-    std::vector<Value> stack;        // 操作数栈,
     std::vector<Value> globals;      // 全局变量存储槽
     std::vector<std::shared_ptr<Series>> vars;        // 中间变量存储槽
     std::map<std::string, ExportedSeries> exports;
@@ -154,6 +376,25 @@ private:
 
     using BuiltinFunction = std::function<Value(FunctionContext&)>;
 
+    /**
+     * @brief 内置函数读取历史的范围，用于流式模式下确定环形缓冲区容量 (见 analyzeLookback)。
+     *        默认无界；有界时序列参数回看 bars 根，window_arg >= 0 时再加上该参数的常量值
+     *        (该参数不是非负常量时仍按无界处理)，self 为读取自身结果序列的历史根数。
+     *        converging 标注的递推函数在最后一根K线模式下以预热代替全部历史 (见 setLastBarMode)。
+     */
+    struct Lookback {
+        bool bounded = false;
+        int window_arg = -1;
+        int bars = 0;
+        int self = 0;
+
+        bool converges = false; // 读取自身历史的递推函数：前值为 NaN 时重新起算，误差随K线数衰减
+
+        static constexpr Lookback fixed(int bars, int self = 0) { return {true, -1, bars, self}; }
+        static constexpr Lookback window(int arg, int bars, int self = 0) { return {true, arg, bars, self}; }
+        constexpr Lookback converging() const { return {bounded, window_arg, bars, self, true}; }
+    };
+
     /**
      * @brief 存储内置函数的信息，包括其可接受的参数数量范围。
      */
@@ -162,22 +403,175 @@ private:
         int min_args; // 函数期望的最少参数数量
         int max_args; // 函数期望的最多参数数量
                       // 对于固定参数函数, min_args == max_args   
-                      };
+        bool pure = true; // 无副作用且结果只取决于参数，相同参数的多次调用可以合并 (公共子表达式消除)
+        Lookback lookback{}; // 读取参数和自身结果的历史范围，未标注的函数不限制序列长度
+        const char* implicit_input = nullptr; // 隐式读取的内置变量 (如 beta 读取 close)：降级时作为最后一个参数追加，
+                                              // 与显式参数一样参与回看分析，按只读方式取用，不复制共享输入
+    };
+
+    /**
+     * @brief 进程级只读内置函数注册表。
+     *        首次使用时构建一次 (静态局部变量的初始化是线程安全的)，之后所有 PineVM 实例共享，
+     *        因此 VM 构造不再复制任何 std::function。函数按名称排序后分配稠密整数 ID。
+     */
+    class BuiltinRegistry {
+    public:
+        static const BuiltinRegistry& instance();
+
+        // 返回函数的稠密 ID，未找到时返回 -1
+        int find(const std::string& name) const;
+        const BuiltinInfo& get(int id) const { return funcs_[id]; }
+        const std::string& name(int id) const { return names_[id]; }
+        size_t size() const { return funcs_.size(); }
+
+    private:
+        BuiltinRegistry();
+        std::vector<BuiltinInfo> funcs_;
+        std::vector<std::string> names_;
+        std::unordered_map<std::string, int> ids_;
+    };
+
     std::map<std::string, Value> built_in_vars;
-    std::map<std::string, BuiltinInfo> built_in_funcs;
     std::map<std::string, std::shared_ptr<Series>> builtin_func_cache;
+    // FunctionContext::getStateSeries 的查找缓存 (结果序列 -> [(状态名, builtin_func_cache 中的序列)])，
+    // 热路径上不再拼接键；builtin_func_cache 清空时一并清空
+    using StateSlots = std::vector<std::pair<const char*, Series*>>;
+    std::unordered_map<const Series*, StateSlots> state_series_index;
+    // avedev 调用点的有序窗口，以结果序列为键；不进入快照，无法沿用时从源序列重建 (见 SortedWindow)
+    std::map<const Series*, std::shared_ptr<SortedWindow>> sorted_windows;
+
+    /**
+     * @brief 调用点链接信息。loadBytecode 时为每条 CALL_BUILTIN_FUNC 指令解析一次，
+     *        执行期直接按指令下标取用，热路径上不再做字符串拼接和 map 查找。
+     */
+    struct CallSite {
+        const BuiltinInfo* info = nullptr;     // 已解析的内置函数；为 nullptr 时执行到此处报 link_error
+        std::shared_ptr<Series> result_series; // 预先创建的结果序列 (同时登记在 builtin_func_cache 中)
+        int arg_count = -1;                    // 已校验的参数数量；-1 表示无法静态确定，运行时再校验
+        std::string link_error;
+    };
+    std::vector<CallSite> call_sites; // 与 bytecode.instructions 一一对应，非调用指令为空项
+
+    /**
+     * @brief 寄存器式中间表示 (IR)。loadBytecode 时由栈式字节码降级生成，
+     *        每条指令直接给出源操作数和目标位置，执行期不再有压栈/出栈。
+     *        常量、全局变量、内置变量和中间变量槽直接作为操作数引用，
+     *        只有内置函数的返回值和控制流汇合处需要占用寄存器 (寄存器编号即原栈深度)。
+     *        只被运算和下标偏移读取的中间结果是标量临时变量 (Temp)，不保留历史，
+     *        逐 bar 执行时是一个 double，按列执行时是一段按区间长度复用的缓冲区。
+     *        文本字节码仍是唯一的交换格式，IR 只存在于 VM 内部。
+     */
+    struct IrOperand {
+        enum class Kind : uint8_t { None, Const, Global, BuiltinVar, Var, Reg, Temp };
+        Kind kind = Kind::None;
+        int index = 0;
+    };
+    enum class IrOp : uint8_t {
+        Move,        // regs[dst] = a
+        Binary,      // vars[dst] = a binop b (temp_dst 时写入标量临时变量 dst)
+        Subscript,   // vars[dst] = a[b] (同上)
+        Store,       // globals[operand] = a
+        StoreExport, // 同 Store，并登记到 exports
+        Rename,      // a 所指序列改名为常量 operand
+        Call,        // regs[dst] = call_sites[operand](ir_args[arg_begin, arg_begin + arg_count))
+        Jump,        // 跳到 IR 下标 operand
+        JumpIfFalse, // a 为 false 时跳到 IR 下标 operand
+        Trap,        // 抛出 ir_traps[operand] (字节码在此处无法合法执行)
+        Halt,
+    };
+    struct IrInstr {
+        IrOp op = IrOp::Halt;
+        OpCode binop = OpCode::HALT;
+        int dst = 0;
+        bool temp_dst = false;
+        IrOperand a, b;
+        int operand = 0;
+        int arg_begin = 0;
+        int arg_count = 0;
+        int source_ip = 0; // 对应的字节码指令下标，用于错误信息
+    };
+    std::vector<IrInstr> ir;
+    std::vector<IrOperand> ir_args;
+    std::vector<std::string> ir_traps;
+    std::vector<StackValue> regs;
+    std::vector<StackValue> call_args; // 内置函数参数缓冲区，容量为最大参数个数
+    const IrInstr* pc = nullptr; // 当前执行的 IR 指令
+
+    // 标量临时变量：逐 bar 执行时的当前值，以及按列执行时按活跃区间复用的缓冲区
+    std::vector<double> temp_values;
+    std::vector<int> temp_column_slot; // 临时变量 -> temp_columns 中的列
+    int temp_column_count = 0;
+    ColumnArena temp_columns;
+
+    // LOAD_BUILTIN_VAR 引用的变量，每次 execute 开始时按名称解析一次
+    std::vector<std::string> builtin_var_names;
+    std::vector<StackValue> builtin_var_values;
+    std::vector<bool> builtin_var_defined;
+
+    // StackValue 引用的字符串与序列的所有者
+    std::vector<std::string> string_pool;              // 常量池中的字符串在前，运行时产生的字符串追加在后
+    std::vector<StackValue> constant_values;           // 与 bytecode.constant_pool 一一对应
+    std::vector<std::shared_ptr<Series>> pinned_series; // 内置函数返回的、不归调用点所有的序列
+    // 以只读方式注册的输入序列。持有引用，保证登记的地址在条目删除前不会被新序列复用；
+    // 写时复制或按同名重新注册后，不再被任何输入名引用的条目随即删除
+    std::unordered_map<const Series*, std::shared_ptr<const Series>> shared_inputs;
+    std::vector<int> hidden_globals;                    // 隐藏全局变量的下标，它们的序列逐根复制保存，不与其他变量共享
+
+    std::mt19937 random_engine; // rand 内置函数使用，默认种子固定
+
+    bool log_bytecode = false;        // loadBytecode 时打印程序
+    bool vectorized_execution = true; // 用户开关
+    bool range_eligible = false;      // loadBytecode 时判定：脚本是否可以按列执行
+
+    // 流式模式下各序列的环形缓冲区容量 (0 表示无界)，loadBytecode 时由 analyzeLookback 计算
+    bool streaming = false;
+    int streaming_keep_bars = 1;
+    std::vector<size_t> global_capacity;
+    std::vector<size_t> var_capacity;
+    std::vector<size_t> builtin_var_capacity;
+    std::vector<size_t> site_capacity; // 按字节码指令下标
+
+    // 试算 (executeTentative) 的K线：第一次试算前的随机数引擎和运行时字符串个数，用于回退
+    bool tentative_active = false;
+    bool tentative_evaluated = false;
+    std::mt19937 tentative_random_engine;
+    size_t tentative_string_count = 0;
+
+    // 最后一根K线模式
+    bool last_bar_mode = false;
+    int last_bar_warmup = 250;
 
     // --- 私有辅助函数 ---
+    void linkCallSites();
+    void checkRangeEligible();
+    void lowerToRegisterIR();
+    void assignScalarTemps();
+    void analyzeLookback();
+    void applyLookbackCapacities();
+    size_t streamingCapacity(size_t capacity) const;
+    long long lastBarHistory() const;
+    void resolveBuiltinVars();
+    bool isSharedInput(const Series* series) const;
+    void releaseSharedInput(const Series* series);
+    bool isProtectedSeries(const Series* series) const;
+    void reserveSeries();
     void runCurrentBar();
-    Value pop();
-    void push(Value val);
-    void pushNumbericValue(double val, int operand);
-    Value& storeGlobal(int operand, const Value& val);
+    void rollbackTentative();
+    void runRange(int begin, int end);
+    StackValue read(const IrOperand& operand);
+    const StackValue* collectCallArgs(const IrInstr& instr);
+    StackValue toStackValue(const Value& val);
+    StackValue toStackValue(Value&& val, const CallSite& site);
+    Value toValue(const StackValue& val) const;
+    double getNumericValue(const StackValue& val) const;
+    Value& storeGlobal(int operand, const StackValue& val);
+    void storeGlobalRange(int operand, const StackValue& val, int begin, int end);
     void writePlottedResultsToStream(std::ostream& stream, int precision = 3) const;
     void printSeriesSummary(const Series& series, std::function<void(double)> print_value) const;
     std::shared_ptr<Series> findTimeSeries() const;
     std::vector<std::shared_ptr<Series>> getAllPlottableSeries() const;
 
-    void registerBuiltins();
-    void registerBuiltinsHithink();
+    // 只在构建 BuiltinRegistry 时调用一次
+    static void registerBuiltins(std::map<std::string, BuiltinInfo>& built_in_funcs);
+    static void registerBuiltinsHithink(std::map<std::string, BuiltinInfo>& built_in_funcs);
 };
\ No newline at end of file
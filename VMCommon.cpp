@@ -5,9 +5,18 @@
 #include <optional> // For std::optional in txtToBytecode
 #include <cstdint> // For uint32_t
 #include <iostream> // For debug output
+#include <algorithm> // For std::max
+#include <new>       // For std::align_val_t
+#include <cstring>   // For std::memcpy
 
-double Series::getCurrent(int bar_index)
+double Series::getCurrent(int bar_index) const
 {
+    if (capacity)
+    {
+        if (bar_index >= firstIndex() && bar_index < length)
+            return data[bar_index % capacity];
+        return NAN;
+    }
     if (bar_index >= 0 && bar_index < data.size())
     {
         return data[bar_index];
@@ -16,9 +25,19 @@ double Series::getCurrent(int bar_index)
     return NAN;
 }
 
-// ... Series::setCurrent 保持不变 ...
 void Series::setCurrent(int bar_index, double value)
 {
+    if (capacity)
+    {
+        if (bar_index < firstIndex())
+            return; // 已滑出窗口
+        // 跳过的 K 线填 NaN，超过一整圈时只需清空整个缓冲区
+        for (int i = std::max(length, bar_index - static_cast<int>(capacity) + 1); i < bar_index; ++i)
+            data[i % capacity] = NAN;
+        length = std::max(length, bar_index + 1);
+        data[bar_index % capacity] = value;
+        return;
+    }
     if (bar_index >= data.size())
     {
         data.resize(bar_index + 1, NAN);
@@ -26,6 +45,65 @@ void Series::setCurrent(int bar_index, double value)
     data[bar_index] = value;
 }
 
+void Series::setCapacity(size_t new_capacity)
+{
+    if (new_capacity == capacity || (new_capacity && capacity > new_capacity))
+        return;
+    const int n = size();
+    const int first = firstIndex();
+    std::vector<double> old;
+    old.swap(data);
+    const size_t old_capacity = capacity;
+    auto at = [&](int i) { return old_capacity ? old[i % old_capacity] : old[i]; };
+
+    capacity = new_capacity;
+    length = n;
+    if (capacity)
+    {
+        data.assign(capacity, NAN);
+        for (int i = std::max(first, n - static_cast<int>(capacity)); i < n; ++i)
+            data[i % capacity] = at(i);
+    }
+    else
+    {
+        data.assign(n, NAN);
+        for (int i = first; i < n; ++i)
+            data[i] = at(i);
+    }
+}
+
+void Series::reserve(int bars)
+{
+    if (capacity || bars <= 0 || data.capacity() >= static_cast<size_t>(bars))
+        return;
+    data.reserve(std::max(static_cast<size_t>(bars), data.capacity() * 2));
+}
+
+void ColumnArena::reserve(size_t columns, size_t length)
+{
+    if (columns <= columns_ && length <= stride_)
+        return;
+    constexpr size_t per_line = kAlignment / sizeof(double);
+    size_t stride = std::max(length, stride_ < length ? stride_ * 2 : stride_);
+    stride = (stride + per_line - 1) / per_line * per_line;
+    columns = std::max(columns, columns_);
+    release();
+    if (columns == 0 || stride == 0)
+        return;
+    base_ = static_cast<double*>(::operator new[](columns * stride * sizeof(double), std::align_val_t(kAlignment)));
+    columns_ = columns;
+    stride_ = stride;
+}
+
+void ColumnArena::release()
+{
+    if (base_)
+        ::operator delete[](base_, std::align_val_t(kAlignment));
+    base_ = nullptr;
+    columns_ = 0;
+    stride_ = 0;
+}
+
 void Series::setName(const std::string &name)
 {
     this->name = name;
@@ -136,6 +214,11 @@ _checksum_t _generateChecksum(const Bytecode& bytecode) {
     return hasher.finalize();
 }
 
+bool isHiddenGlobal(const std::string& name)
+{
+    return name.compare(0, 5, "__cse") == 0;
+}
+
 std::string bytecodeToTxt(const Bytecode& bytecode)
 {
     std::string result = "--- Bytecode ---\n";
@@ -411,4 +494,157 @@ Bytecode txtToBytecode(const std::string& txt)
     }
     
     return bytecode;
-}
\ No newline at end of file
+}
+//-----------------------------------------------------------------------------
+// 二进制字节码
+//-----------------------------------------------------------------------------
+
+static const char kBinaryBytecodeMagic[4] = {'P', 'V', 'M', 'B'};
+
+enum class BinaryConstant : uint8_t { Monostate, Number, Bool, String, Series };
+
+template <typename T>
+static void appendPod(std::string& out, const T& value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void appendString(std::string& out, const std::string& value)
+{
+    appendPod(out, static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+// 从内存块中顺序读取，越界时抛出异常 (数据可能来自映射的文件，不保证对齐)
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    template <typename T>
+    T pod() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    std::string string() {
+        const uint32_t length = pod<uint32_t>();
+        return std::string(take(length), length);
+    }
+
+private:
+    const char* take(size_t n) {
+        if (n > size_ - offset_)
+            throw std::runtime_error("Binary bytecode is truncated.");
+        const char* p = data_ + offset_;
+        offset_ += n;
+        return p;
+    }
+
+    const char* data_;
+    size_t size_;
+    size_t offset_ = 0;
+};
+
+std::string bytecodeToBinary(const Bytecode& bytecode)
+{
+    std::string out(kBinaryBytecodeMagic, sizeof(kBinaryBytecodeMagic));
+    appendPod(out, kBinaryBytecodeVersion);
+    appendPod(out, _generateChecksum(bytecode));
+    appendPod(out, static_cast<int32_t>(bytecode.varNum));
+    appendPod(out, static_cast<uint32_t>(bytecode.instructions.size()));
+    appendPod(out, static_cast<uint32_t>(bytecode.constant_pool.size()));
+    appendPod(out, static_cast<uint32_t>(bytecode.global_name_pool.size()));
+
+    for (const auto& instr : bytecode.instructions) {
+        appendPod(out, static_cast<uint32_t>(instr.op));
+        appendPod(out, static_cast<int32_t>(instr.operand));
+    }
+    for (const auto& constant : bytecode.constant_pool) {
+        std::visit([&](auto&& arg) {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, std::monostate>) {
+                appendPod(out, BinaryConstant::Monostate);
+            } else if constexpr (std::is_same_v<T, double>) {
+                appendPod(out, BinaryConstant::Number);
+                appendPod(out, arg);
+            } else if constexpr (std::is_same_v<T, bool>) {
+                appendPod(out, BinaryConstant::Bool);
+                appendPod(out, static_cast<uint8_t>(arg));
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                appendPod(out, BinaryConstant::String);
+                appendString(out, arg);
+            } else if constexpr (std::is_same_v<T, std::shared_ptr<Series>>) {
+                // 与文本格式一样只保存序列名
+                appendPod(out, BinaryConstant::Series);
+                appendString(out, arg->name);
+            }
+        }, constant);
+    }
+    for (const auto& name : bytecode.global_name_pool) {
+        appendString(out, name);
+    }
+    return out;
+}
+
+Bytecode binaryToBytecode(const char* data, size_t size)
+{
+    BinaryReader reader(data, size);
+    if (size < sizeof(kBinaryBytecodeMagic) || !std::equal(kBinaryBytecodeMagic, kBinaryBytecodeMagic + sizeof(kBinaryBytecodeMagic), data)) {
+        throw std::runtime_error("Not a binary bytecode.");
+    }
+    reader.pod<uint32_t>(); // 魔数
+    const uint32_t version = reader.pod<uint32_t>();
+    if (version != kBinaryBytecodeVersion) {
+        throw std::runtime_error("Unsupported binary bytecode version: " + std::to_string(version));
+    }
+    const _checksum_t expected_checksum = reader.pod<uint32_t>();
+
+    Bytecode bytecode;
+    bytecode.varNum = reader.pod<int32_t>();
+    const uint32_t instruction_count = reader.pod<uint32_t>();
+    const uint32_t constant_count = reader.pod<uint32_t>();
+    const uint32_t global_count = reader.pod<uint32_t>();
+    if (instruction_count > size / 8) {
+        throw std::runtime_error("Binary bytecode is truncated.");
+    }
+
+    bytecode.instructions.resize(instruction_count);
+    for (auto& instr : bytecode.instructions) {
+        const uint32_t op = reader.pod<uint32_t>();
+        if (op > static_cast<uint32_t>(OpCode::HALT)) {
+            throw std::runtime_error("Unknown opcode in binary bytecode: " + std::to_string(op));
+        }
+        instr.op = static_cast<OpCode>(op);
+        instr.operand = reader.pod<int32_t>();
+    }
+    for (uint32_t i = 0; i < constant_count; ++i) {
+        switch (reader.pod<BinaryConstant>()) {
+            case BinaryConstant::Monostate: bytecode.constant_pool.push_back(std::monostate{}); break;
+            case BinaryConstant::Number:    bytecode.constant_pool.push_back(reader.pod<double>()); break;
+            case BinaryConstant::Bool:      bytecode.constant_pool.push_back(reader.pod<uint8_t>() != 0); break;
+            case BinaryConstant::String:    bytecode.constant_pool.push_back(reader.string()); break;
+            case BinaryConstant::Series: {
+                auto series = std::make_shared<Series>();
+                series->setName(reader.string());
+                bytecode.constant_pool.push_back(series);
+                break;
+            }
+            default:
+                throw std::runtime_error("Unknown constant type in binary bytecode.");
+        }
+    }
+    for (uint32_t i = 0; i < global_count; ++i) {
+        bytecode.global_name_pool.push_back(reader.string());
+    }
+
+    _checksum_t actual_checksum = _generateChecksum(bytecode);
+    if (actual_checksum != expected_checksum) {
+        std::stringstream error_msg;
+        error_msg << "Checksum mismatch! The binary bytecode is corrupted or has been tampered with.\n"
+                  << "Expected: " << expected_checksum << "\n"
+                  << "Actual:   " << actual_checksum;
+        throw std::runtime_error(error_msg.str());
+    }
+    return bytecode;
+}
@@ -8,6 +8,7 @@
 #include <functional>
 #include <stdexcept>
 #include <cmath> // for std::isnan, NAN
+#include <cstdint>
 
 //-----------------------------------------------------------------------------
 // 1. 数据结构 (Data Structures)
@@ -56,10 +57,53 @@ enum class OpCode {
 // ... 其余部分与原文件相同 ...
 struct Series : public std::enable_shared_from_this<Series> {
     std::string name;
+    // 无界时 data[i] 就是第 i 根 K 线的值；有界 (环形缓冲区) 时第 i 根存放在 data[i % capacity]
     std::vector<double> data;
-    double getCurrent(int bar_index); 
+    size_t capacity = 0;  // 0 表示无界
+    int length = 0;       // 有界时已写入的 K 线根数 (最大下标 + 1)
+
+    double getCurrent(int bar_index) const;
     void setCurrent(int bar_index, double value);
     void setName(const std::string& name);
+
+    /**
+     * @brief 改为只保留最近 capacity 根 K 线的环形缓冲区 (流式执行用)，已有数据保留最后 capacity 根。
+     *        只会增大已有的容量；capacity 为 0 时恢复为无界存储 (已被丢弃的历史读出为 NaN)。
+     */
+    void setCapacity(size_t capacity);
+    // 为无界序列预留到 bars 根，不足时至少翻倍，逐根写入时不再重新分配；有界序列不受影响
+    void reserve(int bars);
+    bool isBounded() const { return capacity != 0; }
+    // K 线根数 (包括已被环形缓冲区丢弃的部分)
+    int size() const { return capacity ? length : static_cast<int>(data.size()); }
+    // 仍可读取的最早 K 线下标
+    int firstIndex() const { return capacity && length > static_cast<int>(capacity) ? length - static_cast<int>(capacity) : 0; }
+};
+
+/**
+ * @brief 按缓存行对齐的一整块列存储，切分成若干等长的列，每列起点同样对齐。
+ *        容量不够时按几何倍数重新分配 (不保留内容)，release 一次性释放全部列。
+ */
+class ColumnArena {
+public:
+    static constexpr size_t kAlignment = 64; // 缓存行大小
+
+    ColumnArena() = default;
+    ~ColumnArena() { release(); }
+    ColumnArena(const ColumnArena&) = delete;
+    ColumnArena& operator=(const ColumnArena&) = delete;
+
+    // 保证至少有 columns 列、每列至少 length 个元素
+    void reserve(size_t columns, size_t length);
+    void release();
+    double* column(size_t index) { return base_ + index * stride_; }
+    size_t columns() const { return columns_; }
+    size_t stride() const { return stride_; }
+
+private:
+    double* base_ = nullptr;
+    size_t columns_ = 0;
+    size_t stride_ = 0; // 每列的元素个数，是缓存行的整数倍
 };
 
 using Value = std::variant<
@@ -82,10 +126,30 @@ struct Bytecode {
     int varNum = 0;
 };
 
+/**
+ * @brief 是否为优化器新增的隐藏全局变量 (__cseN，见 optimizeBytecode)。
+ *        隐藏全局变量只在 VM 内部传递公共子表达式的值，不出现在 getGlobalSeries 等对外结果中。
+ */
+bool isHiddenGlobal(const std::string& name);
+
 struct ExportedSeries {
     std::string name;
     std::string color;
 };
 
 std::string bytecodeToTxt(const Bytecode& bytecode);
-Bytecode txtToBytecode(const std::string& txt);
\ No newline at end of file
+Bytecode txtToBytecode(const std::string& txt);
+// 字节码的校验和 (32 位 FNV-1a)，即文本格式 Validation 段中的 Checksum
+uint32_t _generateChecksum(const Bytecode& bytecode);
+
+/**
+ * @brief 二进制字节码格式 (本机字节序)：魔数 "PVMB"、版本号、校验和 (与文本格式相同)，
+ *        之后依次是 varNum、指令、常量池和全局变量名。比文本格式紧凑，数值常量不丢失精度，
+ *        加载时不需要逐行解析，可以直接从内存映射的文件中读取 (见 BytecodeLibrary)。
+ */
+constexpr uint32_t kBinaryBytecodeVersion = 1;
+std::string bytecodeToBinary(const Bytecode& bytecode);
+/**
+ * @throws std::runtime_error 不是二进制字节码、版本不支持、数据不完整或校验和不符。
+ */
+Bytecode binaryToBytecode(const char* data, size_t size);
\ No newline at end of file
@@ -6,20 +6,20 @@
 #include <random>
 #include <chrono>
 
-void PineVM::registerBuiltinsHithink()
+void PineVM::registerBuiltinsHithink(std::map<std::string, BuiltinInfo>& built_in_funcs)
 { 
     /////////////////////////////////////////////////////////////////////////////////////////////
     //引用函数
     built_in_funcs["ama"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), A (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             double alpha = ctx.getArgAsNumeric(1);
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double current_source_val = source_series->getCurrent(current_bar);
+            double current_source_val = source_series.getCurrent(current_bar);
             double prev_ama = result_series->getCurrent(current_bar - 1);
 
             double ama_val;
@@ -34,125 +34,160 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0, 1).converging()
     };
 
     built_in_funcs["barscount"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             // BARSCOUNT 有效数据周期数
             // 有效数据周期数.
             // 用法:
             // BARSCOUNT(X)第一个有效数据到当前的间隔周期数
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
 
-            int count = 0;
-            for (int i = 0; i <= current_bar; ++i) {
-                double val = source_series->getCurrent(i);
-                if (!std::isnan(val)) {
-                    count++;
-                }
+            // 上一根的结果非零说明已经出现过有效数据，之后每根加一
+            double prev_count = result_series->getCurrent(current_bar - 1);
+            double count;
+            if (!std::isnan(prev_count) && prev_count > 0.0) {
+                count = prev_count + 1.0;
+            } else {
+                count = std::isnan(source_series.getCurrent(current_bar)) ? 0.0 : 1.0;
             }
-            result_series->setCurrent(current_bar, static_cast<double>(count));
+            result_series->setCurrent(current_bar, count);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0, 1)
     };
 
     built_in_funcs["barslast"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double barslast_val = NAN;
-            for (int i = 0; i <= current_bar; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
-                if (!std::isnan(val) && val != 0.0) {
-                    barslast_val = static_cast<double>(i);
-                    break;
-                }
+            // 条件成立时为 0，否则在上一根的基础上加一；从未成立时为 NaN
+            double val = condition_series.getCurrent(current_bar);
+            double barslast_val;
+            if (!std::isnan(val) && val != 0.0) {
+                barslast_val = 0.0;
+            } else {
+                barslast_val = result_series->getCurrent(current_bar - 1) + 1.0;
             }
             result_series->setCurrent(current_bar, barslast_val);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0, 1)
     };
 
     built_in_funcs["barslastcount"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            int count = 0;
-            for (int i = current_bar; i >= 0; --i) {
-                double val = condition_series->getCurrent(i);
-                if (!std::isnan(val) && val != 0.0) {
-                    count++;
-                } else {
-                    break;
-                }
+            // 连续成立的根数：成立时在上一根的基础上加一，不成立时归零
+            double val = condition_series.getCurrent(current_bar);
+            double count = 0.0;
+            if (!std::isnan(val) && val != 0.0) {
+                double prev_count = result_series->getCurrent(current_bar - 1);
+                count = std::isnan(prev_count) ? 1.0 : prev_count + 1.0;
             }
-            result_series->setCurrent(current_bar, static_cast<double>(count));
+            result_series->setCurrent(current_bar, count);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0, 1)
     };
 
     built_in_funcs["barssince"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            int bars_since = -1; // -1 表示从未发生
-            for (int i = 0; i <= current_bar; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
-                if (!std::isnan(val) && val != 0.0) {
-                    bars_since = i;
-                    break;
+            double val = condition_series.getCurrent(current_bar);
+            double bars_since = -1.0; // -1 表示从未发生
+            if (!std::isnan(val) && val != 0.0) {
+                bars_since = 0.0;
+            } else {
+                double prev = result_series->getCurrent(current_bar - 1);
+                if (!std::isnan(prev) && prev >= 0.0) {
+                    bars_since = prev + 1.0;
                 }
             }
-            result_series->setCurrent(current_bar, static_cast<double>(bars_since));
+            result_series->setCurrent(current_bar, bars_since);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0, 1)
     };
 
     built_in_funcs["barssincen"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), N (numeric)
-            auto condition_series = ctx.getArgAsSeries(0);
-            int length = static_cast<int>(ctx.getArgAsNumeric(1));
+            Series &condition_series = ctx.getArgSeries(0);
+            int length = std::max(1, static_cast<int>(ctx.getArgAsNumeric(1)));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            int bars_since = -1;
+            // 状态：最近 N 次成立中最早一次的K线下标 (不足 N 次时为第一次成立)，以及已成立的次数 (最多记到 N)。
+            // 新的一次成立使第 N 次向后移到下一次成立处，下标只增不减，向前查找的总开销与K线数成正比。
+            Series &first_state = ctx.getStateSeries("barssincen.first");
+            Series &count_state = ctx.getStateSeries("barssincen.count");
+            Series &length_state = ctx.getStateSeries("barssincen.length");
+            auto is_true = [&](int i) {
+                double val = condition_series.getCurrent(i);
+                return !std::isnan(val) && val != 0.0;
+            };
+
+            int first = -1;
             int count = 0;
-            for (int i = 0; i <= current_bar; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
-                if (!std::isnan(val) && val != 0.0) {
-                    bars_since = i;
-                    count++;
-                    if (count >= length) {
-                        break;
+            double prev_count = count_state.getCurrent(current_bar - 1);
+            if (current_bar > 0 && (std::isnan(prev_count) || length_state.getCurrent(current_bar - 1) != length)) {
+                // 上一根的状态不可用或 N 改变：向前扫描重建
+                for (int i = current_bar - 1; i >= 0 && count < length; --i) {
+                    if (is_true(i)) {
+                        first = i;
+                        count++;
                     }
                 }
+            } else if (current_bar > 0) {
+                count = static_cast<int>(prev_count);
+                first = count > 0 ? static_cast<int>(first_state.getCurrent(current_bar - 1)) : -1;
+            }
+
+            if (is_true(current_bar)) {
+                if (count == 0) {
+                    first = current_bar;
+                }
+                if (count < length) {
+                    count++;
+                } else {
+                    do {
+                        first++;
+                    } while (!is_true(first));
+                }
             }
-            result_series->setCurrent(current_bar, static_cast<double>(bars_since));
+            first_state.setCurrent(current_bar, first);
+            count_state.setCurrent(current_bar, count);
+            length_state.setCurrent(current_bar, length);
+            result_series->setCurrent(current_bar, first < 0 ? -1.0 : static_cast<double>(current_bar - first));
             return result_series;
         },
         .min_args = 2,
@@ -162,25 +197,23 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["barsstatus"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: COND (series)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            int count = 0;
-            for (int i = current_bar; i >= 0; --i) {
-                double val = condition_series->getCurrent(i);
-                if (!std::isnan(val) && val != 0.0) {
-                    count++;
-                } else {
-                    break;
-                }
+            double val = condition_series.getCurrent(current_bar);
+            double count = 0.0;
+            if (!std::isnan(val) && val != 0.0) {
+                double prev_count = result_series->getCurrent(current_bar - 1);
+                count = std::isnan(prev_count) ? 1.0 : prev_count + 1.0;
             }
-            result_series->setCurrent(current_bar, static_cast<double>(count));
+            result_series->setCurrent(current_bar, count);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0, 1)
     };
     
     built_in_funcs["const"] = {
@@ -188,37 +221,33 @@ void PineVM::registerBuiltinsHithink()
             // Args: X (numeric)
             double dval = ctx.getArgAsNumeric(0);
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             result_series->setCurrent(current_bar, dval);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
 
     built_in_funcs["count"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), N (numeric)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            int count = 0;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
-                if (!std::isnan(val) && val != 0.0) {
-                    count++;
-                }
-            }
-            result_series->setCurrent(current_bar, static_cast<double>(count));
+            auto window = ctx.windowSum(condition_series, length, true);
+            result_series->setCurrent(current_bar, window.sum);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["currbarscount"] = {
@@ -233,13 +262,13 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["dma"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), A (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             double alpha = ctx.getArgAsNumeric(1);
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double current_source_val = source_series->getCurrent(current_bar);
+            double current_source_val = source_series.getCurrent(current_bar);
             double prev_dma = result_series->getCurrent(current_bar - 1);
 
             double dma_val;
@@ -254,19 +283,20 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0, 1).converging()
     };
 
     built_in_funcs["ema"] = built_in_funcs["expma"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), N (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double current_source_val = source_series->getCurrent(current_bar);
+            double current_source_val = source_series.getCurrent(current_bar);
             double prev_ema = result_series->getCurrent(current_bar - 1);
 
             double ema_val;
@@ -281,23 +311,24 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0, 1).converging()
     };
 
     built_in_funcs["expmema"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), N (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             double expmema_val;
             if (current_bar < length - 1) {
                 expmema_val = NAN;
             } else {
-                double current_source_val = source_series->getCurrent(current_bar);
+                double current_source_val = source_series.getCurrent(current_bar);
                 double prev_expmema = result_series->getCurrent(current_bar - 1);
 
                 if (std::isnan(current_source_val)) {
@@ -306,7 +337,7 @@ void PineVM::registerBuiltinsHithink()
                     double sum = 0.0;
                     int count = 0;
                     for (int i = 0; i < length; ++i) {
-                        double val = source_series->getCurrent(current_bar - i);
+                        double val = source_series.getCurrent(current_bar - i);
                         if (!std::isnan(val)) {
                             sum += val;
                             count++;
@@ -321,16 +352,17 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1, 1).converging()
     };
 
     built_in_funcs["filter"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: COND (series), N (numeric)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             bool any_true = false;
@@ -344,7 +376,7 @@ void PineVM::registerBuiltinsHithink()
             if (any_true)
                 result_series->setCurrent(current_bar, static_cast<double>(false));
             else
-                result_series->setCurrent(current_bar, condition_series->getCurrent(current_bar));
+                result_series->setCurrent(current_bar, condition_series.getCurrent(current_bar));
             return result_series;
         },
         .min_args = 2,
@@ -354,12 +386,12 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["findhigh"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: VAR (series), N, M, T (numeric)
-            auto var_series = ctx.getArgAsSeries(0);
+            Series &var_series = ctx.getArgSeries(0);
             int N = static_cast<int>(ctx.getArgAsNumeric(1));
             int M = static_cast<int>(ctx.getArgAsNumeric(2));
             int T = static_cast<int>(ctx.getArgAsNumeric(3));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             int start_idx = current_bar - N - M + 1;
@@ -369,7 +401,7 @@ void PineVM::registerBuiltinsHithink()
             std::vector<double> values_in_range;
             for (int i = start_idx; i <= end_idx; ++i) {
                 if (i >= 0) {
-                    double val = var_series->getCurrent(i);
+                    double val = var_series.getCurrent(i);
                     if (!std::isnan(val)) values_in_range.push_back(val);
                 }
             }
@@ -389,12 +421,12 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["findhighbars"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: VAR (series), N, M, T (numeric)
-            auto var_series = ctx.getArgAsSeries(0);
+            Series &var_series = ctx.getArgSeries(0);
             int N = static_cast<int>(ctx.getArgAsNumeric(1));
             int M = static_cast<int>(ctx.getArgAsNumeric(2));
             int T = static_cast<int>(ctx.getArgAsNumeric(3));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             int start_idx = current_bar - N - M + 1;
@@ -404,7 +436,7 @@ void PineVM::registerBuiltinsHithink()
             std::vector<std::pair<double, int>> values_with_indices;
             for (int i = start_idx; i <= end_idx; ++i) {
                 if (i >= 0) {
-                    double val = var_series->getCurrent(i);
+                    double val = var_series.getCurrent(i);
                     if (!std::isnan(val)) values_with_indices.push_back({val, i});
                 }
             }
@@ -429,12 +461,12 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["findlow"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: VAR (series), N, M, T (numeric)
-            auto var_series = ctx.getArgAsSeries(0);
+            Series &var_series = ctx.getArgSeries(0);
             int N = static_cast<int>(ctx.getArgAsNumeric(1));
             int M = static_cast<int>(ctx.getArgAsNumeric(2));
             int T = static_cast<int>(ctx.getArgAsNumeric(3));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             int start_idx = current_bar - N - M + 1;
@@ -444,7 +476,7 @@ void PineVM::registerBuiltinsHithink()
             std::vector<double> values_in_range;
             for (int i = start_idx; i <= end_idx; ++i) {
                 if (i >= 0) {
-                    double val = var_series->getCurrent(i);
+                    double val = var_series.getCurrent(i);
                     if (!std::isnan(val)) values_in_range.push_back(val);
                 }
             }
@@ -464,12 +496,12 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["findlowbars"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: VAR (series), N, M, T (numeric)
-            auto var_series = ctx.getArgAsSeries(0);
+            Series &var_series = ctx.getArgSeries(0);
             int N = static_cast<int>(ctx.getArgAsNumeric(1));
             int M = static_cast<int>(ctx.getArgAsNumeric(2));
             int T = static_cast<int>(ctx.getArgAsNumeric(3));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             int start_idx = current_bar - N - M + 1;
@@ -479,7 +511,7 @@ void PineVM::registerBuiltinsHithink()
             std::vector<std::pair<double, int>> values_with_indices;
             for (int i = start_idx; i <= end_idx; ++i) {
                 if (i >= 0) {
-                    double val = var_series->getCurrent(i);
+                    double val = var_series.getCurrent(i);
                     if (!std::isnan(val)) values_with_indices.push_back({val, i});
                 }
             }
@@ -504,108 +536,81 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["hhv"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double highest_val = NAN;
-            bool first = true;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    if (first) {
-                        highest_val = val;
-                        first = false;
-                    } else {
-                        highest_val = std::max(highest_val, val);
-                    }
-                }
-            }
+            // 相等时取最近的一根，与 std::max 从当前根往前扫描一致
+            int highest_idx = ctx.windowExtreme(source_series, length, true, false);
+            double highest_val = highest_idx < 0 ? NAN : source_series.getCurrent(highest_idx);
             result_series->setCurrent(current_bar, highest_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
 
     built_in_funcs["hv"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double highest_val = NAN;
-            bool first = true;
-            for (int i = 1; i < length + 1 && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    if (first) { highest_val = val; first = false; }
-                    else { highest_val = std::max(highest_val, val); }
-                }
-            }
+            int highest_idx = ctx.windowExtreme(source_series, length, true, false, 1);
+            double highest_val = highest_idx < 0 ? NAN : source_series.getCurrent(highest_idx);
             result_series->setCurrent(current_bar, highest_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["hhvbars"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double highest_val = NAN;
-            int highest_idx = -1;
-            bool first = true;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    if (first) {
-                        highest_val = val;
-                        highest_idx = i;
-                        first = false;
-                    } else if (val >= highest_val) {
-                        highest_val = val;
-                        highest_idx = i;
-                    }
-                }
-            }
-            result_series->setCurrent(current_bar, static_cast<double>(highest_idx));
+            // 相等时取最早的一根
+            int highest_idx = ctx.windowExtreme(source_series, length, true, true);
+            result_series->setCurrent(current_bar, highest_idx < 0 ? -1.0 : static_cast<double>(current_bar - highest_idx));
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
 
     built_in_funcs["hod"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), offset (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int offset = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double hod_val = source_series->getCurrent(current_bar - offset);
+            double hod_val = source_series.getCurrent(current_bar - offset);
             result_series->setCurrent(current_bar, hod_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["islastbar"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             int total_bars = ctx.getVM().getTotalBars();
 
@@ -619,159 +624,126 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["llv"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double lowest_val = NAN;
-            bool first = true;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    if (first) {
-                        lowest_val = val;
-                        first = false;
-                    } else {
-                        lowest_val = std::min(lowest_val, val);
-                    }
-                }
-            }
+            // 相等时取最近的一根，与 std::min 从当前根往前扫描一致
+            int lowest_idx = ctx.windowExtreme(source_series, length, false, false);
+            double lowest_val = lowest_idx < 0 ? NAN : source_series.getCurrent(lowest_idx);
             result_series->setCurrent(current_bar, lowest_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
 
     built_in_funcs["lv"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double lowest_val = NAN;
-            bool first = true;
-            for (int i = 1; i < length + 1 && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    if (first) { lowest_val = val; first = false; }
-                    else { lowest_val = std::min(lowest_val, val); }
-                }
-            }
+            int lowest_idx = ctx.windowExtreme(source_series, length, false, false, 1);
+            double lowest_val = lowest_idx < 0 ? NAN : source_series.getCurrent(lowest_idx);
             result_series->setCurrent(current_bar, lowest_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["llvbars"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double lowest_val = NAN;
-            int lowest_idx = -1;
-            bool first = true;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    if (first) {
-                        lowest_val = val;
-                        lowest_idx = i;
-                        first = false;
-                    } else if (val <= lowest_val) {
-                        lowest_val = val;
-                        lowest_idx = i;
-                    }
-                }
-            }
-            result_series->setCurrent(current_bar, static_cast<double>(lowest_idx));
+            // 相等时取最早的一根
+            int lowest_idx = ctx.windowExtreme(source_series, length, false, true);
+            result_series->setCurrent(current_bar, lowest_idx < 0 ? -1.0 : static_cast<double>(current_bar - lowest_idx));
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
     
     built_in_funcs["lod"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), offset (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int offset = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double lod_val = source_series->getCurrent(current_bar - offset);
+            double lod_val = source_series.getCurrent(current_bar - offset);
             result_series->setCurrent(current_bar, lod_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["lowrange"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), offset (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int offset = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double low_val = source_series->getCurrent(current_bar - offset);
+            double low_val = source_series.getCurrent(current_bar - offset);
             result_series->setCurrent(current_bar, low_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["ma"] = 
     built_in_funcs["average"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double sum = 0.0;
-            int count = 0;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    sum += val;
-                    count++;
-                }
-            }
-            double ma_val = (count == length) ? sum / count : NAN;
+            auto window = ctx.windowSum(source_series, length);
+            double ma_val = (window.valid == length) ? window.sum / window.valid : NAN;
             result_series->setCurrent(current_bar, ma_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["mema"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double current_source_val = source_series->getCurrent(current_bar);
+            double current_source_val = source_series.getCurrent(current_bar);
             double prev_mema = result_series->getCurrent(current_bar - 1);
 
             double mema_val;
@@ -782,7 +754,7 @@ void PineVM::registerBuiltinsHithink()
                 double sum = 0.0;
                 int count = 0;
                 for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                    double val = source_series->getCurrent(current_bar - i);
+                    double val = source_series.getCurrent(current_bar - i);
                     if(!std::isnan(val)) { sum += val; count++; }
                 }
                 mema_val = (count == length) ? sum / length : NAN;
@@ -793,16 +765,17 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1, 1).converging()
     };
 
     built_in_funcs["mular"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             double product = 1.0;
@@ -811,7 +784,7 @@ void PineVM::registerBuiltinsHithink()
 
             for (int i = start_bar; i <= current_bar; ++i) {
                 if (i < 0) { has_nan = true; break; }
-                double val = source_series->getCurrent(i);
+                double val = source_series.getCurrent(i);
                 if (std::isnan(val)) { has_nan = true; break; }
                 product *= val;
             }
@@ -830,7 +803,7 @@ void PineVM::registerBuiltinsHithink()
             double B = ctx.getArgAsNumeric(1);
             double C = ctx.getArgAsNumeric(2);
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             double range_val = (A > B && A < C) ? 1.0 : 0.0;
@@ -838,24 +811,26 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 3,
-        .max_args = 3
+        .max_args = 3,
+        .lookback = Lookback::fixed(0)
     };
 
     built_in_funcs["ref"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), offset (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int offset = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double ref_val = source_series->getCurrent(current_bar - offset);
+            double ref_val = source_series.getCurrent(current_bar - offset);
             result_series->setCurrent(current_bar, ref_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["refdate"] = {
@@ -871,127 +846,108 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["refv"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), offset (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int offset = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double ref_val = source_series->getCurrent(current_bar - offset);
+            double ref_val = source_series.getCurrent(current_bar - offset);
             result_series->setCurrent(current_bar, ref_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["reverse"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double reversed_val = source_series->getCurrent(current_bar);
+            double reversed_val = source_series.getCurrent(current_bar);
             result_series->setCurrent(current_bar, reversed_val);
             return result_series;
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
 
     built_in_funcs["sma"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: X (series), N (numeric), M (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             // double weight = ctx.getArgAsNumeric(2); // weight is ignored in original implementation
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double sum = 0.0;
-            int count = 0;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    sum += val;
-                    count++;
-                }
-            }
-            double sma_val = (count == length) ? sum / count : NAN;
+            auto window = ctx.windowSum(source_series, length);
+            double sma_val = (window.valid == length) ? window.sum / window.valid : NAN;
             result_series->setCurrent(current_bar, sma_val);
             return result_series;
         },
         .min_args = 3,
-        .max_args = 3
+        .max_args = 3,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["sum"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double sum = 0.0;
-            int count = 0;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    sum += val;
-                    count++;
-                }
-            }
-            double sum_val = (count == length) ? sum : NAN;
+            auto window = ctx.windowSum(source_series, length);
+            double sum_val = (window.valid == length) ? window.sum : NAN;
             result_series->setCurrent(current_bar, sum_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["sumbars"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double sum = 0.0;
-            int count = 0;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) {
-                    sum += val;
-                    count++;
-                }
-            }
-            double sum_val = (count == length) ? sum : NAN;
+            auto window = ctx.windowSum(source_series, length);
+            double sum_val = (window.valid == length) ? window.sum : NAN;
             result_series->setCurrent(current_bar, sum_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["tfilt"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: COND (series), N (numeric)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             bool all_true = true;
             for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
+                double val = condition_series.getCurrent(current_bar - i);
                 if (std::isnan(val) || val == 0.0) {
                     all_true = false;
                     break;
@@ -1001,21 +957,22 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
     
     built_in_funcs["tfilter"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: COND (series), N (numeric)
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             bool any_true = false;
             for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
+                double val = condition_series.getCurrent(current_bar - i);
                 if (!std::isnan(val) && val != 0.0) {
                     any_true = true;
                     break;
@@ -1025,16 +982,17 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
     
     built_in_funcs["tma"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             double tma_val = NAN;
@@ -1045,7 +1003,7 @@ void PineVM::registerBuiltinsHithink()
                     double inner_sum = 0.0;
                     int inner_count = 0;
                     for (int j = 0; j < length; ++j) {
-                        double val = source_series->getCurrent(current_bar - i - j);
+                        double val = source_series.getCurrent(current_bar - i - j);
                         if (!std::isnan(val)) {
                             inner_sum += val;
                             inner_count++;
@@ -1081,7 +1039,7 @@ void PineVM::registerBuiltinsHithink()
     
     built_in_funcs["totalbarscount"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             int total_bars = ctx.getVM().getTotalBars();
 
@@ -1095,10 +1053,10 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["wma"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             double wma_val = NAN;
@@ -1107,7 +1065,7 @@ void PineVM::registerBuiltinsHithink()
                 double sum_weights = 0.0;
                 bool has_nan = false;
                 for (int i = 0; i < length; ++i) {
-                    double val = source_series->getCurrent(current_bar - i);
+                    double val = source_series.getCurrent(current_bar - i);
                     if (std::isnan(val)) { has_nan = true; break; }
                     double weight = length - i;
                     sum_weighted_values += val * weight;
@@ -1121,19 +1079,20 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
     
     built_in_funcs["xma"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: source (series), length (numeric)
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double current_source_val = source_series->getCurrent(current_bar);
+            double current_source_val = source_series.getCurrent(current_bar);
             double prev_xma = result_series->getCurrent(current_bar - 1);
 
             double xma_val;
@@ -1148,7 +1107,8 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0, 1).converging()
     };
     
     // ... (rest of the functions follow the same pattern)
@@ -1157,7 +1117,7 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["cost"] = {
         .function = [](FunctionContext &ctx) -> Value {
             // Args: (optional) X (numeric)
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             PineVM& vm = ctx.getVM();
 
@@ -1174,7 +1134,8 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 0,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["costex"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 0, .max_args = 2 }; // placeholder
     built_in_funcs["lfs"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 0, .max_args = 0 }; // placeholder
@@ -1194,7 +1155,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["acos"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1203,7 +1165,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["asin"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1212,7 +1175,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["atan"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1221,7 +1185,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["between"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1234,7 +1199,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 3,
-        .max_args = 3
+        .max_args = 3,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["ceiling"] = built_in_funcs["ceil"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1243,7 +1209,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["cos"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1252,7 +1219,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["exp"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1261,7 +1229,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["floor"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1270,7 +1239,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["facepart"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1279,7 +1249,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["intpart"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1289,7 +1260,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["ln"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1298,7 +1270,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["log"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1307,7 +1280,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["max"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1318,7 +1292,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["min"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1329,7 +1304,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["mod"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1341,7 +1317,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["pow"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1351,16 +1328,20 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["rand"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            double random_value = static_cast<double>(rand()) / RAND_MAX;
+            // 使用 VM 自己的随机数引擎，不再共享全局的 rand() 状态 (多个 VM 可以并行执行)
+            std::uniform_real_distribution<double> distribution(0.0, 1.0);
+            double random_value = distribution(ctx.getVM().random_engine);
             ctx.getResultSeries()->setCurrent(ctx.getCurrentBarIndex(), random_value);
             return ctx.getResultSeries();
         },
         .min_args = 0,
-        .max_args = 0
+        .max_args = 0,
+        .pure = false // 每次调用结果不同
     };
     built_in_funcs["round"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1379,7 +1360,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["round2"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1394,7 +1376,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["sign"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1404,7 +1387,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["sin"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1413,7 +1397,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["sqrt"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1422,7 +1407,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["tan"] = {
         .function = [](FunctionContext &ctx) -> Value {
@@ -1431,7 +1417,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     //时间函数
 
@@ -1440,7 +1427,7 @@ void PineVM::registerBuiltinsHithink()
     //选择函数
     built_in_funcs["if"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            bool condition = ctx.getVM().getBoolValue(ctx.getArg(0));
+            bool condition = ctx.getArgAsBool(0);
             double true_val = ctx.getArgAsNumeric(1);
             double false_val = ctx.getArgAsNumeric(2);
             
@@ -1449,7 +1436,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 3,
-        .max_args = 3
+        .max_args = 3,
+        .lookback = Lookback::fixed(0)
     };
     built_in_funcs["ifc"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 3, .max_args = 3 }; // placeholder
     built_in_funcs["iff"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 3, .max_args = 3 }; // placeholder
@@ -1457,10 +1445,10 @@ void PineVM::registerBuiltinsHithink()
     built_in_funcs["testskip"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 1, .max_args = 1 }; // placeholder
     built_in_funcs["valuewhen"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            bool condition = ctx.getVM().getBoolValue(ctx.getArg(0));
-            double source_val = ctx.getVM().getNumericValue(ctx.getArg(1));
+            bool condition = ctx.getArgAsBool(0);
+            double source_val = ctx.getArgAsNumeric(1);
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             double result_val;
@@ -1473,282 +1461,284 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(0, 1)
     };
 
     //统计函数
     built_in_funcs["avedev"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            std::vector<double> values;
-            for(int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) values.push_back(val);
-            }
+            double avedev_val = ctx.windowMeanAbsDeviation(source_series, length);
+            result_series->setCurrent(current_bar, avedev_val);
+            return result_series;
+        },
+        .min_args = 2,
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
+    };
+    built_in_funcs["beta"] = {
+        .function = [](FunctionContext &ctx) -> Value {
+            // Args: X (series, 基准如大盘指数), N (numeric)
+            // BETA(X,N): 本品种收盘价相对 X 的 N 周期贝塔系数，即 BETAX(CLOSE,X,N)
+            Series &benchmark_series = ctx.getArgSeries(0);
+            int length = static_cast<int>(ctx.getArgAsNumeric(1));
+
+            const auto &result_series = ctx.getResultSeries();
+            int current_bar = ctx.getCurrentBarIndex();
 
-            double avedev_val = NAN;
-            if (values.size() > 0) {
-                double sum = std::accumulate(values.begin(), values.end(), 0.0);
-                double mean = sum / values.size();
-                double sum_dev = 0.0;
-                for (double val : values) {
-                    sum_dev += std::abs(val - mean);
+            // 收盘价由 VM 作为隐式的第三个参数传入 (implicit_input)
+            Series *close_series = ctx.getArgSeriesOrNull(2);
+            double beta_val = NAN;
+            if (close_series) {
+                auto regression = ctx.windowRegression(&benchmark_series, *close_series, length, FunctionContext::PairSource::Returns);
+                if (regression.valid == length && regression.valid > 1 && regression.sxx > 0.0) {
+                    beta_val = regression.sxy / regression.sxx;
                 }
-                avedev_val = sum_dev / values.size();
             }
-            result_series->setCurrent(current_bar, avedev_val);
+            result_series->setCurrent(current_bar, beta_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 1),
+        .implicit_input = "close"
+    };
+
+    built_in_funcs["betax"] = {
+        .function = [](FunctionContext &ctx) -> Value {
+            // Args: X (series), Y (series), N (numeric)
+            // BETAX(X,Y,N): X 相对 Y 的 N 周期相关放大系数，Y 涨 1% 时 X 平均涨 BETAX%：Cov(X 涨幅, Y 涨幅) / Var(Y 涨幅)
+            Series &source_series = ctx.getArgSeries(0);
+            Series &benchmark_series = ctx.getArgSeries(1);
+            int length = static_cast<int>(ctx.getArgAsNumeric(2));
+
+            const auto &result_series = ctx.getResultSeries();
+            int current_bar = ctx.getCurrentBarIndex();
+
+            auto regression = ctx.windowRegression(&benchmark_series, source_series, length, FunctionContext::PairSource::Returns);
+            double betax_val = NAN;
+            if (regression.valid == length && regression.valid > 1 && regression.sxx > 0.0) {
+                betax_val = regression.sxy / regression.sxx;
+            }
+            result_series->setCurrent(current_bar, betax_val);
+            return result_series;
+        },
+        .min_args = 3,
+        .max_args = 3,
+        .lookback = Lookback::window(2, 1)
     };
-    built_in_funcs["beta"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 2, .max_args = 2 }; // placeholder
-    built_in_funcs["betax"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 3, .max_args = 3 }; // placeholder
 
     built_in_funcs["covar"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source1_series = ctx.getArgAsSeries(0);
-            auto source2_series = ctx.getArgAsSeries(1);
+            Series &source1_series = ctx.getArgSeries(0);
+            Series &source2_series = ctx.getArgSeries(1);
             int length = static_cast<int>(ctx.getArgAsNumeric(2));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            double sum_x = 0.0, sum_y = 0.0, sum_xy = 0.0;
-            int count = 0;
-            for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double x = source1_series->getCurrent(current_bar - i);
-                double y = source2_series->getCurrent(current_bar - i);
-                if (!std::isnan(x) && !std::isnan(y)) {
-                    sum_x += x;
-                    sum_y += y;
-                    sum_xy += (x * y);
-                    count++;
-                }
-            }
-
+            auto regression = ctx.windowRegression(&source1_series, source2_series, length, FunctionContext::PairSource::Values);
             double covar_val = NAN;
-            if (count == length && count > 1) {
-                double mean_x = sum_x / count;
-                double mean_y = sum_y / count;
-                covar_val = (sum_xy - count * mean_x * mean_y) / (count - 1);
+            if (regression.valid == length && regression.valid > 1) {
+                covar_val = regression.sxy / (regression.valid - 1);
             }
             result_series->setCurrent(current_bar, covar_val);
             return result_series;
         },
         .min_args = 3,
-        .max_args = 3
+        .max_args = 3,
+        .lookback = Lookback::window(2, 0)
     };
 
     built_in_funcs["devsq"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            std::vector<double> values;
-            for(int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) values.push_back(val);
-            }
-            
-            double devsq_val = NAN;
-            if (values.size() > 0) {
-                double sum = std::accumulate(values.begin(), values.end(), 0.0);
-                double mean = sum / values.size();
-                double sum_sq_dev = 0.0;
-                for (double val : values) {
-                    sum_sq_dev += std::pow(val - mean, 2);
-                }
-                devsq_val = sum_sq_dev;
-            }
+            auto moments = ctx.windowMoments(source_series, length);
+            double devsq_val = moments.valid > 0 ? moments.sum_sq_dev : NAN;
             result_series->setCurrent(current_bar, devsq_val);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
+    };
+
+    built_in_funcs["forcast"] = {
+        .function = [](FunctionContext &ctx) -> Value {
+            // Args: X (series), N (numeric)
+            // FORCAST(X,N): X 的 N 周期线性回归在当前根的预测值
+            Series &source_series = ctx.getArgSeries(0);
+            int length = static_cast<int>(ctx.getArgAsNumeric(1));
+
+            const auto &result_series = ctx.getResultSeries();
+            int current_bar = ctx.getCurrentBarIndex();
+
+            auto regression = ctx.windowRegression(nullptr, source_series, length, FunctionContext::PairSource::Time);
+            double forcast_val = NAN;
+            if (regression.valid == length && regression.valid > 1 && regression.sxx > 0.0) {
+                double slope = regression.sxy / regression.sxx;
+                forcast_val = regression.mean_y + slope * (current_bar - regression.mean_x);
+            }
+            result_series->setCurrent(current_bar, forcast_val);
+            return result_series;
+        },
+        .min_args = 2,
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
-    built_in_funcs["forcast"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 2, .max_args = 2 }; // placeholder
-    built_in_funcs["relate"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 3, .max_args = 3 }; // placeholder
+    built_in_funcs["relate"] = {
+        .function = [](FunctionContext &ctx) -> Value {
+            // Args: X (series), Y (series), N (numeric)
+            // RELATE(X,Y,N): X 与 Y 的 N 周期相关系数
+            Series &source1_series = ctx.getArgSeries(0);
+            Series &source2_series = ctx.getArgSeries(1);
+            int length = static_cast<int>(ctx.getArgAsNumeric(2));
+
+            const auto &result_series = ctx.getResultSeries();
+            int current_bar = ctx.getCurrentBarIndex();
+
+            auto regression = ctx.windowRegression(&source1_series, source2_series, length, FunctionContext::PairSource::Values);
+            double relate_val = NAN;
+            if (regression.valid == length && regression.valid > 1 && regression.sxx > 0.0 && regression.syy > 0.0) {
+                relate_val = regression.sxy / std::sqrt(regression.sxx * regression.syy);
+            }
+            result_series->setCurrent(current_bar, relate_val);
+            return result_series;
+        },
+        .min_args = 3,
+        .max_args = 3,
+        .lookback = Lookback::window(2, 0)
+    };
     
     built_in_funcs["slope"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            if (current_bar < length - 1) {
-                result_series->setCurrent(current_bar, NAN);
-            } else {
-                double sum_x = 0, sum_y = 0, sum_xy = 0, sum_x2 = 0;
-                int n = 0;
-                for (int i = 0; i < length; ++i) {
-                    double y = source_series->getCurrent(current_bar - i);
-                    if (!std::isnan(y)) {
-                        double x = length - 1 - i; // x = 0, 1, ..., length-1
-                        sum_x += x;
-                        sum_y += y;
-                        sum_xy += x * y;
-                        sum_x2 += x * x;
-                        n++;
-                    }
-                }
-                if (n == length && n > 1) {
-                    double denominator = n * sum_x2 - sum_x * sum_x;
-                    double slope = (denominator == 0) ? NAN : (n * sum_xy - sum_x * sum_y) / denominator;
-                    result_series->setCurrent(current_bar, slope);
-                } else {
-                    result_series->setCurrent(current_bar, NAN);
-                }
+            auto regression = ctx.windowRegression(nullptr, source_series, length, FunctionContext::PairSource::Time);
+            double slope = NAN;
+            if (regression.valid == length && regression.valid > 1 && regression.sxx > 0.0) {
+                slope = regression.sxy / regression.sxx;
             }
+            result_series->setCurrent(current_bar, slope);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["stddev"] = built_in_funcs["std"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            std::vector<double> values;
-            for(int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) values.push_back(val);
-            }
-
+            auto moments = ctx.windowMoments(source_series, length);
             double std_dev = NAN;
-            if (values.size() > 1 && values.size() == length) {
-                double sum = std::accumulate(values.begin(), values.end(), 0.0);
-                double mean = sum / values.size();
-                double sq_sum = 0.0;
-                for(const auto& d : values) sq_sum += (d - mean) * (d - mean);
-                std_dev = std::sqrt(sq_sum / (values.size() - 1)); // Sample standard deviation
+            if (moments.valid > 1 && moments.valid == length) {
+                std_dev = std::sqrt(moments.sum_sq_dev / (moments.valid - 1)); // Sample standard deviation
             }
             result_series->setCurrent(current_bar, std_dev);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
 
     built_in_funcs["stdp"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            std::vector<double> values;
-            for(int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) values.push_back(val);
-            }
-
+            auto moments = ctx.windowMoments(source_series, length);
             double std_dev_p = NAN;
-            if (values.size() > 0 && values.size() == length) {
-                double sum = std::accumulate(values.begin(), values.end(), 0.0);
-                double mean = sum / values.size();
-                double sq_sum = 0.0;
-                for(const auto& d : values) sq_sum += (d - mean) * (d - mean);
-                std_dev_p = std::sqrt(sq_sum / values.size()); // Population standard deviation
+            if (moments.valid > 0 && moments.valid == length) {
+                std_dev_p = std::sqrt(moments.sum_sq_dev / moments.valid); // Population standard deviation
             }
             result_series->setCurrent(current_bar, std_dev_p);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["var"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            std::vector<double> values;
-            for(int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) values.push_back(val);
-            }
-
+            auto moments = ctx.windowMoments(source_series, length);
             double variance = NAN;
-            if (values.size() > 1 && values.size() == length) {
-                double sum = std::accumulate(values.begin(), values.end(), 0.0);
-                double mean = sum / values.size();
-                double sq_sum = 0.0;
-                for(const auto& d : values) sq_sum += (d - mean) * (d - mean);
-                variance = sq_sum / (values.size() - 1); // Sample variance
+            if (moments.valid > 1 && moments.valid == length) {
+                variance = moments.sum_sq_dev / (moments.valid - 1); // Sample variance
             }
             result_series->setCurrent(current_bar, variance);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     
     built_in_funcs["varp"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto source_series = ctx.getArgAsSeries(0);
+            Series &source_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
 
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
-            std::vector<double> values;
-            for(int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = source_series->getCurrent(current_bar - i);
-                if (!std::isnan(val)) values.push_back(val);
-            }
-
+            auto moments = ctx.windowMoments(source_series, length);
             double variance_p = NAN;
-            if (values.size() > 0 && values.size() == length) {
-                double sum = std::accumulate(values.begin(), values.end(), 0.0);
-                double mean = sum / values.size();
-                double sq_sum = 0.0;
-                for(const auto& d : values) sq_sum += (d - mean) * (d - mean);
-                variance_p = sq_sum / values.size(); // Population variance
+            if (moments.valid > 0 && moments.valid == length) {
+                variance_p = moments.sum_sq_dev / moments.valid; // Population variance
             }
             result_series->setCurrent(current_bar, variance_p);
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, 0)
     };
     //逻辑函数
     built_in_funcs["cross"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            Value val1 = ctx.getArg(0);
-            Value val2 = ctx.getArg(1);
-            
-            auto& vm = ctx.getVM();
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double dval1 = vm.getNumericValue(val1);
-            double dval2 = vm.getNumericValue(val2);
+            double dval1 = ctx.getArgAsNumeric(0);
+            double dval2 = ctx.getArgAsNumeric(1);
 
-            auto *p1 = std::get_if<std::shared_ptr<Series>>(&val1);
-            double prev_dval1 = (p1 && *p1) ? (*p1)->getCurrent(current_bar - 1) : dval1;
-            auto *p2 = std::get_if<std::shared_ptr<Series>>(&val2);
-            double prev_dval2 = (p2 && *p2) ? (*p2)->getCurrent(current_bar - 1) : dval2;
+            Series *p1 = ctx.getArgSeriesOrNull(0);
+            double prev_dval1 = p1 ? p1->getCurrent(current_bar - 1) : dval1;
+            Series *p2 = ctx.getArgSeriesOrNull(1);
+            double prev_dval2 = p2 ? p2->getCurrent(current_bar - 1) : dval2;
             
             bool result = false;
             if (!std::isnan(dval1) && !std::isnan(dval2) && !std::isnan(prev_dval1) && !std::isnan(prev_dval2)) {
@@ -1760,24 +1750,25 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(1)
     };
 
     built_in_funcs["downnday"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 2, .max_args = 2 }; // placeholder
     
     built_in_funcs["every"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
             
             bool result = false;
             if (current_bar >= length - 1) {
                 bool all_true = true;
                 for (int i = 0; i < length; ++i) {
-                    double val = condition_series->getCurrent(current_bar - i);
+                    double val = condition_series.getCurrent(current_bar - i);
                     if (std::isnan(val) || val == 0.0) {
                         all_true = false;
                         break;
@@ -1789,20 +1780,21 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
 
     built_in_funcs["exist"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int length = static_cast<int>(ctx.getArgAsNumeric(1));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             bool result = false;
             for (int i = 0; i < length && current_bar - i >= 0; ++i) {
-                double val = condition_series->getCurrent(current_bar - i);
+                double val = condition_series.getCurrent(current_bar - i);
                 if (!std::isnan(val) && val != 0.0) {
                     result = true;
                     break;
@@ -1812,16 +1804,17 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::window(1, -1)
     };
 
     built_in_funcs["last"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            auto condition_series = ctx.getArgAsSeries(0);
+            Series &condition_series = ctx.getArgSeries(0);
             int start_offset = static_cast<int>(ctx.getArgAsNumeric(1));
             int end_offset = static_cast<int>(ctx.getArgAsNumeric(2));
             
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
             if(start_offset == 0) start_offset = current_bar;
@@ -1831,7 +1824,7 @@ void PineVM::registerBuiltinsHithink()
             for (int i = end_offset; i >= start_offset; --i) {
                 int bar_to_check = current_bar - i;
                 if (bar_to_check < 0) { all_true_in_range = false; break; }
-                double cond_val = condition_series->getCurrent(bar_to_check);
+                double cond_val = condition_series.getCurrent(bar_to_check);
                 if (std::isnan(cond_val) || cond_val == 0.0) { all_true_in_range = false; break; }
             }
             result_series->setCurrent(current_bar, static_cast<double>(all_true_in_range));
@@ -1843,20 +1836,16 @@ void PineVM::registerBuiltinsHithink()
 
     built_in_funcs["longcross"] = {
         .function = [](FunctionContext &ctx) -> Value {
-            Value val1 = ctx.getArg(0);
-            Value val2 = ctx.getArg(1);
-            
-            auto& vm = ctx.getVM();
-            auto result_series = ctx.getResultSeries();
+            const auto &result_series = ctx.getResultSeries();
             int current_bar = ctx.getCurrentBarIndex();
 
-            double dval1 = vm.getNumericValue(val1);
-            double dval2 = vm.getNumericValue(val2);
+            double dval1 = ctx.getArgAsNumeric(0);
+            double dval2 = ctx.getArgAsNumeric(1);
 
-            auto *p1 = std::get_if<std::shared_ptr<Series>>(&val1);
-            double prev_dval1 = (p1 && *p1) ? (*p1)->getCurrent(current_bar - 1) : dval1;
-            auto *p2 = std::get_if<std::shared_ptr<Series>>(&val2);
-            double prev_dval2 = (p2 && *p2) ? (*p2)->getCurrent(current_bar - 1) : dval2;
+            Series *p1 = ctx.getArgSeriesOrNull(0);
+            double prev_dval1 = p1 ? p1->getCurrent(current_bar - 1) : dval1;
+            Series *p2 = ctx.getArgSeriesOrNull(1);
+            double prev_dval2 = p2 ? p2->getCurrent(current_bar - 1) : dval2;
             
             bool long_cross = false;
             if (!std::isnan(dval1) && !std::isnan(dval2) && !std::isnan(prev_dval1) && !std::isnan(prev_dval2)) {
@@ -1866,7 +1855,8 @@ void PineVM::registerBuiltinsHithink()
             return result_series;
         },
         .min_args = 2,
-        .max_args = 2
+        .max_args = 2,
+        .lookback = Lookback::fixed(1)
     };
 
     built_in_funcs["nday"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 2, .max_args = 2 }; // placeholder
@@ -1879,7 +1869,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
     
     built_in_funcs["upnday"] = { .function = [](FunctionContext &ctx) { return ctx.getResultSeries(); }, .min_args = 2, .max_args = 2 }; // placeholder
@@ -1891,7 +1882,8 @@ void PineVM::registerBuiltinsHithink()
             return ctx.getResultSeries();
         },
         .min_args = 1,
-        .max_args = 1
+        .max_args = 1,
+        .lookback = Lookback::fixed(0)
     };
 
 }
\ No newline at end of file
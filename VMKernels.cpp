@@ -0,0 +1,224 @@
+#include "VMKernels.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define PINEVM_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define PINEVM_TARGET_AVX2
+#else
+#define PINEVM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+//-----------------------------------------------------------------------------
+// 标量实现 (所有平台可用，也是 SIMD 实现处理尾部元素时的回退)
+//-----------------------------------------------------------------------------
+
+template <OpCode OP>
+static void binaryOpScalar(const double* a, double av, const double* b, double bv, double* out, size_t begin, size_t n)
+{
+    for (size_t i = begin; i < n; ++i)
+        out[i] = applyBinaryOp(OP, a ? a[i] : av, b ? b[i] : bv);
+}
+
+#ifdef PINEVM_KERNELS_X86
+
+//-----------------------------------------------------------------------------
+// SSE2 实现 (x86-64 的基线指令集，无需运行时检测)
+// 先按 IEEE 规则计算，再用 "无序" (任一为 NaN) 掩码统一替换为 NaN，
+// 保证与 applyBinaryOp 的结果完全一致，包括 inf - inf、0 * inf 等情况。
+//-----------------------------------------------------------------------------
+
+template <OpCode OP>
+static void binaryOpSSE2(const double* a, double av, const double* b, double bv, double* out, size_t n)
+{
+    const __m128d nan = _mm_set1_pd(NAN);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d va_s = _mm_set1_pd(av);
+    const __m128d vb_s = _mm_set1_pd(bv);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128d x = a ? _mm_loadu_pd(a + i) : va_s;
+        const __m128d y = b ? _mm_loadu_pd(b + i) : vb_s;
+        __m128d invalid = _mm_cmpunord_pd(x, y);
+        __m128d r;
+        if constexpr (OP == OpCode::ADD) r = _mm_add_pd(x, y);
+        else if constexpr (OP == OpCode::SUB) r = _mm_sub_pd(x, y);
+        else if constexpr (OP == OpCode::MUL) r = _mm_mul_pd(x, y);
+        else if constexpr (OP == OpCode::DIV) {
+            r = _mm_div_pd(x, y);
+            invalid = _mm_or_pd(invalid, _mm_cmpeq_pd(y, zero));
+        }
+        else if constexpr (OP == OpCode::LESS) r = _mm_and_pd(_mm_cmplt_pd(x, y), one);
+        else if constexpr (OP == OpCode::LESS_EQUAL) r = _mm_and_pd(_mm_cmple_pd(x, y), one);
+        else if constexpr (OP == OpCode::EQUAL_EQUAL) r = _mm_and_pd(_mm_cmpeq_pd(x, y), one);
+        else if constexpr (OP == OpCode::BANG_EQUAL) r = _mm_and_pd(_mm_cmpneq_pd(x, y), one);
+        else if constexpr (OP == OpCode::GREATER) r = _mm_and_pd(_mm_cmpgt_pd(x, y), one);
+        else if constexpr (OP == OpCode::GREATER_EQUAL) r = _mm_and_pd(_mm_cmpge_pd(x, y), one);
+        else if constexpr (OP == OpCode::LOGICAL_AND)
+            r = _mm_and_pd(_mm_and_pd(_mm_cmpneq_pd(x, zero), _mm_cmpneq_pd(y, zero)), one);
+        else if constexpr (OP == OpCode::LOGICAL_OR)
+            r = _mm_and_pd(_mm_or_pd(_mm_cmpneq_pd(x, zero), _mm_cmpneq_pd(y, zero)), one);
+        // SSE2 没有 blendv，用与/或拼出选择
+        _mm_storeu_pd(out + i, _mm_or_pd(_mm_andnot_pd(invalid, r), _mm_and_pd(invalid, nan)));
+    }
+    binaryOpScalar<OP>(a, av, b, bv, out, i, n);
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 实现 (运行时检测到 CPU 支持才会调用)
+//-----------------------------------------------------------------------------
+
+template <OpCode OP>
+PINEVM_TARGET_AVX2
+static void binaryOpAVX2(const double* a, double av, const double* b, double bv, double* out, size_t n)
+{
+    const __m256d nan = _mm256_set1_pd(NAN);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d va_s = _mm256_set1_pd(av);
+    const __m256d vb_s = _mm256_set1_pd(bv);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256d x = a ? _mm256_loadu_pd(a + i) : va_s;
+        const __m256d y = b ? _mm256_loadu_pd(b + i) : vb_s;
+        __m256d invalid = _mm256_cmp_pd(x, y, _CMP_UNORD_Q);
+        __m256d r;
+        if constexpr (OP == OpCode::ADD) r = _mm256_add_pd(x, y);
+        else if constexpr (OP == OpCode::SUB) r = _mm256_sub_pd(x, y);
+        else if constexpr (OP == OpCode::MUL) r = _mm256_mul_pd(x, y);
+        else if constexpr (OP == OpCode::DIV) {
+            r = _mm256_div_pd(x, y);
+            invalid = _mm256_or_pd(invalid, _mm256_cmp_pd(y, zero, _CMP_EQ_OQ));
+        }
+        else if constexpr (OP == OpCode::LESS) r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), one);
+        else if constexpr (OP == OpCode::LESS_EQUAL) r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LE_OQ), one);
+        else if constexpr (OP == OpCode::EQUAL_EQUAL) r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_EQ_OQ), one);
+        else if constexpr (OP == OpCode::BANG_EQUAL) r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_NEQ_UQ), one);
+        else if constexpr (OP == OpCode::GREATER) r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_GT_OQ), one);
+        else if constexpr (OP == OpCode::GREATER_EQUAL) r = _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_GE_OQ), one);
+        else if constexpr (OP == OpCode::LOGICAL_AND)
+            r = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x, zero, _CMP_NEQ_UQ), _mm256_cmp_pd(y, zero, _CMP_NEQ_UQ)), one);
+        else if constexpr (OP == OpCode::LOGICAL_OR)
+            r = _mm256_and_pd(_mm256_or_pd(_mm256_cmp_pd(x, zero, _CMP_NEQ_UQ), _mm256_cmp_pd(y, zero, _CMP_NEQ_UQ)), one);
+        _mm256_storeu_pd(out + i, _mm256_blendv_pd(r, nan, invalid));
+    }
+    binaryOpScalar<OP>(a, av, b, bv, out, i, n);
+}
+
+static bool cpuSupportsAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx)
+        return false;
+    // 操作系统必须保存 YMM 寄存器状态
+    if ((_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PINEVM_KERNELS_X86
+
+//-----------------------------------------------------------------------------
+// 运行时分派
+//-----------------------------------------------------------------------------
+
+KernelIsa detectKernelIsa()
+{
+#ifdef PINEVM_KERNELS_X86
+    static const KernelIsa detected = cpuSupportsAVX2() ? KernelIsa::AVX2 : KernelIsa::SSE2;
+    return detected;
+#else
+    return KernelIsa::Scalar;
+#endif
+}
+
+static std::atomic<KernelIsa>& selectedKernelIsa()
+{
+    static std::atomic<KernelIsa> selected{detectKernelIsa()};
+    return selected;
+}
+
+KernelIsa activeKernelIsa()
+{
+    return selectedKernelIsa().load(std::memory_order_relaxed);
+}
+
+void forceKernelIsa(KernelIsa isa)
+{
+    if (static_cast<int>(isa) > static_cast<int>(detectKernelIsa()))
+        isa = detectKernelIsa();
+    selectedKernelIsa().store(isa, std::memory_order_relaxed);
+}
+
+const char* kernelIsaName(KernelIsa isa)
+{
+    switch (isa)
+    {
+    case KernelIsa::AVX2: return "avx2";
+    case KernelIsa::SSE2: return "sse2";
+    default:              return "scalar";
+    }
+}
+
+template <OpCode OP>
+static void dispatchBinaryOp(const double* a, double av, const double* b, double bv, double* out, size_t n)
+{
+    switch (activeKernelIsa())
+    {
+#ifdef PINEVM_KERNELS_X86
+    case KernelIsa::AVX2:
+        binaryOpAVX2<OP>(a, av, b, bv, out, n);
+        return;
+    case KernelIsa::SSE2:
+        binaryOpSSE2<OP>(a, av, b, bv, out, n);
+        return;
+#endif
+    default:
+        binaryOpScalar<OP>(a, av, b, bv, out, 0, n);
+        return;
+    }
+}
+
+void binaryOpKernel(OpCode op,
+                    const double* left, double left_scalar,
+                    const double* right, double right_scalar,
+                    double* out, size_t n)
+{
+    switch (op)
+    {
+    case OpCode::ADD:           dispatchBinaryOp<OpCode::ADD>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::SUB:           dispatchBinaryOp<OpCode::SUB>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::MUL:           dispatchBinaryOp<OpCode::MUL>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::DIV:           dispatchBinaryOp<OpCode::DIV>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::LESS:          dispatchBinaryOp<OpCode::LESS>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::LESS_EQUAL:    dispatchBinaryOp<OpCode::LESS_EQUAL>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::EQUAL_EQUAL:   dispatchBinaryOp<OpCode::EQUAL_EQUAL>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::BANG_EQUAL:    dispatchBinaryOp<OpCode::BANG_EQUAL>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::GREATER:       dispatchBinaryOp<OpCode::GREATER>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::GREATER_EQUAL: dispatchBinaryOp<OpCode::GREATER_EQUAL>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::LOGICAL_AND:   dispatchBinaryOp<OpCode::LOGICAL_AND>(left, left_scalar, right, right_scalar, out, n); break;
+    case OpCode::LOGICAL_OR:    dispatchBinaryOp<OpCode::LOGICAL_OR>(left, left_scalar, right, right_scalar, out, n); break;
+    default:
+        throw std::runtime_error("Not a binary operator.");
+    }
+}
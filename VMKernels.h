@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cmath>
+#include <stdexcept>
+#include "VMCommon.h"
+
+//-----------------------------------------------------------------------------
+// 按列执行使用的算术/比较/逻辑运算内核
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief 单个元素的运算语义，所有内核都必须与之逐位一致：
+ *        任一操作数为 NaN 时结果为 NaN，除以 0 结果为 NaN，比较与逻辑运算的结果为 1.0 / 0.0。
+ */
+inline double applyBinaryOp(OpCode op, double left, double right)
+{
+    if (std::isnan(left) || std::isnan(right))
+        return NAN;
+    switch (op)
+    {
+    case OpCode::ADD:           return left + right;
+    case OpCode::SUB:           return left - right;
+    case OpCode::MUL:           return left * right;
+    case OpCode::DIV:           return right == 0.0 ? NAN : left / right;
+    case OpCode::LESS:          return left < right;
+    case OpCode::LESS_EQUAL:    return left <= right;
+    case OpCode::EQUAL_EQUAL:   return left == right;
+    case OpCode::BANG_EQUAL:    return left != right;
+    case OpCode::GREATER:       return left > right;
+    case OpCode::GREATER_EQUAL: return left >= right;
+    // 在Hithink中, 非0且非NaN为true, 结果为1.0或0.0
+    case OpCode::LOGICAL_AND:   return (left != 0.0 && right != 0.0) ? 1.0 : 0.0;
+    case OpCode::LOGICAL_OR:    return (left != 0.0 || right != 0.0) ? 1.0 : 0.0;
+    default:
+        throw std::runtime_error("Not a binary operator.");
+    }
+}
+
+enum class KernelIsa {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+/**
+ * @brief 对 n 个元素执行 out[i] = left[i] op right[i]。
+ *        left / right 为 nullptr 时，该侧在整个区间内使用对应的标量值。
+ *        out 可以与 left 或 right 指向同一块内存。
+ *        首次调用时按 CPU 能力选择 AVX2 / SSE2 / 标量实现。
+ */
+void binaryOpKernel(OpCode op,
+                    const double* left, double left_scalar,
+                    const double* right, double right_scalar,
+                    double* out, size_t n);
+
+// 当前 CPU 支持的最佳实现
+KernelIsa detectKernelIsa();
+
+// 当前实际使用的实现；forceKernelIsa 可用于测试或排查问题 (超出 CPU 能力的请求会被降级)
+KernelIsa activeKernelIsa();
+void forceKernelIsa(KernelIsa isa);
+
+const char* kernelIsaName(KernelIsa isa);
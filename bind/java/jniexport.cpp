@@ -6,6 +6,7 @@
 // 包含我们需要导出的 C++ 类的头文件
 #include "../../Hithink/HithinkCompiler.h"
 #include "../../PineVM.h"
+#include "../../CompileCache.h"
 
 // 辅助函数，用于将 Java 的 jstring 转换为 C++ 的 std::string
 std::string jstringToStdString(JNIEnv *env, jstring jStr) {
@@ -42,17 +43,19 @@ extern "C" {
  */
 JNIEXPORT jstring JNICALL
 Java_com_pinevm_HithinkCompiler_nativeCompile(JNIEnv *env, jclass clazz, jstring source) {
-    HithinkCompiler compiler;
     std::string source_str = jstringToStdString(env, source);
     
     try {
-        std::string bytecode_txt = compiler.compile_to_str(source_str);
-        if (compiler.hadError()) {
-            // 编译期间的语法错误等，通过异常报告给 Java
-            ThrowJavaException(env, "java/lang/RuntimeException", "Hithink compilation failed. Check console for details.");
-            return nullptr;
-        }
-        return env->NewStringUTF(bytecode_txt.c_str());
+        // 相同的公式只编译一次 (进程级缓存)；编译期间的语法错误等通过异常报告给 Java
+        auto bytecode = CompileCache::shared().get("hithink", source_str, [](const std::string& normalized) {
+            HithinkCompiler compiler;
+            Bytecode compiled = compiler.compile(normalized);
+            if (compiler.hadError()) {
+                throw std::runtime_error("Hithink compilation failed. Check console for details.");
+            }
+            return compiled;
+        });
+        return env->NewStringUTF(bytecodeToTxt(*bytecode).c_str());
     } catch (const std::exception& e) {
         // 捕获 C++ 异常并转换为 Java 异常
         ThrowJavaException(env, "java/lang/RuntimeException", e.what());
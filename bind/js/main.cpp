@@ -8,6 +8,7 @@
 
 #include "../../PineVM.h"
 #include "../../Hithink/HithinkCompiler.h"
+#include "../../CompileCache.h"
 
 std::string extract_json_str(const std::string& line, const std::string& key) {
     size_t key_pos = line.find(key);
@@ -104,11 +105,17 @@ const char* pine_compiler(const char* source_code) {
     std::streambuf* old_cerr_buf = std::cerr.rdbuf(output_buffer.rdbuf());
 
     try {
-            HithinkCompiler compiler;
-            bytecode_string = compiler.compile_to_str(source_code);
-            if (compiler.hadError()) {
-                throw std::runtime_error("Hithink compilation failed.");
-            }
+            // 相同的公式只编译一次 (进程级缓存)
+            bytecode_string.clear();
+            auto bytecode = CompileCache::shared().get("hithink", source_code, [](const std::string& normalized) {
+                HithinkCompiler compiler;
+                Bytecode compiled = compiler.compile(normalized);
+                if (compiler.hadError()) {
+                    throw std::runtime_error("Hithink compilation failed.");
+                }
+                return compiled;
+            });
+            bytecode_string = bytecodeToTxt(*bytecode);
         } catch (const std::exception& e) {
             std::cerr << "\n!!! C++ EXCEPTION CAUGHT !!!\n" << e.what() << std::endl;
         } catch (...) {
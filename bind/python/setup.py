@@ -50,6 +50,8 @@ ext_modules = [
          '../../Hithink/HithinkLexer.cpp', # 假设Lexer是Parser的一部分
          '../../PineVM.cpp',
          '../../VMFunc.cpp',
+         '../../VMKernels.cpp',
+         '../../BytecodeOptimizer.cpp',
          '../../VMCommon.cpp'
          ],
         # 包含目录
@@ -310,6 +310,7 @@ int main(int argc, char* argv[]) {
 
         // --- 初始化 VM 并注册数据 ---
         PineVM vm;
+        vm.setBytecodeLogging(true);
         dataSource->loadData(vm);
 
         // --- 3. 初始化并测量 VM 执行时间 ---
@@ -352,6 +353,13 @@ int main(int argc, char* argv[]) {
         if (!push_csv_path.empty()) {
             // === 启动生产者线程，进入增量计算模式 ===
             std::cout << "\n\n--- [Main] Starting real-time simulation ---" << std::endl;
+            // 流式模式：序列改为按回看根数分配的环形缓冲区，内存不随运行时间增长
+            // (多保留一些K线，生产者可能先于计算写入后面的K线)
+            // 数据源注册的是只读共享的输入列，生产者要写入，先取得本 VM 的私有副本
+            for (const char* name : {"open", "high", "low", "close", "time"}) {
+                vm.getSeries(name);
+            }
+            vm.setStreamingMode(true, 16);
             std::thread producer_thread(data_producer, std::ref(vm));
 
             // === 4. 消费者循环（在主线程中） ===
@@ -391,9 +399,9 @@ int main(int argc, char* argv[]) {
                 // 打印最后一个值来观察变化
                 const auto& results = vm.getGlobalSeries();
                 if (!results.empty()) {
-                    const auto& data = std::get<std::shared_ptr<Series>>(results[0])->data;
-                    if (!data.empty()) {
-                        std::cout << "[Main/Consumer] Latest value: " << data.back() << std::endl << std::endl;
+                    const auto& series = std::get<std::shared_ptr<Series>>(results[0]);
+                    if (series->size() > 0) {
+                        std::cout << "[Main/Consumer] Latest value: " << series->getCurrent(series->size() - 1) << std::endl << std::endl;
                     }
                 }
             }
@@ -7,8 +7,20 @@
 #include <cmath>
 #include <iomanip>
 #include <limits>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+#include <functional>
 
 #include "../PineVM.h"
+#include "../VMKernels.h"
+#include "../BatchRunner.h"
+#include "../ParameterSweep.h"
+#include "../BytecodeLibrary.h"
+#include "../CompileCache.h"
 #include "../Hithink/HithinkCompiler.h"
 
 // 用于比较浮点数
@@ -102,6 +114,1249 @@ void run_test(const std::string& test_name,
      std::cout << std::endl;
 }
 
+// 在同一份输入上分别以逐 bar、按列 (一次性/增量) 三种方式执行，要求所有全局序列逐点一致；
+// min_scalar_temps 要求加载时至少有这么多中间结果改为标量临时变量
+void run_mode_equivalence_test(const std::string& test_name,
+                               const std::string& script,
+                               const std::map<std::string, std::vector<double>>& input_data,
+                               int min_scalar_temps = 0) {
+    total_tests++;
+    std::cout << "--- Running mode equivalence test: " << test_name << " ---" << std::endl;
+    std::cout << "    Script: " << script << std::endl;
+
+    HithinkCompiler compiler;
+    Bytecode bytecode = compiler.compile(script);
+    if (compiler.hadError()) {
+        std::cout << "    [COMPILATION FAILED]" << std::endl;
+        return;
+    }
+    const std::string code = bytecodeToTxt(bytecode);
+
+    int total_bars = 0;
+    for (const auto& pair : input_data) {
+        total_bars = std::max(total_bars, static_cast<int>(pair.second.size()));
+    }
+
+    // mode 0: 逐 bar; mode 1: 按列一次执行; mode 2: 按列增量执行 (最后两根K线分两次推入)
+    std::vector<std::map<std::string, std::vector<double>>> outputs(3);
+    for (int mode = 0; mode < 3; ++mode) {
+        PineVM vm;
+        vm.setVectorizedExecution(mode != 0);
+        for (const auto& pair : input_data) {
+            auto series = std::make_shared<Series>();
+            series->name = pair.first;
+            series->data = pair.second;
+            vm.registerSeries(pair.first, series);
+        }
+        vm.loadBytecode(code);
+        if (mode == 1 && !vm.isVectorizedExecution()) {
+            std::cout << "    [FAIL] Script was not eligible for vectorized execution." << std::endl;
+            return;
+        }
+        if (vm.getScalarTempCount() < min_scalar_temps) {
+            std::cout << "    [FAIL] Only " << vm.getScalarTempCount() << " scalar temps assigned, expected at least "
+                      << min_scalar_temps << std::endl;
+            return;
+        }
+        int failed = 0;
+        if (mode == 2) {
+            failed |= vm.execute(total_bars - 2);
+            failed |= vm.execute(total_bars - 1);
+            failed |= vm.execute(total_bars);
+        } else {
+            failed = vm.execute(total_bars);
+        }
+        if (failed) {
+            std::cout << "    [EXECUTION FAILED]" << vm.getLastErrorMessage() << std::endl;
+            return;
+        }
+        for (const auto& global : vm.getGlobalSeries()) {
+            if (auto* p = std::get_if<std::shared_ptr<Series>>(&global)) {
+                outputs[mode][(*p)->name] = (*p)->data;
+            }
+        }
+    }
+
+    for (int mode = 1; mode < 3; ++mode) {
+        if (outputs[mode].size() != outputs[0].size()) {
+            std::cout << "    [FAIL] Mode " << mode << " produced a different set of series." << std::endl;
+            return;
+        }
+        for (const auto& pair : outputs[0]) {
+            auto it = outputs[mode].find(pair.first);
+            if (it == outputs[mode].end() || it->second.size() != pair.second.size()) {
+                std::cout << "    [FAIL] Series '" << pair.first << "' differs in mode " << mode << "." << std::endl;
+                return;
+            }
+            for (size_t i = 0; i < pair.second.size(); ++i) {
+                if (!are_equal(pair.second[i], it->second[i])) {
+                    std::cout << "    [FAIL] Series '" << pair.first << "' differs at bar " << i
+                              << " in mode " << mode << ": " << pair.second[i] << " vs " << it->second[i] << std::endl;
+                    return;
+                }
+            }
+        }
+    }
+    std::cout << "    [PASS] " << outputs[0].size() << " series identical in all modes" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 递推状态的对照测试：一次算完与分段增量计算 (bars/3、bars/2、全部) 的所有全局变量逐位一致，
+// reference(bar) 列出的变量与逐根直接计算的结果一致。tolerance 为相对误差上限，0 表示逐位一致 (NaN 与 NaN 相同)。
+void run_incremental_test(const std::string& test_name,
+                          const std::string& script,
+                          const std::map<std::string, std::vector<double>>& input_data,
+                          const std::function<std::map<std::string, double>(int bar)>& reference,
+                          double tolerance = 0.0) {
+    total_tests++;
+    std::cout << "--- Running incremental test: " << test_name << " ---" << std::endl;
+    std::cout << "    Script: " << script << std::endl;
+
+    HithinkCompiler compiler;
+    const Bytecode bytecode = compiler.compile(script);
+    if (compiler.hadError()) {
+        std::cout << "    [COMPILATION FAILED]" << std::endl;
+        return;
+    }
+
+    int total_bars = 0;
+    PineVM full, incremental;
+    for (const auto& pair : input_data) {
+        total_bars = std::max(total_bars, static_cast<int>(pair.second.size()));
+        auto series = std::make_shared<Series>();
+        series->name = pair.first;
+        series->data = pair.second;
+        std::shared_ptr<const Series> input = series;
+        full.registerSeries(pair.first, input);
+        incremental.registerSeries(pair.first, input);
+    }
+    full.loadBytecode(bytecode);
+    incremental.loadBytecode(bytecode);
+    if (full.execute(total_bars) || incremental.execute(total_bars / 3) || incremental.execute(total_bars / 2) ||
+        incremental.execute(total_bars)) {
+        std::cout << "    [EXECUTION FAILED]" << full.getLastErrorMessage() << incremental.getLastErrorMessage() << std::endl;
+        return;
+    }
+
+    auto same = [](double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+    std::map<std::string, const Series*> outputs[2];
+    PineVM* vms[2] = {&full, &incremental};
+    for (int k = 0; k < 2; ++k) {
+        for (const auto& global : vms[k]->getGlobalSeries()) {
+            if (auto* p = std::get_if<std::shared_ptr<Series>>(&global)) {
+                outputs[k][(*p)->name] = p->get();
+            }
+        }
+    }
+    if (outputs[0].size() != outputs[1].size()) {
+        std::cout << "    [FAIL] Incremental execution produced a different set of series." << std::endl;
+        return;
+    }
+    size_t checked = 0;
+    for (int bar = 0; bar < total_bars; ++bar) {
+        for (const auto& pair : outputs[0]) {
+            auto it = outputs[1].find(pair.first);
+            if (it == outputs[1].end() || !same(pair.second->getCurrent(bar), it->second->getCurrent(bar))) {
+                std::cout << "    [FAIL] Series '" << pair.first << "' differs between full and incremental execution at bar " << bar << std::endl;
+                return;
+            }
+        }
+        const std::map<std::string, double> expected = reference(bar);
+        checked = expected.size();
+        for (const auto& pair : expected) {
+            auto it = outputs[0].find(pair.first);
+            if (it == outputs[0].end()) {
+                std::cout << "    [FAIL] Series '" << pair.first << "' not found." << std::endl;
+                return;
+            }
+            const double a = it->second->getCurrent(bar);
+            const double e = pair.second;
+            const bool ok = tolerance == 0.0 || std::isnan(e) ? same(a, e) : std::fabs(a - e) <= tolerance * std::max(1.0, std::fabs(e));
+            if (!ok) {
+                std::cout << "    [FAIL] Series '" << pair.first << "' at bar " << bar << ": " << a << ", expected " << e << std::endl;
+                return;
+            }
+        }
+    }
+    std::cout << "    [PASS] " << total_bars << " bars, " << checked << " series match direct computation" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 流式模式逐根推入K线，每根执行后的结果须与普通模式一致；
+// 所有序列都应是环形缓冲区；给出 unbounded_input (回看根数不是常量) 时只要求该输入保持无界
+void run_streaming_test(const std::string& test_name,
+                        const std::string& script,
+                        const std::map<std::string, std::vector<double>>& input_data,
+                        const std::string& unbounded_input = "") {
+    total_tests++;
+    std::cout << "--- Running streaming test: " << test_name << " ---" << std::endl;
+    std::cout << "    Script: " << script << std::endl;
+
+    HithinkCompiler compiler;
+    Bytecode bytecode = compiler.compile(script);
+    if (compiler.hadError()) {
+        std::cout << "    [COMPILATION FAILED]" << std::endl;
+        return;
+    }
+    const std::string code = bytecodeToTxt(bytecode);
+
+    int total_bars = 0;
+    PineVM reference, streaming;
+    std::map<std::string, std::shared_ptr<Series>> inputs;
+    for (const auto& pair : input_data) {
+        total_bars = std::max(total_bars, static_cast<int>(pair.second.size()));
+        auto series = std::make_shared<Series>();
+        series->name = pair.first;
+        series->data = pair.second;
+        reference.registerSeries(pair.first, series);
+        inputs[pair.first] = std::make_shared<Series>();
+        inputs[pair.first]->name = pair.first;
+        streaming.registerSeries(pair.first, inputs[pair.first]);
+    }
+    reference.loadBytecode(code);
+    streaming.loadBytecode(code);
+    streaming.setStreamingMode(true);
+    if (reference.execute(total_bars)) {
+        std::cout << "    [EXECUTION FAILED]" << reference.getLastErrorMessage() << std::endl;
+        return;
+    }
+
+    size_t max_capacity = 0;
+    for (int bar = 0; bar < total_bars; ++bar) {
+        for (const auto& pair : input_data) {
+            inputs[pair.first]->setCurrent(bar, pair.second[bar]);
+        }
+        if (streaming.execute(bar + 1)) {
+            std::cout << "    [EXECUTION FAILED]" << streaming.getLastErrorMessage() << std::endl;
+            return;
+        }
+        const auto& expected = reference.getGlobalSeries();
+        const auto& actual = streaming.getGlobalSeries();
+        for (size_t i = 0; i < expected.size(); ++i) {
+            const auto& e = std::get<std::shared_ptr<Series>>(expected[i]);
+            const auto& a = std::get<std::shared_ptr<Series>>(actual[i]);
+            if (!are_equal(e->getCurrent(bar), a->getCurrent(bar))) {
+                std::cout << "    [FAIL] Series '" << e->name << "' differs at bar " << bar << ": "
+                          << e->getCurrent(bar) << " vs " << a->getCurrent(bar) << std::endl;
+                return;
+            }
+            if (!a->isBounded() && unbounded_input.empty()) {
+                std::cout << "    [FAIL] Series '" << a->name << "' is not bounded." << std::endl;
+                return;
+            }
+            max_capacity = std::max(max_capacity, a->capacity);
+        }
+    }
+    for (const auto& pair : inputs) {
+        if (pair.second->isBounded() == (pair.first == unbounded_input)) {
+            std::cout << "    [FAIL] Input '" << pair.first << "' has capacity " << pair.second->capacity << std::endl;
+            return;
+        }
+        max_capacity = std::max(max_capacity, pair.second->capacity);
+    }
+    std::cout << "    [PASS] " << total_bars << " bars streamed, max capacity " << max_capacity << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 列存储：每列起点按缓存行对齐，按几何倍数扩容，release 后全部归还
+void run_column_arena_test() {
+    total_tests++;
+    std::cout << "--- Running test: column arena ---" << std::endl;
+    ColumnArena arena;
+    arena.reserve(3, 10);
+    const size_t first_stride = arena.stride();
+    bool ok = arena.columns() == 3 && first_stride >= 10;
+    arena.reserve(2, first_stride + 1);
+    ok = ok && arena.columns() == 3 && arena.stride() >= 2 * first_stride;
+    for (size_t i = 0; i < arena.columns(); ++i) {
+        ok = ok && reinterpret_cast<std::uintptr_t>(arena.column(i)) % ColumnArena::kAlignment == 0;
+        std::fill(arena.column(i), arena.column(i) + arena.stride(), static_cast<double>(i));
+    }
+    ok = ok && arena.column(2)[arena.stride() - 1] == 2.0 && arena.column(1)[0] == 1.0;
+    const size_t grown_stride = arena.stride();
+    arena.release();
+    ok = ok && arena.columns() == 0 && arena.stride() == 0;
+    if (ok) {
+        std::cout << "    [PASS] stride " << first_stride << " -> " << grown_stride << std::endl;
+        passed_tests++;
+    } else {
+        std::cout << "    [FAIL] Unexpected arena layout." << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+// 多品种批量计算：多线程结果须与单线程逐点一致 (包括每个 VM 独立的 rand 序列)
+void run_batch_test() {
+    total_tests++;
+    std::cout << "--- Running test: batch execution ---" << std::endl;
+
+    HithinkCompiler compiler;
+    Bytecode bytecode = compiler.compile("M:MA(C,5); D:C-REF(C,1); R:rand()*C; H:HHV(H,10)-LLV(L,10);");
+    if (compiler.hadError()) {
+        std::cout << "    [COMPILATION FAILED]" << std::endl;
+        return;
+    }
+
+    std::vector<SymbolInput> inputs;
+    for (int s = 0; s < 37; ++s) {
+        SymbolInput input;
+        input.symbol = "S" + std::to_string(s);
+        const int bars = 20 + (s * 97) % 600; // 长短不一
+        for (const char* name : {"close", "high", "low"}) {
+            auto series = std::make_shared<Series>();
+            series->name = name;
+            for (int i = 0; i < bars; ++i) {
+                series->data.push_back(100 + s + 10 * std::sin(i * 0.1 + s) + (name[0] == 'h' ? 2 : name[0] == 'l' ? -2 : 0));
+            }
+            input.series[name] = series;
+        }
+        inputs.push_back(input);
+    }
+
+    const auto serial = runBatch(bytecode, inputs, 1);
+    const auto parallel = runBatch(bytecode, inputs, 4);
+    for (size_t s = 0; s < inputs.size(); ++s) {
+        if (serial[s].status != 0 || parallel[s].status != 0 || serial[s].symbol != inputs[s].symbol ||
+            parallel[s].symbol != inputs[s].symbol || serial[s].series.size() != parallel[s].series.size()) {
+            std::cout << "    [FAIL] Symbol " << inputs[s].symbol << ": " << serial[s].error_message << parallel[s].error_message << std::endl;
+            return;
+        }
+        for (size_t g = 0; g < serial[s].series.size(); ++g) {
+            const auto& a = serial[s].series[g]->data;
+            const auto& b = parallel[s].series[g]->data;
+            if (a.size() != inputs[s].series.at("close")->data.size() || a.size() != b.size() ||
+                !std::equal(a.begin(), a.end(), b.begin(), are_equal)) {
+                std::cout << "    [FAIL] Symbol " << inputs[s].symbol << " series " << g << " differs." << std::endl;
+                return;
+            }
+        }
+    }
+    std::cout << "    [PASS] " << inputs.size() << " symbols identical on 1 and 4 threads" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 只读共享的输入列：多个 VM 共用一份数据，结果与各自持有副本时相同，且共享数据保持不变
+void run_shared_input_test() {
+    total_tests++;
+    std::cout << "--- Running test: shared input columns ---" << std::endl;
+
+    std::vector<double> closes;
+    for (int i = 0; i < 50; ++i) {
+        closes.push_back(100 + 5 * std::sin(i * 0.4));
+    }
+    auto shared = std::make_shared<Series>();
+    shared->name = "close";
+    shared->data = closes;
+    std::shared_ptr<const Series> shared_close = shared;
+
+    const char* scripts[] = {"X:C; Y:MA(X,5);", "X:C; X:=X*2; Z:REF(X,3);", "E:EMA(C,5)-C[2];"};
+    for (const char* script : scripts) {
+        HithinkCompiler compiler;
+        const Bytecode bytecode = compiler.compile(script);
+        PineVM shared_vm, private_vm;
+        shared_vm.registerSeries("close", shared_close);
+        auto copy = std::make_shared<Series>();
+        copy->name = "close";
+        copy->data = closes;
+        private_vm.registerSeries("close", copy);
+        shared_vm.loadBytecode(bytecode);
+        private_vm.loadBytecode(bytecode);
+        shared_vm.setStreamingMode(true, 50);
+        if (shared_vm.execute(50) || private_vm.execute(50)) {
+            std::cout << "    [EXECUTION FAILED] " << script << std::endl;
+            return;
+        }
+        const auto& a = shared_vm.getGlobalSeries();
+        const auto& b = private_vm.getGlobalSeries();
+        for (size_t g = 0; g < a.size(); ++g) {
+            const auto& sa = std::get<std::shared_ptr<Series>>(a[g]);
+            const auto& sb = std::get<std::shared_ptr<Series>>(b[g]);
+            for (int i = 0; i < 50; ++i) {
+                if (!are_equal(sa->getCurrent(i), sb->getCurrent(i))) {
+                    std::cout << "    [FAIL] " << script << " differs at bar " << i << std::endl;
+                    return;
+                }
+            }
+        }
+        // 写时复制：通过 getSeries 写入只影响本 VM
+        shared_vm.getSeries("close")->setCurrent(50, 1.0);
+    }
+    {
+        // BETA 隐式读取收盘价：按只读方式取用，不触发写时复制
+        HithinkCompiler compiler;
+        PineVM vm;
+        vm.registerSeries("close", shared_close);
+        vm.registerSeries("open", shared_close);
+        vm.loadBytecode(compiler.compile("B:BETA(O,5);"));
+        const long before = shared.use_count();
+        if (vm.execute(50) || shared.use_count() != before) {
+            std::cout << "    [FAIL] BETA copied the shared close column (" << before << " -> " << shared.use_count() << ")" << std::endl;
+            return;
+        }
+    }
+    {
+        // 同一只读序列以两个名字注册：一个名字写时复制后另一个仍受保护；都不再引用后登记随之删除
+        PineVM vm;
+        const long before = shared.use_count();
+        vm.registerSeries("close", shared_close);
+        vm.registerSeries("open", shared_close);
+        Series* close = vm.getSeries("close");
+        Series* open = vm.getSeries("open");
+        if (close == shared.get() || open == shared.get() || close == open || shared.use_count() != before) {
+            std::cout << "    [FAIL] Detached inputs still share or hold the shared column." << std::endl;
+            return;
+        }
+        vm.registerSeries("close", shared_close);
+        vm.registerSeries("close", std::make_shared<Series>());
+        if (shared.use_count() != before) {
+            std::cout << "    [FAIL] Re-registered input left a stale shared entry." << std::endl;
+            return;
+        }
+    }
+    if (shared->name != "close" || shared->isBounded() || shared->data != closes) {
+        std::cout << "    [FAIL] Shared input was modified." << std::endl;
+        return;
+    }
+    std::cout << "    [PASS] " << shared.use_count() << " reference(s) left, shared data unchanged" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 参数扫描：每个组合与把参数值直接写进脚本后单独计算的结果一致，与参数无关的序列只算一次
+void run_sweep_test() {
+    total_tests++;
+    std::cout << "--- Running test: parameter sweep ---" << std::endl;
+
+    const std::string body = "A:HHV(H,9)-LLV(L,9); B:MA(C,N)+A; D:EMA(C,M)*(C-O)/(H-L);";
+    std::map<std::string, std::shared_ptr<const Series>> inputs;
+    for (const char* name : {"open", "high", "low", "close"}) {
+        auto series = std::make_shared<Series>();
+        series->name = name;
+        for (int i = 0; i < 120; ++i) {
+            series->data.push_back(100 + 8 * std::sin(i * 0.15) + (name[0] == 'h' ? 3 : name[0] == 'l' ? -3 : name[0] == 'o' ? 1 : 0));
+        }
+        inputs[name] = series;
+    }
+
+    HithinkCompiler compiler;
+    const Bytecode bytecode = compiler.compile("N:=5; M:=3; " + body);
+    const auto results = runSweep(bytecode, inputs, {{"N", {3, 5, 8}}, {"M", {2, 4}}}, 4);
+    if (results.size() != 6) {
+        std::cout << "    [FAIL] Expected 6 combinations, got " << results.size() << std::endl;
+        return;
+    }
+
+    for (const SweepResult& result : results) {
+        const std::string script = "N:=" + std::to_string(static_cast<int>(result.parameters[0])) +
+                                   "; M:=" + std::to_string(static_cast<int>(result.parameters[1])) + "; " + body;
+        HithinkCompiler reference_compiler;
+        const Bytecode reference = reference_compiler.compile(script);
+        PineVM vm;
+        for (const auto& pair : inputs) {
+            vm.registerSeries(pair.first, pair.second);
+        }
+        vm.loadBytecode(reference);
+        if (result.status != 0 || vm.execute(120) != 0) {
+            std::cout << "    [EXECUTION FAILED] " << script << " " << result.error_message << std::endl;
+            return;
+        }
+        for (const std::string name : {"A", "B", "D"}) {
+            const size_t g = std::find(bytecode.global_name_pool.begin(), bytecode.global_name_pool.end(), name) - bytecode.global_name_pool.begin();
+            const size_t r = std::find(reference.global_name_pool.begin(), reference.global_name_pool.end(), name) - reference.global_name_pool.begin();
+            const auto& expected = std::get<std::shared_ptr<Series>>(vm.getGlobalSeries()[r])->data;
+            const auto& actual = result.series.at(g)->data;
+            if (expected.size() != actual.size() || !std::equal(expected.begin(), expected.end(), actual.begin(), are_equal)) {
+                std::cout << "    [FAIL] " << script << " series " << name << " differs." << std::endl;
+                return;
+            }
+        }
+    }
+
+    const size_t a = std::find(bytecode.global_name_pool.begin(), bytecode.global_name_pool.end(), "A") - bytecode.global_name_pool.begin();
+    if (results[0].series[a] != results[5].series[a]) {
+        std::cout << "    [FAIL] Parameter-independent series A was computed per combination." << std::endl;
+        return;
+    }
+    std::cout << "    [PASS] 6 combinations match, A shared" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 最后一根K线模式：只执行所需的后缀，最后一根K线上的全局变量与全量计算一致
+void run_last_bar_test() {
+    total_tests++;
+    std::cout << "--- Running test: last-bar mode ---" << std::endl;
+
+    auto close = std::make_shared<Series>();
+    close->name = "close";
+    for (int i = 0; i < 1000; ++i) {
+        close->data.push_back(100 + 10 * std::sin(i * 0.05) + 3 * std::cos(i * 0.7));
+    }
+    std::shared_ptr<const Series> input = close;
+
+    struct Case { const char* script; int start; };
+    const Case cases[] = {
+        {"A:=MA(C,5); B:REF(A,10)+MA(A,3);", 1000 - 1 - 10},
+        {"SELECT CROSS(MA(C,5),MA(C,20)) AND EMA(C,12)>REF(C,3);", 1000 - 1 - 250},
+        {"V:VALUEWHEN(C>105,C);", 0},
+    };
+    for (const Case& c : cases) {
+        HithinkCompiler compiler;
+        const Bytecode bytecode = compiler.compile(c.script);
+        PineVM full, last;
+        full.registerSeries("close", input);
+        last.registerSeries("close", input);
+        full.loadBytecode(bytecode);
+        last.loadBytecode(bytecode);
+        last.setLastBarMode(true);
+        if (last.lastBarStart(1000) != c.start) {
+            std::cout << "    [FAIL] " << c.script << " starts at " << last.lastBarStart(1000) << ", expected " << c.start << std::endl;
+            return;
+        }
+        if (full.execute(1000) || last.execute(1000)) {
+            std::cout << "    [EXECUTION FAILED] " << c.script << std::endl;
+            return;
+        }
+        const auto full_globals = full.getGlobalSeries();
+        const auto last_globals = last.getGlobalSeries();
+        for (size_t g = 0; g < full_globals.size(); ++g) {
+            const auto* a = std::get_if<std::shared_ptr<Series>>(&full_globals[g]);
+            const auto* b = std::get_if<std::shared_ptr<Series>>(&last_globals[g]);
+            if (!a || !b || !are_equal((*a)->getCurrent(999), (*b)->getCurrent(999))) {
+                std::cout << "    [FAIL] " << c.script << " global " << g << " differs on the last bar." << std::endl;
+                return;
+            }
+        }
+    }
+    std::cout << "    [PASS] last-bar values match full history" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 盘中试算：同一根K线反复试算后确认，结果与只用最终数据逐根计算相同
+void run_tentative_bar_test() {
+    total_tests++;
+    std::cout << "--- Running test: tentative bar evaluation ---" << std::endl;
+
+    const int bars = 60;
+    const int history = 50;
+    std::vector<double> closes;
+    for (int i = 0; i < bars; ++i) {
+        closes.push_back(100 + 6 * std::sin(i * 0.3) + (i % 7) * 0.5);
+    }
+
+    HithinkCompiler compiler;
+    const Bytecode bytecode = compiler.compile("R:RSI(C,6); F:FILTER(C>REF(C,1),3); E:EMA(C,5); X:RAND()*C; S:STD(C,40); A:AVEDEV(C,100); W:SUM(C,N); N:=10;");
+    if (compiler.hadError()) {
+        std::cout << "    [COMPILATION FAILED]" << std::endl;
+        return;
+    }
+
+    PineVM full, live;
+    auto full_close = std::make_shared<Series>();
+    full_close->name = "close";
+    full_close->data = closes;
+    full.registerSeries("close", full_close);
+    auto live_close = std::make_shared<Series>();
+    live_close->name = "close";
+    live_close->data.assign(closes.begin(), closes.begin() + history);
+    live.registerSeries("close", live_close);
+    full.loadBytecode(bytecode);
+    live.loadBytecode(bytecode);
+    full.setRandomSeed(7);
+    live.setRandomSeed(7);
+
+    if (full.execute(bars) || live.execute(history)) {
+        std::cout << "    [EXECUTION FAILED]" << std::endl;
+        return;
+    }
+    for (int bar = history; bar < bars; ++bar) {
+        // 若干个偏离最终值的 tick，最后一个 tick 是收盘价；最后一根不试算，直接确认
+        for (int tick = 0; tick < 4 && bar + 1 < bars; ++tick) {
+            live.getSeries("close")->setCurrent(bar, closes[bar] + (tick - 2) * 1.5);
+            if (live.executeTentative() || live.getCurrentBarIndex() != bar) {
+                std::cout << "    [FAIL] Tentative evaluation of bar " << bar << " failed." << std::endl;
+                return;
+            }
+        }
+        live.getSeries("close")->setCurrent(bar, closes[bar]);
+        if ((bar + 1 < bars && live.executeTentative()) || live.commitBar()) {
+            std::cout << "    [FAIL] Commit of bar " << bar << " failed." << std::endl;
+            return;
+        }
+    }
+
+    const auto& a = full.getGlobalSeries();
+    const auto& b = live.getGlobalSeries();
+    for (size_t g = 0; g < a.size(); ++g) {
+        const auto& sa = std::get<std::shared_ptr<Series>>(a[g])->data;
+        const auto& sb = std::get<std::shared_ptr<Series>>(b[g])->data;
+        if (sa.size() != sb.size() || !std::equal(sa.begin(), sa.end(), sb.begin(), are_equal)) {
+            std::cout << "    [FAIL] Global " << g << " differs from full evaluation." << std::endl;
+            return;
+        }
+    }
+    std::cout << "    [PASS] " << (bars - history) << " bars committed after repeated ticks" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 状态快照：中途保存、在新 VM 中恢复后继续计算，结果与全量计算相同；字节码不同时拒绝恢复
+void run_checkpoint_test() {
+    total_tests++;
+    std::cout << "--- Running test: checkpoint and restore ---" << std::endl;
+
+    auto close = std::make_shared<Series>();
+    close->name = "close";
+    for (int i = 0; i < 200; ++i) {
+        close->data.push_back(100 + 7 * std::sin(i * 0.2) + (i % 5));
+    }
+    std::shared_ptr<const Series> input = close;
+
+    HithinkCompiler compiler;
+    const Bytecode bytecode = compiler.compile("R:RSI(C,6); E:EMA(C,9); F:FILTER(C>REF(C,1),3); H:HHV(C,10)-REF(C,2); X:RAND()*C;");
+    PineVM full, first;
+    full.registerSeries("close", input);
+    first.registerSeries("close", input);
+    full.loadBytecode(bytecode);
+    first.loadBytecode(bytecode);
+    if (full.execute(200) || first.execute(120)) {
+        std::cout << "    [EXECUTION FAILED]" << std::endl;
+        return;
+    }
+    std::stringstream snapshot;
+    first.saveCheckpoint(snapshot);
+
+    PineVM restored;
+    restored.registerSeries("close", input);
+    restored.loadBytecode(bytecode);
+    try {
+        restored.restoreCheckpoint(snapshot);
+    } catch (const std::exception& e) {
+        std::cout << "    [FAIL] Restore failed: " << e.what() << std::endl;
+        return;
+    }
+    if (restored.getCurrentBarIndex() != 120 || restored.execute(200)) {
+        std::cout << "    [FAIL] Restored VM did not continue from bar 120." << std::endl;
+        return;
+    }
+    const auto& a = full.getGlobalSeries();
+    const auto& b = restored.getGlobalSeries();
+    for (size_t g = 0; g < a.size(); ++g) {
+        const auto& sa = std::get<std::shared_ptr<Series>>(a[g])->data;
+        const auto& sb = std::get<std::shared_ptr<Series>>(b[g])->data;
+        if (sa.size() != sb.size() || !std::equal(sa.begin(), sa.end(), sb.begin(), are_equal)) {
+            std::cout << "    [FAIL] Global " << g << " differs from full replay." << std::endl;
+            return;
+        }
+    }
+
+    {
+        // 字符串全局变量与直接别名输入序列的全局变量 (输入序列被改名为 A) 按槽位还原
+        HithinkCompiler alias_compiler;
+        const Bytecode alias_bytecode = alias_compiler.compile("A:=C; S:'abc'; B:A+1;");
+        PineVM saved, loaded;
+        for (PineVM* vm : {&saved, &loaded}) {
+            vm->registerSeries("close", std::make_shared<Series>(*close));
+            vm->loadBytecode(alias_bytecode);
+        }
+        std::stringstream alias_snapshot;
+        if (saved.execute(120)) {
+            std::cout << "    [EXECUTION FAILED] " << saved.getLastErrorMessage() << std::endl;
+            return;
+        }
+        saved.saveCheckpoint(alias_snapshot);
+        try {
+            loaded.restoreCheckpoint(alias_snapshot);
+        } catch (const std::exception& e) {
+            std::cout << "    [FAIL] Restore failed: " << e.what() << std::endl;
+            return;
+        }
+        const Value text = loaded.getGlobal("S");
+        const Value alias = loaded.getGlobal("A");
+        if (!std::holds_alternative<std::string>(text) || std::get<std::string>(text) != "abc") {
+            std::cout << "    [FAIL] String global was not restored." << std::endl;
+            return;
+        }
+        if (!std::holds_alternative<std::shared_ptr<Series>>(alias) || std::get<std::shared_ptr<Series>>(alias)->name != "A") {
+            std::cout << "    [FAIL] Aliased global was not restored under its own name." << std::endl;
+            return;
+        }
+        if (loaded.execute(200) || std::get<std::shared_ptr<Series>>(loaded.getGlobal("B"))->getCurrent(199) != close->data[199] + 1) {
+            std::cout << "    [FAIL] Restored VM with aliased global did not continue." << std::endl;
+            return;
+        }
+    }
+
+    PineVM other;
+    other.registerSeries("close", input);
+    HithinkCompiler other_compiler;
+    other.loadBytecode(other_compiler.compile("R:RSI(C,7);"));
+    snapshot.clear();
+    snapshot.seekg(0);
+    try {
+        other.restoreCheckpoint(snapshot);
+        std::cout << "    [FAIL] Checkpoint restored into different bytecode." << std::endl;
+        return;
+    } catch (const std::runtime_error&) {
+    }
+    std::cout << "    [PASS] " << snapshot.str().size() << " byte snapshot, continuation matches full replay" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 二进制字节码与公式库：往返后与原字节码相同，损坏时拒绝加载，从映射的库中加载的公式结果不变
+void run_binary_bytecode_test() {
+    total_tests++;
+    std::cout << "--- Running test: binary bytecode and library ---" << std::endl;
+
+    const char* scripts[] = {"M:MA(C,5); D:C-REF(C,1);", "R:RSI(C,6); E:EMA(C,0.1+9);", "SELECT CROSS(MA(C,5),MA(C,20));"};
+    std::vector<std::pair<std::string, Bytecode>> formulas;
+    for (const char* script : scripts) {
+        HithinkCompiler compiler;
+        formulas.push_back({script, compiler.compile(script)});
+    }
+
+    for (const auto& formula : formulas) {
+        const std::string binary = bytecodeToBinary(formula.second);
+        const Bytecode decoded = binaryToBytecode(binary.data(), binary.size());
+        if (bytecodeToBinary(decoded) != binary || bytecodeToTxt(decoded) != bytecodeToTxt(formula.second)) {
+            std::cout << "    [FAIL] Round trip changed " << formula.first << std::endl;
+            return;
+        }
+        std::string corrupted = binary;
+        corrupted[corrupted.size() - 1] ^= 0x20;
+        try {
+            binaryToBytecode(corrupted.data(), corrupted.size());
+            std::cout << "    [FAIL] Corrupted bytecode was accepted." << std::endl;
+            return;
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    const std::string path = "bytecode_library_test.pvml";
+    BytecodeLibrary::write(path, formulas);
+    BytecodeLibrary library;
+    library.open(path);
+    auto close = std::make_shared<Series>();
+    close->name = "close";
+    for (int i = 0; i < 80; ++i) {
+        close->data.push_back(50 + 4 * std::sin(i * 0.25));
+    }
+    std::shared_ptr<const Series> input = close;
+    bool ok = library.size() == formulas.size();
+    for (const auto& formula : formulas) {
+        const int index = library.find(formula.first);
+        if (index < 0) {
+            ok = false;
+            break;
+        }
+        PineVM direct, mapped;
+        direct.registerSeries("close", input);
+        mapped.registerSeries("close", input);
+        direct.loadBytecode(formula.second);
+        mapped.loadBytecode(library.load(index));
+        if (direct.execute(80) || mapped.execute(80)) {
+            ok = false;
+            break;
+        }
+        for (size_t g = 0; g < direct.getGlobalSeries().size(); ++g) {
+            const auto& a = std::get<std::shared_ptr<Series>>(direct.getGlobalSeries()[g])->data;
+            const auto& b = std::get<std::shared_ptr<Series>>(mapped.getGlobalSeries()[g])->data;
+            ok = ok && a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), are_equal);
+        }
+    }
+    library.close();
+    std::remove(path.c_str());
+    if (!ok || library.find(scripts[0]) != -1) {
+        std::cout << "    [FAIL] Formulas loaded from the library differ." << std::endl;
+        return;
+    }
+    std::cout << "    [PASS] " << formulas.size() << " formulas round-trip through the binary format and library" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 编译缓存：规范化后相同的源码只编译一次，LRU 淘汰，磁盘缓存跨实例复用，编译失败不缓存
+void run_compile_cache_test() {
+    total_tests++;
+    std::cout << "--- Running test: compile cache ---" << std::endl;
+
+    int compiles = 0;
+    auto hithink = [&](const std::string& source) {
+        ++compiles;
+        HithinkCompiler compiler;
+        Bytecode bytecode = compiler.compile(source);
+        if (compiler.hadError()) {
+            throw std::runtime_error("Hithink compilation failed.");
+        }
+        return bytecode;
+    };
+
+    const std::string directory = "compile_cache_test_dir";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    bool ok = true;
+    {
+        CompileCache cache(2, directory);
+        auto first = cache.get("hithink", "M:MA(C,5);", hithink);
+        auto again = cache.get("hithink", "\r\n  M:MA(C,5);   \r\n\r\n", hithink);
+        ok = ok && first == again && compiles == 1 && cache.hits() == 1 && cache.misses() == 1;
+        ok = ok && cache.get("hithink", "M:MA(C, 5);", hithink) != first && compiles == 2;
+        ok = ok && CompileCache::normalizeSource("pine", "a =  1\n    b") == "a =  1\n    b";
+        ok = ok && CompileCache::normalizeSource("hithink", "X:'a  b'  +1;") == "X:'a  b' +1;";
+
+        // 容量为 2：第三个公式淘汰最久未用的，之后再取时从磁盘读取而不是重新编译
+        cache.get("hithink", "E:EMA(C,9);", hithink);
+        ok = ok && cache.size() == 2 && compiles == 3;
+        ok = ok && cache.get("hithink", "M:MA(C,5);", hithink) != first && compiles == 3;
+
+        try {
+            cache.get("hithink", "M:MA(C,5", hithink);
+            ok = false;
+        } catch (const std::runtime_error&) {
+        }
+        try {
+            cache.get("hithink", "M:MA(C,5", hithink);
+            ok = false;
+        } catch (const std::runtime_error&) {
+        }
+        ok = ok && compiles == 5;
+    }
+    {
+        CompileCache restarted(16, directory);
+        auto bytecode = restarted.get("hithink", "E:EMA(C,9);", hithink);
+        HithinkCompiler compiler;
+        ok = ok && compiles == 5 && bytecodeToTxt(*bytecode) == bytecodeToTxt(compiler.compile("E:EMA(C,9);"));
+    }
+    std::filesystem::remove_all(directory);
+    if (!ok) {
+        std::cout << "    [FAIL] Cache behaved unexpectedly (" << compiles << " compiles)." << std::endl;
+        return;
+    }
+    std::cout << "    [PASS] " << compiles << " compiles for 9 requests" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
+// 窗口长度在两个值之间切换，与脚本中的 N:=IF(MOD(BARSCOUNT(C),150)>75,long,short) 相同 (C 从第 first_valid 根开始有效)
+int switching_length(int bar, int first_valid, int long_length, int short_length) {
+    const int counted = bar < first_valid ? 0 : bar - first_valid + 1;
+    return counted % 150 > 75 ? long_length : short_length;
+}
+
+// 滑动窗口求和的递推状态 (MA/SUM/COUNT)：长窗口、NaN 缺口和逐根变化的窗口长度下与逐根求和一致，流式执行结果相同
+void run_window_sum_test() {
+    const int bars = 600;
+    std::vector<double> close;
+    for (int i = 0; i < bars; ++i) {
+        // 中间有一段 NaN，窗口移出后要重新变为有效
+        close.push_back(i >= 200 && i < 205 ? NAN : 100 + 10 * std::sin(i * 0.05) + 3 * std::cos(i * 0.7));
+    }
+    // 窗口内非 NaN 值的和、个数以及大于 100 的个数
+    auto window = [&](int bar, int length, double& sum, int& valid, int& above) {
+        sum = 0.0;
+        valid = above = 0;
+        for (int k = 0; k < length && bar - k >= 0; ++k) {
+            if (!std::isnan(close[bar - k])) {
+                sum += close[bar - k];
+                valid++;
+                above += close[bar - k] > 100;
+            }
+        }
+    };
+    run_incremental_test("window sums",
+        "N:=IF(MOD(BARSCOUNT(C),150)>75,150,40); A:MA(C,40); B:SUM(C,150); D:COUNT(C>100,N); E:MA(C,N);",
+        {{"close", close}},
+        [&](int bar) {
+            std::map<std::string, double> expected;
+            double sum;
+            int valid, above;
+            window(bar, 40, sum, valid, above);
+            expected["A"] = valid == 40 ? sum / 40 : NAN;
+            window(bar, 150, sum, valid, above);
+            expected["B"] = valid == 150 ? sum : NAN;
+            const int n = switching_length(bar, 0, 150, 40);
+            window(bar, n, sum, valid, above);
+            expected["D"] = above;
+            expected["E"] = valid == n ? sum / n : NAN;
+            return expected;
+        }, 1e-9);
+    run_streaming_test("window sums", "A:MA(C,40); B:SUM(C,150); D:COUNT(C>100,60);", {{"close", close}});
+}
+
+// 窗口最值的分块递推 (HHV/HHVBARS/LLVBARS/LV/LLV)：结果 (包括相等时取哪一根) 与逐根扫描逐位一致
+void run_window_extreme_test() {
+    const int bars = 500;
+    std::vector<double> close;
+    for (int i = 0; i < bars; ++i) {
+        // 取整制造大量相等的值，并夹杂 NaN
+        close.push_back(i % 37 == 3 ? NAN : std::round(100 + 8 * std::sin(i * 0.07) + (i * 7 % 5)));
+    }
+    // [bar - offset - length + 1, bar - offset] 中最大 (highest) 或最小值的下标，跳过 NaN；
+    // oldest_on_tie 为 true 时相等取最早的一根，否则取最近的一根
+    auto extreme = [&](int bar, int length, bool highest, bool oldest_on_tie, int offset) {
+        int best = -1;
+        for (int k = offset; k < offset + length && bar - k >= 0; ++k) {
+            const double val = close[bar - k];
+            if (std::isnan(val)) {
+                continue;
+            }
+            if (best < 0 || (highest ? val > close[best] : val < close[best]) || (oldest_on_tie && val == close[best])) {
+                best = bar - k;
+            }
+        }
+        return best;
+    };
+    auto value = [&](int index) { return index < 0 ? NAN : close[index]; };
+    auto distance = [](int bar, int index) { return index < 0 ? -1.0 : static_cast<double>(bar - index); };
+    run_incremental_test("window extremes",
+        "N:=IF(MOD(BARSCOUNT(C),150)>75,100,40); A:HHV(C,40); B:HHVBARS(C,100); D:LLVBARS(C,N); E:LV(C,100); F:LLV(C,N);",
+        {{"close", close}},
+        [&](int bar) {
+            const int n = switching_length(bar, 0, 100, 40);
+            return std::map<std::string, double>{
+                {"A", value(extreme(bar, 40, true, false, 0))},
+                {"B", distance(bar, extreme(bar, 100, true, true, 0))},
+                {"D", distance(bar, extreme(bar, n, false, true, 0))},
+                {"E", value(extreme(bar, 100, false, false, 1))},
+                {"F", value(extreme(bar, n, false, false, 0))}};
+        });
+    run_streaming_test("window extremes", "A:HHV(C,40); B:HHVBARS(C,100); D:LLVBARS(C,60); E:LV(C,100);", {{"close", close}});
+}
+
+// 窗口统计量的递推 (STD/VARP/DEVSQ/AVEDEV)：与两遍扫描一致 (相对误差很小)
+void run_window_moments_test() {
+    const int bars = 600;
+    std::vector<double> close;
+    for (int i = 0; i < bars; ++i) {
+        // 均值远大于波动，检验重新居中后的精度；后半段没有 NaN，长窗口重新变为全部有效
+        close.push_back(i % 53 == 7 && i < 300 ? NAN : 10000 + 20 * std::sin(i * 0.05) + (i * 7 % 11) * 0.3);
+    }
+    // 窗口内非 NaN 值的个数、离差平方和与离差绝对值之和
+    auto moments = [&](int bar, int length, double& n, double& sq, double& dev) {
+        std::vector<double> values;
+        for (int k = 0; k < length && bar - k >= 0; ++k) {
+            if (!std::isnan(close[bar - k])) {
+                values.push_back(close[bar - k]);
+            }
+        }
+        n = static_cast<double>(values.size());
+        sq = dev = values.empty() ? NAN : 0.0;
+        const double mean = std::accumulate(values.begin(), values.end(), 0.0) / n;
+        for (double val : values) {
+            sq += (val - mean) * (val - mean);
+            dev += std::abs(val - mean);
+        }
+    };
+    run_incremental_test("window moments",
+        "N:=IF(MOD(BARSCOUNT(C),150)>75,120,40); A:STD(C,40); B:VARP(C,200); D:DEVSQ(C,N); E:AVEDEV(C,100); F:STD(C,N);",
+        {{"close", close}},
+        [&](int bar) {
+            std::map<std::string, double> expected;
+            double n, sq, dev;
+            moments(bar, 40, n, sq, dev);
+            expected["A"] = n == 40 ? std::sqrt(sq / (n - 1)) : NAN;
+            moments(bar, 200, n, sq, dev);
+            expected["B"] = n == 200 ? sq / n : NAN;
+            moments(bar, 100, n, sq, dev);
+            expected["E"] = dev / n;
+            const int length = switching_length(bar, 0, 120, 40);
+            moments(bar, length, n, sq, dev);
+            expected["D"] = sq;
+            expected["F"] = n == length ? std::sqrt(sq / (n - 1)) : NAN;
+            return expected;
+        }, 1e-9);
+    run_streaming_test("window moments", "A:STD(C,40); B:VARP(C,200); D:DEVSQ(C,60); E:AVEDEV(C,100);", {{"close", close}});
+}
+
+// 回归类函数的递推 (SLOPE/FORCAST/RELATE/COVAR)：与两遍扫描一致 (相对误差很小)
+void run_window_regression_test() {
+    const int bars = 600;
+    std::vector<double> close, open;
+    for (int i = 0; i < bars; ++i) {
+        close.push_back(i % 71 == 9 && i < 300 ? NAN : 3000 + 40 * std::sin(i * 0.03) + (i * 7 % 11) * 0.5);
+        open.push_back(3000 + 35 * std::sin(i * 0.03 + 0.2) + (i * 3 % 7) * 0.4);
+    }
+    // 窗口内 (x, y) 的均值、离差平方和与乘积和，x 为K线下标 (by_time) 或收盘价，y 为收盘价或开盘价；
+    // 窗口不完整或含 NaN 时返回 false
+    struct Regression {
+        double mean_x = 0.0, mean_y = 0.0, sxx = 0.0, syy = 0.0, sxy = 0.0;
+    };
+    auto regression = [&](int bar, int length, bool by_time, Regression& r) {
+        r = Regression();
+        if (bar < length - 1) {
+            return false;
+        }
+        auto x = [&](int i) { return by_time ? static_cast<double>(i) : close[i]; };
+        auto y = [&](int i) { return by_time ? close[i] : open[i]; };
+        for (int k = 0; k < length; ++k) {
+            if (std::isnan(close[bar - k])) {
+                return false;
+            }
+            r.mean_x += x(bar - k) / length;
+            r.mean_y += y(bar - k) / length;
+        }
+        for (int k = 0; k < length; ++k) {
+            const double dx = x(bar - k) - r.mean_x, dy = y(bar - k) - r.mean_y;
+            r.sxx += dx * dx;
+            r.syy += dy * dy;
+            r.sxy += dx * dy;
+        }
+        return true;
+    };
+    run_incremental_test("window regression",
+        "N:=IF(MOD(BARSCOUNT(C),150)>75,120,40); A:SLOPE(C,60); B:FORCAST(C,200); D:RELATE(C,O,60); E:COVAR(C,O,N); F:SLOPE(C,N);",
+        {{"close", close}, {"open", open}},
+        [&](int bar) {
+            std::map<std::string, double> expected;
+            Regression r;
+            expected["A"] = regression(bar, 60, true, r) ? r.sxy / r.sxx : NAN;
+            expected["B"] = regression(bar, 200, true, r) ? r.mean_y + r.sxy / r.sxx * (bar - r.mean_x) : NAN;
+            expected["D"] = regression(bar, 60, false, r) ? r.sxy / std::sqrt(r.sxx * r.syy) : NAN;
+            const int n = switching_length(bar, 0, 120, 40);
+            expected["E"] = regression(bar, n, false, r) ? r.sxy / (n - 1) : NAN;
+            expected["F"] = regression(bar, n, true, r) ? r.sxy / r.sxx : NAN;
+            return expected;
+        }, 1e-9);
+    run_streaming_test("window regression", "A:SLOPE(C,60); B:FORCAST(C,200); D:RELATE(C,O,60); E:COVAR(C,O,60);",
+                       {{"close", close}, {"open", open}});
+}
+
+// BARSLAST 等计数函数的递推：与逐根向前扫描的结果完全一致
+void run_bars_counting_test() {
+    const int bars = 400;
+    const int first_valid = 5;
+    std::vector<double> close;
+    for (int i = 0; i < bars; ++i) {
+        // 开头一段 NaN，中间成立的间隔长短不一
+        close.push_back(i < first_valid || i % 97 == 50 ? NAN : ((i * 37) % 23 < 4 ? 1.0 : 0.0));
+    }
+    auto is_true = [&](int i) { return !std::isnan(close[i]) && close[i] != 0.0; };
+    // 最近 n 次成立中最早一次的下标 (不足 n 次时为第一次成立)，从未成立时为 -1
+    auto nth_true = [&](int bar, int n) {
+        int found = -1, seen = 0;
+        for (int k = bar; k >= 0 && seen < n; --k) {
+            if (is_true(k)) {
+                found = k;
+                seen++;
+            }
+        }
+        return found;
+    };
+    run_incremental_test("bars counting",
+        "N:=IF(MOD(BARSCOUNT(C),150)>75,5,3); A:BARSCOUNT(C); B:BARSLAST(C); D:BARSLASTCOUNT(C); E:BARSSINCE(C); "
+        "F:BARSSINCEN(C,3); G:BARSSTATUS(C); H:BARSSINCEN(C,N);",
+        {{"close", close}},
+        [&](int bar) {
+            const int last_true = nth_true(bar, 1);
+            const int nth = nth_true(bar, 3);
+            const int switched = nth_true(bar, switching_length(bar, first_valid, 5, 3));
+            int run = 0;
+            for (int k = bar; k >= 0 && is_true(k); --k) {
+                run++;
+            }
+            return std::map<std::string, double>{
+                {"A", bar < first_valid ? 0.0 : static_cast<double>(bar - first_valid + 1)},
+                {"B", last_true < 0 ? NAN : static_cast<double>(bar - last_true)},
+                {"D", static_cast<double>(run)},
+                {"E", last_true < 0 ? -1.0 : static_cast<double>(bar - last_true)},
+                {"F", nth < 0 ? -1.0 : static_cast<double>(bar - nth)},
+                {"G", static_cast<double>(run)},
+                {"H", switched < 0 ? -1.0 : static_cast<double>(bar - switched)}};
+        });
+    run_streaming_test("bars counting", "A:BARSCOUNT(C); B:BARSLAST(C); D:BARSLASTCOUNT(C); E:BARSSINCE(C); G:BARSSTATUS(C);",
+                       {{"close", close}});
+    // BARSSINCEN 向前查找的范围不固定，输入保持无界
+    run_streaming_test("bars since n", "F:BARSSINCEN(C,3);", {{"close", close}}, "close");
+}
+
+// 各指令集实现与标量语义 applyBinaryOp 逐元素比较 (NaN、±inf、±0、除零等边界值)
+void run_kernel_test() {
+    total_tests++;
+    std::cout << "--- Running test: binary op kernels (" << kernelIsaName(detectKernelIsa()) << ") ---" << std::endl;
+
+    const double edge[] = {0.0, -0.0, 1.0, -1.0, 2.5, NAN, INFINITY, -INFINITY, 1e-300, 3.0};
+    std::vector<double> a, b;
+    for (double x : edge) {
+        for (double y : edge) {
+            a.push_back(x);
+            b.push_back(y);
+        }
+    }
+    a.push_back(7.0); b.push_back(0.0); // 奇数长度，覆盖尾部处理
+
+    const OpCode ops[] = {OpCode::ADD, OpCode::SUB, OpCode::MUL, OpCode::DIV,
+                          OpCode::LESS, OpCode::LESS_EQUAL, OpCode::EQUAL_EQUAL, OpCode::BANG_EQUAL,
+                          OpCode::GREATER, OpCode::GREATER_EQUAL, OpCode::LOGICAL_AND, OpCode::LOGICAL_OR};
+    const KernelIsa isas[] = {KernelIsa::Scalar, KernelIsa::SSE2, KernelIsa::AVX2};
+
+    const size_t n = a.size();
+    std::vector<double> out(n);
+    bool ok = true;
+    for (KernelIsa isa : isas) {
+        forceKernelIsa(isa);
+        for (OpCode op : ops) {
+            // 三种形态：序列 op 序列、序列 op 标量、标量 op 序列
+            for (int shape = 0; shape < 3 && ok; ++shape) {
+                for (double scalar : {0.0, 2.0, (double)NAN}) {
+                    binaryOpKernel(op, shape == 2 ? nullptr : a.data(), scalar,
+                                   shape == 1 ? nullptr : b.data(), scalar, out.data(), n);
+                    for (size_t i = 0; i < n; ++i) {
+                        double expected = applyBinaryOp(op, shape == 2 ? scalar : a[i], shape == 1 ? scalar : b[i]);
+                        if (!(std::isnan(expected) ? std::isnan(out[i]) : expected == out[i])) {
+                            std::cout << "    [FAIL] isa=" << kernelIsaName(activeKernelIsa()) << " op=" << static_cast<int>(op)
+                                      << " index=" << i << " expected " << expected << ", got " << out[i] << std::endl;
+                            ok = false;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    forceKernelIsa(detectKernelIsa());
+
+    if (ok) {
+        std::cout << "    [PASS]" << std::endl;
+        passed_tests++;
+    }
+    std::cout << std::endl;
+}
+
+// 优化后的字节码：常量已折叠、常量池无重复、被覆盖的存储与无用表达式已删除
+void run_optimizer_test() {
+    total_tests++;
+    std::cout << "--- Running test: bytecode optimizer ---" << std::endl;
+
+    HithinkCompiler compiler;
+    Bytecode bytecode = compiler.compile("A:=C*(1+2); A:=C; B:-(2*3); 1+2; RESULT:MA(C,2)+MA(A,2)+B;");
+    bool ok = !compiler.hadError();
+
+    // 期望: PUSH_CONST -6 / STORE_EXPORT B，A 只剩一次存储，没有常量之间的运算
+    int stores_a = 0;
+    for (size_t i = 0; i < bytecode.instructions.size(); ++i) {
+        const Instruction& instr = bytecode.instructions[i];
+        if (instr.op == OpCode::STORE_GLOBAL && bytecode.global_name_pool[instr.operand] == "A") stores_a++;
+        if (i >= 2 && instr.op >= OpCode::ADD && instr.op <= OpCode::GREATER_EQUAL &&
+            bytecode.instructions[i - 1].op == OpCode::PUSH_CONST && bytecode.instructions[i - 2].op == OpCode::PUSH_CONST) {
+            std::cout << "    [FAIL] Unfolded constant expression at " << i << std::endl;
+            ok = false;
+        }
+    }
+    if (stores_a != 1) {
+        std::cout << "    [FAIL] Expected one store to A, got " << stores_a << std::endl;
+        ok = false;
+    }
+    for (size_t i = 0; i < bytecode.constant_pool.size(); ++i) {
+        for (size_t j = i + 1; j < bytecode.constant_pool.size(); ++j) {
+            if (bytecode.constant_pool[i] == bytecode.constant_pool[j]) {
+                std::cout << "    [FAIL] Duplicate constants " << i << " and " << j << std::endl;
+                ok = false;
+            }
+        }
+    }
+    std::cout << bytecodeToTxt(bytecode);
+
+    if (ok) {
+        std::cout << "    [PASS]" << std::endl;
+        passed_tests++;
+    }
+    std::cout << std::endl;
+}
+
+// 公共子表达式消除：相同参数的纯函数调用只保留一次，有副作用的调用 (rand) 不合并；
+// 优化前后的全局变量 (名称和逐根数值) 与输出结果须完全一致，隐藏的 __cseN 变量不对外可见
+void run_cse_test() {
+    total_tests++;
+    std::cout << "--- Running test: common subexpression elimination ---" << std::endl;
+
+    HithinkCompiler compiler;
+    Bytecode bytecode = compiler.compile(
+        "RSV:=(CLOSE-LLV(LOW,9))/(HHV(HIGH,9)-LLV(LOW,9))*100; A:LLV(LOW,9)+1; R1:rand(); R2:rand();");
+    std::map<std::string, int> calls;
+    for (const Instruction& instr : bytecode.instructions) {
+        if (instr.op == OpCode::CALL_BUILTIN_FUNC) {
+            calls[std::get<std::string>(bytecode.constant_pool[instr.operand])]++;
+        }
+    }
+    if (compiler.hadError() || calls["llv"] != 1 || calls["hhv"] != 1 || calls["rand"] != 2) {
+        std::cout << "    [FAIL] llv x" << calls["llv"] << ", hhv x" << calls["hhv"] << ", rand x" << calls["rand"] << std::endl;
+        return;
+    }
+
+    const std::vector<std::string> scripts = {
+        // 合并后的调用结果不能与之后被改写的全局变量共享序列
+        "T: EMA(close,3)+1; X := EMA(close,3); X := X*2;",
+        // 两个输出不能指向同一个序列 (否则改名后表头为 B,B)
+        "A: MA(close,3); B: MA(close,3);",
+        "X := MA(C,5); Y: MA(C,5)*2; X := X+1; Z: MA(C,5)-X; W: (C-O)*(C-O)+(C-O);",
+        "RSV:=(CLOSE-LLV(LOW,9))/(HHV(HIGH,9)-LLV(LOW,9))*100; K:SMA(RSV,3,1); D:SMA(K,3,1); J:3*K-2*D; A:LLV(LOW,9)+1;",
+    };
+    std::map<std::string, std::vector<double>> inputs;
+    for (int i = 0; i < 60; ++i) {
+        inputs["close"].push_back(10 + std::sin(i * 0.3) * 2 + i * 0.05);
+        inputs["open"].push_back(10 + std::sin(i * 0.3 - 0.4) * 2 + i * 0.05);
+        inputs["high"].push_back(inputs["close"].back() + 0.5 + (i % 3) * 0.1);
+        inputs["low"].push_back(inputs["open"].back() - 0.5 - (i % 4) * 0.1);
+    }
+    for (const std::string& script : scripts) {
+        std::map<std::string, std::vector<double>> globals[2];
+        std::string plotted[2];
+        for (int optimized = 0; optimized < 2; ++optimized) {
+            HithinkCompiler script_compiler;
+            script_compiler.setOptimizationEnabled(optimized == 1);
+            const Bytecode code = script_compiler.compile(script);
+            PineVM vm;
+            for (const auto& pair : inputs) {
+                auto series = std::make_shared<Series>();
+                series->name = pair.first;
+                series->data = pair.second;
+                vm.registerSeries(pair.first, series);
+            }
+            vm.loadBytecode(code);
+            if (script_compiler.hadError() || vm.execute(static_cast<int>(inputs["close"].size()))) {
+                std::cout << "    [EXECUTION FAILED] " << script << std::endl;
+                return;
+            }
+            for (const auto& global : vm.getGlobalSeries()) {
+                if (auto* p = std::get_if<std::shared_ptr<Series>>(&global)) {
+                    if ((*p)->name.compare(0, 5, "__cse") == 0 || globals[optimized].count((*p)->name)) {
+                        std::cout << "    [FAIL] " << script << ": unexpected global '" << (*p)->name << "'" << std::endl;
+                        return;
+                    }
+                    globals[optimized][(*p)->name] = (*p)->data;
+                }
+            }
+            plotted[optimized] = vm.getPlottedResultsAsString();
+        }
+        bool same = globals[0].size() == globals[1].size() && plotted[0] == plotted[1];
+        for (const auto& pair : globals[0]) {
+            auto it = globals[1].find(pair.first);
+            same = same && it != globals[1].end() && it->second.size() == pair.second.size();
+            for (size_t i = 0; same && i < pair.second.size(); ++i) {
+                if (!are_equal(pair.second[i], it->second[i])) {
+                    std::cout << "    [FAIL] " << script << ": '" << pair.first << "' differs at bar " << i << ": "
+                              << pair.second[i] << " vs " << it->second[i] << std::endl;
+                    return;
+                }
+            }
+        }
+        if (!same) {
+            std::cout << "    [FAIL] " << script << ": optimized globals or plotted results differ" << std::endl;
+            std::cout << plotted[0] << std::endl << plotted[1] << std::endl;
+            return;
+        }
+    }
+    std::cout << "    [PASS] merged calls, " << scripts.size() << " scripts match unoptimized results" << std::endl;
+    passed_tests++;
+    std::cout << std::endl;
+}
+
 void test_all_functions() {
     // --- 引用函数 ---
     run_test("ama", "RESULT: ama(close, 0.1);", {{"close", {10,11,12,13,14,15,16,17,16,15}}}, 12.90678, 9);
@@ -174,6 +1429,10 @@ void test_all_functions() {
     run_test("avedev", "RESULT: avedev(close, 4);", {{"close", {2,4,4,4,5,8,8,8}}}, 1.125, 7); // mean=(5+8+8+8)/4=7.25. dev=(2.25+0.75+0.75+0.75)/4=1.125
     run_test("covar", "RESULT: covar(C, O, 4);", {{"close", {2,3,5,6}}, {"open", {3,4,4,7}}}, 2.666666, 3); // 手动计算
     run_test("slope", "RESULT: slope(close, 4);", {{"close", {10,11,12,13}}}, 1.0, 3);
+    run_test("forcast", "RESULT: forcast(close, 4);", {{"close", {10,12,11,13}}}, 12.7, 3); // 斜率 0.8，均值 11.5 在 x=1.5 处
+    run_test("relate", "RESULT: relate(C, O, 4);", {{"close", {2,3,5,6}}, {"open", {3,4,4,7}}}, 0.843274043, 3); // 8/sqrt(10*9)
+    run_test("betax", "RESULT: betax(C, O, 3);", {{"close", {2,3,5,6}}, {"open", {3,4,4,7}}}, -0.626229508, 3); // 按单根涨幅计算
+    run_test("beta", "RESULT: beta(O, 3);", {{"close", {2,3,5,6}}, {"open", {3,4,4,7}}}, -0.626229508, 3);
     run_test("std", "RESULT: std(close, 4);", {{"close", {10,12,11,13}}}, 1.290994449, 3); // Sample std dev
     run_test("stddev", "RESULT: stddev(close, 4);", {{"close", {10,12,11,13}}}, 1.290994449, 3); // Sample
     run_test("stdp", "RESULT: stdp(close, 4);", {{"close", {10,12,11,13}}}, 1.118033989, 3); // Population std dev
@@ -186,6 +1445,57 @@ void test_all_functions() {
     run_test("longcross", "RESULT: longcross(C, O);", {{"close", {9,11}}, {"open", {10,10}}}, 1.0, 1);
     run_test("not", "RESULT: not(C > 10);", {{"close", {9}}}, 1.0, 0);
 
+    // --- 字节码优化 ---
+    run_optimizer_test();
+    run_test("folded unary minus", "RESULT: C - -(2*3);", {{"close", {1,2,3}}}, 9.0, 2);
+    run_test("folded store", "A:=C; A:=(1+2)*C; RESULT: A/2;", {{"close", {2,4}}}, 6.0, 1);
+    run_cse_test();
+    run_test("shared llv", "RESULT: (C-LLV(L,3))/(HHV(H,3)-LLV(L,3));",
+             {{"close", {5,6,7,8}}, {"high", {6,7,8,9}}, {"low", {4,5,6,7}}}, 0.75, 3); // (8-5)/(9-5)
+
+    // --- 执行模式一致性 ---
+    run_kernel_test();
+    run_column_arena_test();
+    run_batch_test();
+    run_shared_input_test();
+    run_sweep_test();
+    run_last_bar_test();
+    run_tentative_bar_test();
+    run_checkpoint_test();
+    run_binary_bytecode_test();
+    run_compile_cache_test();
+    run_window_sum_test();
+    run_window_extreme_test();
+    run_window_moments_test();
+    run_window_regression_test();
+    run_bars_counting_test();
+    {
+        std::vector<double> c, h, l, o;
+        for (int i = 0; i < 60; ++i) {
+            double base = 100 + 10 * std::sin(i * 0.3) + i * 0.2;
+            c.push_back(base);
+            o.push_back(base - std::cos(i * 0.7));
+            h.push_back(base + 1.5 + std::sin(i * 1.1));
+            l.push_back(base - 1.5 - std::cos(i * 0.9));
+        }
+        std::map<std::string, std::vector<double>> ohlc = {{"close", c}, {"open", o}, {"high", h}, {"low", l}};
+        run_mode_equivalence_test("kdj",
+            "RSV:=(CLOSE-LLV(LOW,9))/(HHV(HIGH,9)-LLV(LOW,9))*100; K:SMA(RSV,3,1); D:SMA(K,3,1); J:3*K-2*D;", ohlc);
+        run_mode_equivalence_test("macd",
+            "DIF:EMA(CLOSE,12)-EMA(CLOSE,26); DEA:EMA(DIF,9); MACD:(DIF-DEA)*2;", ohlc);
+        run_mode_equivalence_test("two_rsi",
+            "R1:rsi(C,6); R2:rsi(C,12); X:cross(R1,R2) AND C>O; Y:ref(C,1)/C[2]-1;", ohlc);
+        run_mode_equivalence_test("scalar_temps",
+            "X:(C-O)*(H-L)/((H+L)/2-O)+C[1]*2-(C-O)[1]; Y:MA((H-L)/2,3)+(C+O)/(C-O+1);", ohlc, 12);
+        run_streaming_test("kdj",
+            "RSV:=(CLOSE-LLV(LOW,9))/(HHV(HIGH,9)-LLV(LOW,9))*100; K:SMA(RSV,3,1); D:SMA(K,3,1); J:3*K-2*D;", ohlc);
+        run_streaming_test("lookback",
+            "A:REF(C,5)+C[2]; B:MA(A,4)-HV(H,3); E:EMA(C-O,5); X:cross(E,0)+rsi(C,6);", ohlc);
+        run_streaming_test("dynamic_ref", "N:=BARSLAST(C>O)+1; X:REF(C,N)+MA(O,3);", ohlc, "close");
+        // BETA 隐式读取 CLOSE，脚本不引用 CLOSE 时收盘价也要保留足够的历史
+        run_streaming_test("implicit_close", "B:BETA(O,20);", ohlc);
+    }
+
     // --- 输入函数 ---
     // Note: input.* functions are special, they don't really compute on series
     // They are meant to provide parameters. We test if they correctly return the default value.
@@ -229,8 +1539,8 @@ void print_summary() {
         {"tan", "[ OK ]"},
         {"if", "[ OK ]"}, {"ifc", "[STUB]"}, {"iff", "[STUB]"}, {"ifn", "[STUB]"},
         {"testskip", "[TODO]"}, {"valuewhen", "[ OK ]"},
-        {"avedev", "[ OK ]"}, {"beta", "[TODO]"}, {"betax", "[TODO]"}, {"covar", "[ OK ]"},
-        {"devsq", "[STUB]"}, {"forcast", "[TODO]"}, {"relate", "[TODO]"}, {"slope", "[ OK ]"},
+        {"avedev", "[ OK ]"}, {"beta", "[ OK ]"}, {"betax", "[ OK ]"}, {"covar", "[ OK ]"},
+        {"devsq", "[STUB]"}, {"forcast", "[ OK ]"}, {"relate", "[ OK ]"}, {"slope", "[ OK ]"},
         {"std", "[ OK ]"}, {"stddev", "[ OK ]"}, {"stdp", "[ OK ]"}, {"var", "[ OK ]"},
         {"varp", "[ OK ]"},
         {"cross", "[ OK ]"}, {"downnday", "[TODO]"}, {"every", "[ OK ]"}, {"exist", "[ OK ]"},